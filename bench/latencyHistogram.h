@@ -0,0 +1,105 @@
+#ifndef __LATENCYHISTOGRAM__
+#define __LATENCYHISTOGRAM__
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief
+ * HDR风格的延迟直方图，按2的幂划分区间，每个区间再线性划分为固定数量的子桶。
+ * 记录只进行一次数组自增，相对误差不超过1/subBucketCount，可以在每次调用后记录
+ * @note 非线程安全，每个线程使用自己的直方图，结束后合并
+ */
+class latencyHistogram {
+public:
+  //子桶数量的位数，精度约为三位有效数字
+  static constexpr unsigned subBucketBits = 7;
+  static constexpr uint64_t subBucketCount = 1ULL << subBucketBits;
+
+  latencyHistogram() : counts((64 - subBucketBits + 1) * subBucketCount) {}
+
+  /**
+   * @brief 记录一个取值
+   * @param value 取值，通常为纳秒
+   */
+  void record(uint64_t value) {
+    counts[indexOf(value)]++;
+    total++;
+    maxValue = std::max(maxValue, value);
+  }
+
+  /**
+   * @brief 将另一个直方图的记录合并进来
+   */
+  void merge(const latencyHistogram &other) {
+    for (size_t i = 0; i < counts.size(); i++) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    maxValue = std::max(maxValue, other.maxValue);
+  }
+
+  /**
+   * @brief 获取百分位数
+   * @param percentile 百分位，取值0到100
+   * @return 返回该百分位所在子桶的上界，不超过记录的最大值；没有记录时返回0
+   */
+  uint64_t valueAtPercentile(double percentile) const {
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return std::min(highestValueOf(i), maxValue);
+      }
+    }
+    return maxValue;
+  }
+
+  /**
+   * @brief 获取记录的最大值
+   */
+  uint64_t getMax() const { return maxValue; }
+
+  /**
+   * @brief 获取记录的数量
+   */
+  uint64_t getCount() const { return total; }
+
+private:
+  /**
+   * @brief 计算取值所在的子桶，小于subBucketCount的取值精确记录
+   */
+  static size_t indexOf(uint64_t value) {
+    if (value < subBucketCount) {
+      return value;
+    }
+    unsigned shift = std::bit_width(value) - 1 - subBucketBits;
+    return (shift + 1) * subBucketCount +
+           ((value >> shift) - subBucketCount);
+  }
+
+  /**
+   * @brief 计算子桶中的最大取值
+   */
+  static uint64_t highestValueOf(size_t index) {
+    if (index < subBucketCount) {
+      return index;
+    }
+    unsigned shift = index / subBucketCount - 1;
+    uint64_t lowest = (index % subBucketCount + subBucketCount) << shift;
+    return lowest + (1ULL << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+  uint64_t maxValue = 0;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "../code/mmapBuffer.h"
+#include "latencyHistogram.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief
+ * 写入性能基准测试。对线程数、记录大小、缓存块大小、最大缓存块数量和写出期限的所有组合运行，
+ * 输出吞吐量和每次try_append的延迟分布，格式为CSV或JSON，便于比较不同版本。
+ *
+ * 用法: bench [--scenario=cpu,disk] [--threads=1,4] [--record-size=100]
+ *             [--block-size=4194304] [--max-blocks=4] [--flush-deadline=0]
+ *             [--records=1000000] [--dir=.] [--format=csv|json]
+ * 列表参数以逗号分隔，records为每组参数下所有线程写入的记录总数。
+ *
+ * cpu场景使用匿名内存缓存块，最大缓存块数量按数据总量放大，写入线程不会等待持久化，
+ * 测量的是写入路径本身的开销；disk场景使用磁盘文件缓存块和给定的最大缓存块数量，
+ * 数据总量远大于缓存容量时写入线程快于持久化，测量的是磁盘限速时的写入延迟
+ */
+
+namespace {
+
+struct benchConfig {
+  std::string scenario;
+  size_t threads = 1;
+  size_t recordSize = 100;
+  size_t blockSize = 4 * 1024 * 1024;
+  size_t maxBlocks = 4;
+  unsigned flushDeadline = 0;
+  size_t records = 0; //每个线程写入的记录数量
+};
+
+struct benchResult {
+  double appendSeconds = 0; //所有写入线程完成的时间
+  double drainSeconds = 0;  //之后等待缓存全部持久化的时间
+  latencyHistogram latency;
+};
+
+/**
+ * @brief 解析逗号分隔的数值列表
+ */
+std::vector<size_t> parseList(const std::string &text) {
+  std::vector<size_t> values;
+  size_t begin = 0;
+  while (begin <= text.size()) {
+    size_t end = text.find(',', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    if (end > begin) {
+      values.push_back(std::strtoull(text.c_str() + begin, nullptr, 10));
+    }
+    begin = end + 1;
+  }
+  return values;
+}
+
+/**
+ * @brief 解析逗号分隔的字符串列表
+ */
+std::vector<std::string> parseNames(const std::string &text) {
+  std::vector<std::string> names;
+  size_t begin = 0;
+  while (begin <= text.size()) {
+    size_t end = text.find(',', begin);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    if (end > begin) {
+      names.push_back(text.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return names;
+}
+
+benchResult runOnce(const benchConfig &config, const std::string &dir,
+                    size_t runIndex) {
+  std::string name = "BENCH" + std::to_string(runIndex);
+  std::string dataPath = dir + "/bench_" + std::to_string(runIndex) + ".dat";
+  std::string bufferPath = dir + "/bench_" + std::to_string(runIndex) + "_buf";
+  auto &ins = mmapBuffer::getBufferInstance(name);
+
+  size_t maxBlocks = config.maxBlocks;
+  if (config.scenario == "cpu") {
+    //缓存容纳全部数据，持久化不会阻塞写入
+    size_t totalBytes = config.threads * config.records * config.recordSize;
+    maxBlocks = std::max(maxBlocks, totalBytes / config.blockSize + 2);
+    ins->setBlockBacking(blockBacking::anonymous);
+  }
+  ins->setFlushDeadline(config.flushDeadline);
+  ins->initBuffer(dataPath, bufferPath, maxBlocks, 2, config.blockSize, 10,
+                  4096);
+
+  std::vector<latencyHistogram> histograms(config.threads);
+  std::atomic_size_t ready = 0;
+  std::atomic_bool start = false;
+  std::vector<std::thread> producers;
+  for (size_t t = 0; t < config.threads; t++) {
+    producers.emplace_back([&, t] {
+      std::vector<char> record(config.recordSize, 'a' + t % 26);
+      record.back() = '\n';
+      latencyHistogram &latency = histograms[t];
+      ready++;
+      while (!start) {
+        std::this_thread::yield();
+      }
+      for (size_t i = 0; i < config.records; i++) {
+        auto begin = std::chrono::steady_clock::now();
+        ins->try_append(record.data(), record.size(), true);
+        auto end = std::chrono::steady_clock::now();
+        latency.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+                .count());
+      }
+    });
+  }
+
+  //所有线程就绪后同时开始
+  while (ready < config.threads) {
+    std::this_thread::yield();
+  }
+  auto begin = std::chrono::steady_clock::now();
+  start = true;
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  auto appended = std::chrono::steady_clock::now();
+  ins->waitForBufferPersist();
+  auto drained = std::chrono::steady_clock::now();
+
+  benchResult result;
+  result.appendSeconds =
+      std::chrono::duration<double>(appended - begin).count();
+  result.drainSeconds =
+      std::chrono::duration<double>(drained - appended).count();
+  for (const auto &histogram : histograms) {
+    result.latency.merge(histogram);
+  }
+
+  mmapBuffer::removeBufferInstance(name);
+  remove(dataPath.c_str());
+  return result;
+}
+
+void printResult(const benchConfig &config, const benchResult &result,
+                 bool json, bool first) {
+  double totalRecords = static_cast<double>(config.threads) * config.records;
+  double recordsPerSecond = totalRecords / result.appendSeconds;
+  double mbPerSecond = recordsPerSecond * config.recordSize / (1024 * 1024);
+  const latencyHistogram &latency = result.latency;
+  if (json) {
+    printf("%s  {\"scenario\": \"%s\", \"threads\": %zu, \"record_size\": %zu, "
+           "\"block_size\": %zu, \"max_blocks\": %zu, \"flush_deadline_ms\": "
+           "%u, \"records\": %.0f, \"append_s\": %.6f, \"drain_s\": %.6f, "
+           "\"records_per_s\": %.0f, \"mb_per_s\": %.2f, \"p50_ns\": %lu, "
+           "\"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}",
+           first ? "" : ",\n", config.scenario.c_str(), config.threads,
+           config.recordSize, config.blockSize, config.maxBlocks,
+           config.flushDeadline, totalRecords, result.appendSeconds,
+           result.drainSeconds, recordsPerSecond, mbPerSecond,
+           latency.valueAtPercentile(50), latency.valueAtPercentile(99),
+           latency.valueAtPercentile(99.9), latency.getMax());
+  } else {
+    printf("%s,%zu,%zu,%zu,%zu,%u,%.0f,%.6f,%.6f,%.0f,%.2f,%lu,%lu,%lu,%lu\n",
+           config.scenario.c_str(), config.threads, config.recordSize,
+           config.blockSize, config.maxBlocks, config.flushDeadline,
+           totalRecords, result.appendSeconds, result.drainSeconds,
+           recordsPerSecond, mbPerSecond, latency.valueAtPercentile(50),
+           latency.valueAtPercentile(99), latency.valueAtPercentile(99.9),
+           latency.getMax());
+  }
+  fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> scenarios = {"cpu", "disk"};
+  std::vector<size_t> threads = {1, 4};
+  std::vector<size_t> recordSizes = {100};
+  std::vector<size_t> blockSizes = {4 * 1024 * 1024};
+  std::vector<size_t> maxBlocks = {4};
+  std::vector<size_t> flushDeadlines = {0};
+  size_t records = 1000000;
+  std::string dir = ".";
+  bool json = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--scenario") {
+      scenarios = parseNames(value);
+    } else if (key == "--threads") {
+      threads = parseList(value);
+    } else if (key == "--record-size") {
+      recordSizes = parseList(value);
+    } else if (key == "--block-size") {
+      blockSizes = parseList(value);
+    } else if (key == "--max-blocks") {
+      maxBlocks = parseList(value);
+    } else if (key == "--flush-deadline") {
+      flushDeadlines = parseList(value);
+    } else if (key == "--records") {
+      records = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (key == "--dir") {
+      dir = value;
+    } else if (key == "--format") {
+      json = value == "json";
+    } else {
+      fprintf(stderr,
+              "usage: %s [--scenario=cpu,disk] [--threads=1,4] "
+              "[--record-size=100] [--block-size=4194304] [--max-blocks=4] "
+              "[--flush-deadline=0] [--records=1000000] [--dir=.] "
+              "[--format=csv|json]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("scenario,threads,record_size,block_size,max_blocks,"
+           "flush_deadline_ms,records,append_s,drain_s,records_per_s,"
+           "mb_per_s,p50_ns,p99_ns,p999_ns,max_ns\n");
+  }
+  size_t runIndex = 0;
+  for (const auto &scenario : scenarios) {
+    for (size_t threadCount : threads) {
+      for (size_t recordSize : recordSizes) {
+        for (size_t blockSize : blockSizes) {
+          for (size_t maxBlockCount : maxBlocks) {
+            for (size_t deadline : flushDeadlines) {
+              benchConfig config;
+              config.scenario = scenario;
+              config.threads = std::max<size_t>(threadCount, 1);
+              config.recordSize = std::clamp<size_t>(recordSize, 1, blockSize);
+              config.blockSize = blockSize;
+              config.maxBlocks = maxBlockCount;
+              config.flushDeadline = static_cast<unsigned>(deadline);
+              config.records = records / config.threads;
+              benchResult result = runOnce(config, dir, runIndex);
+              printResult(config, result, json, runIndex == 0);
+              runIndex++;
+            }
+          }
+        }
+      }
+    }
+  }
+  if (json) {
+    printf("\n]\n");
+  }
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include "ioUring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+ioUring::ioUring(unsigned entries) {
+  ringFd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ringFd < 0) {
+    ringFd = -1;
+    return;
+  }
+
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  //较新的内核中提交队列和完成队列可以共用一次映射
+  bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMap) {
+    sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+  }
+
+  sqRingPtr = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+  if (sqRingPtr == MAP_FAILED) {
+    sqRingPtr = nullptr;
+    return;
+  }
+  if (singleMap) {
+    cqRingPtr = sqRingPtr;
+  } else {
+    cqRingPtr = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqRingPtr == MAP_FAILED) {
+      cqRingPtr = nullptr;
+      return;
+    }
+  }
+  sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqePtr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  if (sqePtr == MAP_FAILED) {
+    return;
+  }
+  sqes = reinterpret_cast<io_uring_sqe *>(sqePtr);
+
+  char *sq = reinterpret_cast<char *>(sqRingPtr);
+  sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sqRingMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = reinterpret_cast<char *>(cqRingPtr);
+  cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cqRingMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  sqeTail = *sqTail;
+}
+
+ioUring::~ioUring() {
+  if (sqes != nullptr) {
+    munmap(sqes, sqesSize);
+  }
+  if (cqRingPtr != nullptr && cqRingPtr != sqRingPtr) {
+    munmap(cqRingPtr, cqRingSize);
+  }
+  if (sqRingPtr != nullptr) {
+    munmap(sqRingPtr, sqRingSize);
+  }
+  if (ringFd >= 0) {
+    close(ringFd);
+  }
+}
+
+bool ioUring::isValid() const { return ringFd >= 0 && sqes != nullptr; }
+
+unsigned ioUring::getEntries() const { return params.sq_entries; }
+
+bool ioUring::registerBuffers(const std::vector<iovec> &buffers) {
+  if (!isValid() || buffers.empty()) {
+    return false;
+  }
+  if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+              buffers.data(), buffers.size()) < 0) {
+    return false;
+  }
+  registeredBuffers = buffers;
+  return true;
+}
+
+bool ioUring::isRegisteredBuffer(const char *buf, size_t len) const {
+  for (const iovec &buffer : registeredBuffers) {
+    const char *base = static_cast<const char *>(buffer.iov_base);
+    if (buf >= base && buf + len <= base + buffer.iov_len) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ioUring::prepareWrite(int fd, const char *buf, size_t len,
+                           uint64_t offset, uint64_t userData) {
+  //请求中的长度为32位，更长的写入由调用方拆分
+  if (len > maxWriteLen) {
+    return false;
+  }
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  if (sqeTail - head >= params.sq_entries) { //提交队列已满
+    return false;
+  }
+  unsigned index = sqeTail & *sqRingMask;
+  io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(len);
+  sqe->off = offset;
+  sqe->user_data = userData;
+
+  //数据位于已注册的固定缓冲区时，省去内核每次请求时的页面映射
+  for (size_t i = 0; i < registeredBuffers.size(); i++) {
+    const char *base = static_cast<const char *>(registeredBuffers[i].iov_base);
+    if (buf >= base && buf + len <= base + registeredBuffers[i].iov_len) {
+      sqe->opcode = IORING_OP_WRITE_FIXED;
+      sqe->buf_index = i;
+      break;
+    }
+  }
+
+  sqArray[index] = index;
+  sqeTail++;
+  __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+  toSubmit++;
+  return true;
+}
+
+int ioUring::submit(unsigned waitNr) {
+  unsigned flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, waitNr, flags,
+                  nullptr, 0);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    return -errno;
+  }
+  toSubmit -= std::min<unsigned>(ret, toSubmit);
+  return ret;
+}
+
+bool ioUring::peekCompletion(uint64_t &userData, int &result) {
+  unsigned head = *cqHead;
+  if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  io_uring_cqe *cqe = &cqes[head & *cqRingMask];
+  userData = cqe->user_data;
+  result = cqe->res;
+  __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool ioUring::waitCompletion(uint64_t &userData, int &result) {
+  while (!peekCompletion(userData, result)) {
+    if (submit(1) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
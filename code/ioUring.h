@@ -0,0 +1,113 @@
+#ifndef __IOURING__
+#define __IOURING__
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <vector>
+
+/**
+ * @brief 基于io_uring系统调用的最小异步写入封装，不依赖liburing
+ * @note 只支持单线程提交和收割，供持久化线程使用
+ */
+class ioUring {
+public:
+  //单个写入请求的长度上限，完成事件的返回值为int，内核单次写入也不超过2GB
+  static constexpr size_t maxWriteLen = 1UL << 30;
+
+  /**
+   * @brief 创建io_uring实例，内核不支持时isValid()返回false
+   * @param entries 提交队列深度
+   */
+  explicit ioUring(unsigned entries);
+
+  //删除复制构造函数
+  ioUring(const ioUring &) = delete;
+  //删除赋值运算符重载
+  ioUring &operator=(const ioUring &) = delete;
+
+  /**
+   * @brief 析构时解除队列映射并关闭io_uring实例
+   */
+  ~ioUring();
+
+  /**
+   * @brief 检查io_uring实例是否可用
+   */
+  bool isValid() const;
+
+  /**
+   * @brief 获取提交队列深度
+   */
+  unsigned getEntries() const;
+
+  /**
+   * @brief 判断[buf, buf + len)是否位于已注册的固定缓冲区中
+   */
+  bool isRegisteredBuffer(const char *buf, size_t len) const;
+
+  /**
+   * @brief 注册固定缓冲区，之后落在这些缓冲区中的写入使用IORING_OP_WRITE_FIXED
+   * @param buffers 缓冲区数组
+   * @return 注册成功返回true，内核不支持的内存类型(如普通文件映射)会注册失败
+   */
+  bool registerBuffers(const std::vector<iovec> &buffers);
+
+  /**
+   * @brief 向提交队列中添加一个写入请求，不进行系统调用
+   * @param fd 写入文件的描述符
+   * @param buf 数据指针
+   * @param len 写入长度，不超过maxWriteLen
+   * @param offset 写入偏移量
+   * @param userData 随完成事件返回的用户数据
+   * @return 提交队列已满或长度超过maxWriteLen时返回false
+   */
+  bool prepareWrite(int fd, const char *buf, size_t len, uint64_t offset,
+                    uint64_t userData);
+
+  /**
+   * @brief 提交所有已添加的请求
+   * @param waitNr 需要等待完成的请求数量
+   * @return 返回成功提交的请求数量，出错返回-errno
+   */
+  int submit(unsigned waitNr = 0);
+
+  /**
+   * @brief 阻塞等待一个完成事件
+   * @param userData 完成请求的用户数据
+   * @param result 完成请求的返回值，含义与pwrite的返回值相同，出错时为-errno
+   * @return 成功获取完成事件返回true
+   */
+  bool waitCompletion(uint64_t &userData, int &result);
+
+private:
+  /**
+   * @brief 非阻塞地获取一个完成事件
+   */
+  bool peekCompletion(uint64_t &userData, int &result);
+
+  int ringFd = -1; // io_uring实例的文件描述符
+  io_uring_params params = {};
+
+  void *sqRingPtr = nullptr; //提交队列映射
+  size_t sqRingSize = 0;
+  void *cqRingPtr = nullptr; //完成队列映射
+  size_t cqRingSize = 0;
+  io_uring_sqe *sqes = nullptr; //提交队列项数组
+  size_t sqesSize = 0;
+
+  unsigned *sqHead = nullptr;
+  unsigned *sqTail = nullptr;
+  unsigned *sqRingMask = nullptr;
+  unsigned *sqArray = nullptr;
+  unsigned *cqHead = nullptr;
+  unsigned *cqTail = nullptr;
+  unsigned *cqRingMask = nullptr;
+  io_uring_cqe *cqes = nullptr;
+
+  unsigned sqeTail = 0;   //本地维护的提交队列尾
+  unsigned toSubmit = 0;  //已添加但尚未提交的请求数量
+
+  std::vector<iovec> registeredBuffers; //已注册的固定缓冲区
+};
+
+#endif
@@ -1,4 +1,54 @@
 #include "mmapBlock.h"
+#include <cerrno>
+#include <sys/file.h>
+
+int mmapBlock::OpenBacking() {
+  switch (backing) {
+  case blockBacking::memfd: {
+    std::string name = filePath.substr(filePath.find_last_of('/') + 1);
+    return memfd_create(name.c_str(), MFD_CLOEXEC);
+  }
+  case blockBacking::shm:
+    // tmpfs不支持O_DIRECT，缓存块文件只通过映射访问
+    return LockBacking(
+        open(filePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0645));
+  default:
+    return LockBacking(
+        open(filePath.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0645));
+  }
+}
+
+int mmapBlock::LockBacking(int fd) {
+  //文件锁随描述符关闭或进程退出释放，崩溃恢复据此区分遗留文件和仍在使用的文件
+  if (fd >= 0) {
+    flock(fd, LOCK_EX | LOCK_NB);
+  }
+  return fd;
+}
+
+void mmapBlock::MapAnonymous(char *&base) {
+  void *ptr = MAP_FAILED;
+  if (blockSize >= hugePageSize) {
+    //预留的大页不足时mmap失败，退回普通匿名内存
+    size_t hugeSize =
+        (mapSize + hugePageSize - 1) / hugePageSize * hugePageSize;
+    ptr = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      mapSize = hugeSize;
+    }
+  }
+  if (ptr == MAP_FAILED) {
+    ptr = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      base = nullptr;
+      return;
+    }
+    madvise(ptr, mapSize, MADV_HUGEPAGE);
+  }
+  base = reinterpret_cast<char *>(ptr);
+}
 
 void mmapBlock::MapRegion(int fd, uint64_t file_offset, char *&base,
                           size_t map_size) {
@@ -15,58 +65,244 @@ void mmapBlock::UnMapRegion(char *base, size_t map_size) {
   munmap(base, map_size);
 }
 
-//自旋锁，实现低开销多线程同时对一个缓存块写入
 std::pair<size_t, bool> mmapBlock::append(const char *_data, size_t len) {
-  auto writePos = 0;
-  auto wirteLen = 0;
-  auto isFull = false;
-  if (usedSpace.load() == blockSize) { //缓冲区满，直接返回
+  auto [writePtr, writeLen, isFull] = reserve(len);
+  if (writeLen == 0) {
     return {0, true};
   }
-  std::shared_lock lock(mtx_writeOut); //所有写操作结束后释放锁
-  while (blockSpinLock.test_and_set()) {
-    ;
+  memcpy(writePtr, _data, writeLen);
+  commit(writeLen);
+  return {writeLen, isFull};
+}
+
+//通过fetch_add预留写入区间，实现多线程同时对一个缓存块的无锁写入
+template <producerPolicy Policy>
+std::tuple<char *, size_t, bool> mmapBlock::reserve(size_t len) {
+  size_t writePos = usedSpace.load(std::memory_order_relaxed);
+  if (writePos >= blockSize) { //缓冲区满，直接返回
+    return {nullptr, 0, true};
   }
-  if (blockSize - usedSpace.load() <= len) {
-    writePos = usedSpace.load();
-    wirteLen = blockSize - usedSpace.load();
-    usedSpace.store(blockSize);
-    isFull = true;
-    blockSpinLock.clear();
+  if constexpr (Policy == producerPolicy::single) {
+    //只有本线程修改已用空间，持久化线程通过提交计数的release-acquire看到该值
+    usedSpace.store(writePos + len, std::memory_order_relaxed);
   } else {
     writePos = usedSpace.fetch_add(len);
-    wirteLen = len;
-    blockSpinLock.clear();
   }
-  memcpy(data + writePos, _data, wirteLen);
-  return {wirteLen, isFull};
+  if (writePos >= blockSize) { //预留前缓冲区已被其他线程填满或已被封存
+    return {nullptr, 0, true};
+  }
+  //跨越block末尾的写入只预留前半部分，剩余部分由调用方在下一个block中预留
+  size_t writeLen = std::min(len, blockSize - writePos);
+  return {data + writePos, writeLen, writePos + len >= blockSize};
+}
+
+template <producerPolicy Policy> void mmapBlock::commit(size_t len) {
+  auto committed = committedSpace();
+  if constexpr (Policy == producerPolicy::single) {
+    committed.store(committed.load(std::memory_order_relaxed) + len,
+                    std::memory_order_release);
+  } else {
+    committed.fetch_add(len, std::memory_order_release);
+  }
 }
 
-bool mmapBlock::isValid() { return fd != -1 && data != nullptr; }
+template std::tuple<char *, size_t, bool>
+mmapBlock::reserve<producerPolicy::multi>(size_t len);
+template std::tuple<char *, size_t, bool>
+mmapBlock::reserve<producerPolicy::single>(size_t len);
+template void mmapBlock::commit<producerPolicy::multi>(size_t len);
+template void mmapBlock::commit<producerPolicy::single>(size_t len);
+
+bool mmapBlock::isValid() {
+  return (fd != -1 || backing == blockBacking::anonymous) && data != nullptr;
+}
+
+size_t mmapBlock::getBlockSize() const { return blockSize; }
+
+const char *mmapBlock::getData() const { return data; }
 
 int mmapBlock::getFd() const { return fd; }
 
 const std::string &mmapBlock::getFilePath() const { return filePath; }
 
-size_t mmapBlock::getUsedSpace() const { return usedSpace.load(); }
+blockBacking mmapBlock::getBacking() const { return backing; }
+
+bool mmapBlock::hasFilePath() const {
+  return backing == blockBacking::file || backing == blockBacking::shm;
+}
+
+bool mmapBlock::rename(const std::string &newPath) {
+  if (hasFilePath() && ::rename(filePath.c_str(), newPath.c_str()) != 0) {
+    return false;
+  }
+  filePath = newPath;
+  return true;
+}
+
+void mmapBlock::releaseMemory() {
+  //打洞后页面缓存和磁盘块都被释放，映射仍然有效
+  munlock(data, blockSize);
+  if (backing == blockBacking::anonymous) {
+    //私有匿名内存释放后读取得到零
+    madvise(data, blockSize, MADV_DONTNEED);
+  } else {
+    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, headerSize,
+              blockSize);
+  }
+  prefaulted = false;
+}
+
+void mmapBlock::prefault(bool lockMemory) {
+  bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+  populated = madvise(data, blockSize, MADV_POPULATE_WRITE) == 0;
+#endif
+  if (!populated) {
+    //内核不支持时预读页面，之后的首次写入只触发次缺页
+    madvise(data, blockSize, MADV_WILLNEED);
+  }
+  if (lockMemory) {
+    //超出RLIMIT_MEMLOCK时锁定失败，不影响使用
+    mlock(data, blockSize);
+  }
+  prefaulted = true;
+}
+
+bool mmapBlock::isPrefaulted() const { return prefaulted; }
+
+void mmapBlock::setOwner(const void *_owner) { owner = _owner; }
+
+const void *mmapBlock::getOwner() const { return owner; }
+
+void mmapBlock::setIdleSince(std::chrono::steady_clock::time_point time) {
+  idleSince = time;
+}
+
+std::chrono::steady_clock::time_point mmapBlock::getIdleSince() const {
+  return idleSince;
+}
+
+size_t mmapBlock::getUsedSpace() const {
+  uint64_t used = usedSpace.load();
+  return used >= sealedSpace ? 0 : std::min<size_t>(used, blockSize);
+}
 
 size_t mmapBlock::getUsedPages(unsigned int pageSize) const {
-  return (usedSpace % pageSize) == 0 ? (usedSpace / pageSize)
-                                     : (usedSpace / pageSize) + 1;
+  size_t used = getUsedSpace();
+  return (used % pageSize) == 0 ? (used / pageSize) : (used / pageSize) + 1;
+}
+
+size_t mmapBlock::getFreeSpace() const { return blockSize - getUsedSpace(); }
+
+bool mmapBlock::isEmpty() const { return 0 == getUsedSpace(); }
+
+void mmapBlock::clear() {
+  committedSpace().store(0);
+  usedSpace.store(sealedSpace);
+}
+
+bool mmapBlock::trySeal(size_t &used) {
+  uint64_t current = usedSpace.load();
+  do {
+    if (current >= blockSize) {
+      return false;
+    }
+  } while (!usedSpace.compare_exchange_weak(current, sealedSpace));
+  used = current;
+  return true;
+}
+
+void mmapBlock::releaseTail(size_t offset) {
+  //填满之后其他线程的预留都已失败，只会继续增大已用空间，回退不会覆盖有效的预留
+  uint64_t current = usedSpace.load();
+  while (current < sealedSpace &&
+         !usedSpace.compare_exchange_weak(current, offset)) {
+  }
+}
+
+bool mmapBlock::isSealed() const { return usedSpace.load() >= sealedSpace; }
+
+char *mmapBlock::reset(uint64_t sequence, size_t reserveLen) {
+  std::atomic_ref<uint64_t>(header->sequence).store(sequence);
+  setPersistedSpace(0);
+  committedSpace().store(0);
+  usedSpace.store(reserveLen);
+  return data;
 }
 
-size_t mmapBlock::getFreeSpace() const { return blockSize - usedSpace.load(); }
+void mmapBlock::resetWithTail(uint64_t sequence, size_t offset, size_t len) {
+  memmove(data, data + offset, len);
+  std::atomic_ref<uint64_t>(header->sequence).store(sequence);
+  setPersistedSpace(len);
+  committedSpace().store(len);
+  usedSpace.store(len);
+}
+
+void mmapBlock::setPersistedSpace(size_t len) {
+  std::atomic_ref<uint64_t>(header->persistedSpace).store(len);
+}
+
+uint64_t mmapBlock::getSequence() const {
+  return std::atomic_ref<uint64_t>(header->sequence).load();
+}
 
-bool mmapBlock::isEmpty() const { return 0 == usedSpace.load(); }
+void mmapBlock::zeroFillTail(size_t used, size_t len) {
+  if (len > used) {
+    memset(data + used, 0, std::min(len, blockSize) - used);
+  }
+}
 
-void mmapBlock::clear() { usedSpace.store(0); }
+bool mmapBlock::isCommitted() const {
+  //先读取提交量再读取预留量，两者相等说明此刻所有已预留的区间都已写入完成
+  return committedSpace().load(std::memory_order_acquire) == getUsedSpace();
+}
+
+void mmapBlock::waitForCommit() const {
+  while (!isCommitted()) {
+    std::this_thread::yield();
+  }
+}
+
+bool mmapBlock::isCommitted(size_t len) const {
+  return committedSpace().load(std::memory_order_acquire) >= len;
+}
+
+size_t mmapBlock::waitForCommittedPrefix() const {
+  while (true) {
+    size_t committed = committedSpace().load(std::memory_order_acquire);
+    size_t used = getUsedSpace();
+    if (committed == used) {
+      return used;
+    }
+    if (used == blockSize) {
+      return 0;
+    }
+    std::this_thread::yield();
+  }
+}
+
+void mmapBlock::setStreamOffset(uint64_t offset) { streamOffset = offset; }
+
+uint64_t mmapBlock::getStreamOffset() const { return streamOffset; }
 
 size_t mmapBlock::writeOut(int fd, size_t offset, size_t len) {
   assert(fd);
-  std::scoped_lock lk(mtx_writeOut); //等待所有写缓存操作结束
+  waitForCommit(); //等待所有写缓存操作结束
   if (len == 0) {
     len = blockSize;
   }
-  size_t writeLen = pwrite64(fd, data, len, offset);
+  //处理被信号中断和不完整的写入，单次写入不超过2GB
+  size_t writeLen = 0;
+  while (writeLen < len) {
+    ssize_t n =
+        pwrite64(fd, data + writeLen, len - writeLen, offset + writeLen);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    writeLen += n;
+  }
   return writeLen;
 }
\ No newline at end of file
@@ -1,16 +1,70 @@
 #ifndef __MMAPBLOCK__
 #define __MMAPBLOCK__
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <cstring>
 #include <mutex>
-#include <shared_mutex>
+#include <string>
 #include <sys/fcntl.h>
 #include <sys/mman.h>
 #include <sys/unistd.h>
+#include <thread>
+#include <tuple>
+
+/**
+ * @brief 缓存块文件头部，与数据区一同映射到内存，进程崩溃后用于恢复缓存块中的数据
+ */
+struct mmapBlockHeader {
+  uint64_t magic;          //文件标识，用于识别有效的缓存块文件
+  uint64_t blockSize;      //数据区大小
+  uint64_t sequence;       //缓存块启用时分配的序号，恢复时按序号顺序写入
+  uint64_t committedSpace; //数据区中已完成拷贝的数据长度
+  uint64_t cleanShutdown;  //正常关闭标志位，置位时文件中没有需要恢复的数据
+  uint64_t persistedSpace; //数据区中已写入持久化文件的前缀长度，恢复时跳过
+};
+
+/**
+ * @brief 缓存块内存的来源
+ */
+enum class blockBacking {
+  file,     //磁盘上的缓存块文件，进程崩溃后可恢复
+  shm,      //tmpfs上的缓存块文件，不产生磁盘写回，进程崩溃后可恢复，系统重启后丢失
+  memfd,    //memfd_create创建的匿名文件，不产生磁盘写回，进程退出后丢失
+  anonymous //匿名内存，优先使用大页，不产生磁盘写回，进程退出后丢失
+};
+
+/**
+ * @brief 写入线程的并发策略
+ */
+enum class producerPolicy {
+  multi, //多个线程同时写入，通过原子加法预留和提交
+  single //只有一个写入线程，预留和提交只进行普通的原子存储，没有读-改-写操作
+};
 
 class mmapBlock {
+  /**
+   * @brief 按缓存块内存的来源打开文件
+   * @return 返回文件描述符，失败时返回-1
+   */
+  int OpenBacking();
+
+  /**
+   * @brief 对磁盘和tmpfs上的缓存块文件加锁，在缓存块的生命周期内持有
+   * @param fd 打开的文件描述符，为-1时直接返回
+   * @return 返回fd
+   */
+  static int LockBacking(int fd);
+
+  /**
+   * @brief 映射匿名内存，块足够大时优先使用预留的大页，否则建议内核使用透明大页
+   * @param base 存储内存映射块的头指针
+   */
+  void MapAnonymous(char *&base);
+
   /**
    * @brief 执行内存映射
    * @param fd 被映射的文件描述符
@@ -28,22 +82,41 @@ class mmapBlock {
   void UnMapRegion(char *base, size_t map_size);
 
 public:
+  //缓存块文件头部标识
+  static constexpr uint64_t headerMagic = 0x314b4c4250414d4dULL; // "MMAPBLK1"
+  //头部占用的长度，占满一个页面，保证数据区满足O_DIRECT的对齐要求
+  static constexpr size_t headerSize = 4096;
+
+  //匿名内存使用的大页大小
+  static constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
   /**
    * @brief 内存映射缓存块构造函数
-   * @param _filePath 对应文件路径
+   * @param _filePath 对应文件路径，memfd和anonymous不在磁盘上创建文件
    * @param _blockSize 缓存块大小
+   * @param _backing 缓存块内存的来源
    * @param _prev 缓存块前驱指针
    * @param _next 缓存块后继指针
    */
   mmapBlock(const std::string &_filePath, size_t _blockSize,
+            blockBacking _backing = blockBacking::file,
             mmapBlock *_prev = nullptr, mmapBlock *_next = nullptr)
-      : filePath(_filePath), blockSize(_blockSize), prev(_prev), next(_next) {
-    fd = open(filePath.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0645);
-    if (fd > 0) {
-      if (posix_fallocate(fd, 0, blockSize) == 0) {
-        MapRegion(fd, 0, data, blockSize);
+      : prev(_prev), next(_next), filePath(_filePath), blockSize(_blockSize),
+        backing(_backing), mapSize(headerSize + _blockSize) {
+    char *base = nullptr;
+    if (backing == blockBacking::anonymous) {
+      MapAnonymous(base);
+    } else {
+      fd = OpenBacking();
+      if (fd >= 0 && posix_fallocate(fd, 0, mapSize) == 0) {
+        MapRegion(fd, 0, base, mapSize);
       }
     }
+    if (base != nullptr) {
+      header = reinterpret_cast<mmapBlockHeader *>(base);
+      *header = {headerMagic, blockSize, 0, 0, 0, 0};
+      data = base + headerSize;
+    }
   };
 
   //删除复制构造函数
@@ -55,21 +128,46 @@ public:
    * @brief 析构时解除内存映射，关闭和删除磁盘上对应的文件
    */
   ~mmapBlock() {
-    if (data != nullptr) {
-      UnMapRegion(data, blockSize);
+    if (header != nullptr) {
+      header->cleanShutdown = 1;
+      UnMapRegion(reinterpret_cast<char *>(header), mapSize);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (hasFilePath()) {
+      remove(filePath.c_str());
     }
-    close(fd);
-    remove(filePath.c_str());
   }
 
   /**
-   * @brief 向block中写入数据
+   * @brief 向block中写入数据，通过一次fetch_add预留写入区间，无锁无自旋
    * @param _data 数据指针
    * @param len 写入长度
-   * @return 返回成功写入的长度,缓存区满返回0
+   * @return
+   * 返回成功写入的长度(缓存区满返回0)，以及本次写入后block是否已满。跨越block末尾的写入只写入前半部分
    */
   std::pair<size_t, bool> append(const char *_data, size_t len);
 
+  /**
+   * @brief 在block中预留写入空间，不拷贝数据，写入完成后需调用commit提交
+   * @tparam Policy
+   * 写入线程的并发策略，single要求同一时刻只有一个线程预留和提交，且写入期间block不会被其他线程封存
+   * @param len 预留长度
+   * @return
+   * 返回预留区间的头指针、预留长度(缓存区满返回0)，以及预留后block是否已满。跨越block末尾时只预留前半部分
+   */
+  template <producerPolicy Policy = producerPolicy::multi>
+  std::tuple<char *, size_t, bool> reserve(size_t len);
+
+  /**
+   * @brief 提交预留区间中已写入完成的数据
+   * @tparam Policy 写入线程的并发策略，需与预留时一致
+   * @param len 提交长度
+   */
+  template <producerPolicy Policy = producerPolicy::multi>
+  void commit(size_t len);
+
   /**
    * @brief 检查block的有效性
    */
@@ -92,6 +190,16 @@ public:
    */
   size_t getFreeSpace() const;
 
+  /**
+   * @brief 获取block大小
+   */
+  size_t getBlockSize() const;
+
+  /**
+   * @brief 获取block的数据块头指针
+   */
+  const char *getData() const;
+
   /**
    * @brief 获取block对应的文件描述符
    */
@@ -102,18 +210,165 @@ public:
    */
   const std::string &getFilePath() const;
 
+  /**
+   * @brief 获取block内存的来源
+   */
+  blockBacking getBacking() const;
+
+  /**
+   * @brief 返回block是否对应文件系统中的文件，只有这样的block可以在崩溃后恢复
+   */
+  bool hasFilePath() const;
+
+  /**
+   * @brief 重命名block对应的文件，映射不受影响。不对应文件的block只记录新路径
+   * @param newPath 新的文件路径
+   * @return 成功返回true
+   */
+  bool rename(const std::string &newPath);
+
+  /**
+   * @brief 释放数据区占用的内存和磁盘空间，之后读取数据区得到零，再次写入时重新分配页面
+   * @note 只能在block被封存且不再被读取时调用
+   */
+  void releaseMemory();
+
+  /**
+   * @brief 预先建立数据区的可写页表映射，之后写入数据区不再触发缺页
+   * @param lockMemory 为true时同时锁定数据区内存，不会被换出
+   * @note 不修改数据区内容，可以与写入同时进行
+   */
+  void prefault(bool lockMemory);
+
+  /**
+   * @brief 返回数据区是否已经预取，releaseMemory之后需要重新预取
+   */
+  bool isPrefaulted() const;
+
+  /**
+   * @brief 设置使用该block的缓存实例，需在reset之前调用
+   */
+  void setOwner(const void *_owner);
+
+  /**
+   * @brief 获取使用该block的缓存实例，位于缓存块池中时为nullptr
+   */
+  const void *getOwner() const;
+
+  /**
+   * @brief 记录block被清空的时间，用于回收长时间空闲的缓存块
+   */
+  void setIdleSince(std::chrono::steady_clock::time_point time);
+
+  /**
+   * @brief 获取block被清空的时间
+   */
+  std::chrono::steady_clock::time_point getIdleSince() const;
+
   /**
    * @brief 返回block是否为空
    */
   bool isEmpty() const;
 
   /**
-   * @brief 清空block
+   * @brief 清空block并将其封存，封存期间拒绝所有写入，直到被reset重新启用
+   * @note 封存可以防止持有旧写指针的线程写入已经持久化的block
    */
   void clear();
 
   /**
-   * @brief 将block数据写入文件
+   * @brief 在block未满时将其封存，封存后拒绝所有写入，之前的预留区间仍可正常提交
+   * @param used 封存前的已用空间
+   * @return block已满或已封存时不进行封存，返回false
+   */
+  bool trySeal(size_t &used);
+
+  /**
+   * @brief
+   * 撤销从offset开始直到block末尾的预留，block重新接受之后的写入，
+   * 只由预留区间填满block的线程调用，之后的预留从offset开始
+   * @param offset 被撤销的预留区间在数据区中的起点
+   * @note offset之前的预留区间不受影响，仍可正常提交
+   */
+  void releaseTail(size_t offset);
+
+  /**
+   * @brief 返回block是否处于封存状态
+   */
+  bool isSealed() const;
+
+  /**
+   * @brief 清空block并重新启用写入
+   * @param sequence 启用序号，写入文件头部，崩溃恢复时按该序号排序
+   * @param reserveLen
+   * 启用的同时为调用方预留的起始空间长度，预留与启用是一次原子操作，其他线程无法抢先写入
+   * @return 返回block的数据块头指针
+   */
+  char *reset(uint64_t sequence, size_t reserveLen = 0);
+
+  /**
+   * @brief
+   * 将封存的block中[offset, offset + len)的数据移动到数据区起点后重新启用，
+   * 移动的部分视为已提交且已写入持久化文件
+   * @param sequence 启用序号
+   * @param offset 保留数据的起点
+   * @param len 保留数据的长度
+   * @note 只能在block封存且所有预留区间都已提交时调用
+   */
+  void resetWithTail(uint64_t sequence, size_t offset, size_t len);
+
+  /**
+   * @brief 记录数据区中已写入持久化文件的前缀长度，崩溃恢复时不再重复写入该部分
+   */
+  void setPersistedSpace(size_t len);
+
+  /**
+   * @brief 获取block的启用序号
+   */
+  uint64_t getSequence() const;
+
+  /**
+   * @brief 将数据长度之后直到len的部分填零，用于页对齐补足
+   * @param used 数据长度，即封存前的已用空间
+   * @param len 填零的终点，即写出长度
+   */
+  void zeroFillTail(size_t used, size_t len);
+
+  /**
+   * @brief 返回所有已预留区间的数据是否都已拷贝完成
+   */
+  bool isCommitted() const;
+
+  /**
+   * @brief 等待所有已预留区间的数据拷贝完成
+   */
+  void waitForCommit() const;
+
+  /**
+   * @brief 返回已拷贝完成的数据长度是否达到len，用于封存之后检查之前的预留区间是否都已提交
+   */
+  bool isCommitted(size_t len) const;
+
+  /**
+   * @brief 等待某一时刻所有已预留区间都拷贝完成，获取此时的已用空间，写入可以同时进行
+   * @return 返回数据全部拷贝完成的前缀长度；缓存块在此期间被填满而未全部提交时返回0
+   * @note
+   * 填满缓存块的线程在调整写指针后才会提交，可能正在等待持久化线程，因此缓存块满时不再等待
+   */
+  size_t waitForCommittedPrefix() const;
+
+  /**
+   * @brief 设置block起始位置在整个数据流中的偏移量，需在reset之前调用
+   */
+  void setStreamOffset(uint64_t offset);
+
+  /**
+   * @brief 获取block起始位置在整个数据流中的偏移量
+   */
+  uint64_t getStreamOffset() const;
+
+  /**
+   * @brief 将block数据写入文件，写入前等待所有进行中的append完成
    * @param fd 写入文件的描述符
    * @param offset 写入偏移量
    * @param len 写入长度，默认为整个block的大小
@@ -126,16 +381,41 @@ public:
   mmapBlock *next; // block后继指针
 
 private:
-  char *data = nullptr; // block的数据块头指针
-  int fd = -1;          // block对应的文件描述符
+  mmapBlockHeader *header = nullptr; // block的文件头部指针，即映射区域的起点
+  char *data = nullptr;              // block的数据块头指针
+  int fd = -1;          // block对应的文件描述符，匿名内存为-1
   std::string filePath; // block对应的文件路径
 
   size_t blockSize = 0; // block大小
 
-  std::atomic_uint64_t usedSpace = 0;                // block被使用的空间
-  std::atomic_flag fullFlag = ATOMIC_FLAG_INIT;      // block被使用的空间
-  std::atomic_flag blockSpinLock = ATOMIC_FLAG_INIT; // 用于实现block的自旋锁
-  std::shared_mutex mtx_writeOut;                    //控制缓冲区刷新
+  blockBacking backing = blockBacking::file; // block内存的来源
+  size_t mapSize = 0; // 映射大小，使用大页时向上取整到大页大小
+
+  // block起始位置在整个数据流中的偏移量，用于生成持久化凭据
+  uint64_t streamOffset = 0;
+
+  // 使用该block的缓存实例，block可能在实例之间借用
+  std::atomic<const void *> owner = nullptr;
+
+  // block被清空的时间，只由持久化线程访问
+  std::chrono::steady_clock::time_point idleSince;
+
+  // 数据区是否已经预取
+  std::atomic_bool prefaulted = false;
+
+  // block封存时usedSpace的取值，远大于blockSize，使所有预留都失败
+  static constexpr uint64_t sealedSpace = 1ULL << 62;
+
+  // block已预留的空间，写满后可能超过blockSize，读取时需截断
+  std::atomic_uint64_t usedSpace = sealedSpace;
+  /**
+   * @brief
+   * 文件头部中已完成拷贝的数据长度，与usedSpace相等时说明没有进行中的写入。
+   * 该计数位于映射的文件中，进程崩溃后仍然保留
+   */
+  std::atomic_ref<uint64_t> committedSpace() const {
+    return std::atomic_ref<uint64_t>(header->committedSpace);
+  }
 };
 
 #endif
\ No newline at end of file
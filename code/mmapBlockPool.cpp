@@ -0,0 +1,184 @@
+#include "mmapBlockPool.h"
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <signal.h>
+#include <vector>
+
+mmapBlockPool &mmapBlockPool::getInstance() {
+  static mmapBlockPool *pool = [] {
+    auto *instance = new mmapBlockPool();
+    std::atexit([] { getInstance().shutdown(); });
+    return instance;
+  }();
+  return *pool;
+}
+
+void mmapBlockPool::setBudget(size_t bytes) {
+  std::unique_lock<std::mutex> lock(mtx);
+  budget = bytes;
+  budgetAvailable.notify_all();
+}
+
+size_t mmapBlockPool::getBudget() const {
+  std::unique_lock<std::mutex> lock(mtx);
+  return budget;
+}
+
+void mmapBlockPool::setMaxIdleBlocks(size_t count) {
+  std::vector<mmapBlock *> evicted;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    maxIdleBlocks = count;
+    while (idleBlocks.size() > maxIdleBlocks) {
+      evicted.push_back(idleBlocks.begin()->second);
+      idleBlocks.erase(idleBlocks.begin());
+    }
+  }
+  for (mmapBlock *block : evicted) {
+    delete block;
+  }
+}
+
+size_t mmapBlockPool::getUsedBytes() const {
+  std::unique_lock<std::mutex> lock(mtx);
+  return usedBytes;
+}
+
+size_t mmapBlockPool::chargeOf(size_t blockSize) {
+  return mmapBlock::headerSize + blockSize;
+}
+
+bool mmapBlockPool::withinBudget(size_t charge) const {
+  return budget == 0 || usedBytes + charge <= budget;
+}
+
+mmapBlock *mmapBlockPool::acquire(const std::string &filePath,
+                                  size_t blockSize, blockBacking backing,
+                                  const void *owner, bool force) {
+  size_t charge = chargeOf(blockSize);
+  mmapBlock *block = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!force && !withinBudget(charge)) {
+      return nullptr;
+    }
+    usedBytes += charge;
+    auto it = idleBlocks.find({backing, blockSize});
+    if (it != idleBlocks.end()) {
+      block = it->second;
+      idleBlocks.erase(it);
+    }
+  }
+
+  //空闲缓存块重命名到借用方的路径，崩溃恢复时可以找到其中的数据
+  if (block != nullptr && !block->rename(filePath)) {
+    delete block;
+    block = nullptr;
+  }
+  if (block == nullptr) {
+    block = new mmapBlock(filePath, blockSize, backing);
+    if (!block->isValid()) {
+      delete block;
+      std::unique_lock<std::mutex> lock(mtx);
+      usedBytes -= charge;
+      budgetAvailable.notify_all();
+      return nullptr;
+    }
+  }
+  block->setOwner(owner);
+  return block;
+}
+
+void mmapBlockPool::release(mmapBlock *block) {
+  namespace fs = std::filesystem;
+  //清空预留和提交计数以及数据流偏移量，再次借出的缓存块总是从封存的空状态开始
+  block->clear();
+  block->setStreamOffset(0);
+  block->setOwner(nullptr);
+  bool keep = false;
+  uint64_t sequence = 0;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    usedBytes -= chargeOf(block->getBlockSize());
+    //先占用空闲位置，释放内存和重命名在锁外进行
+    keep = !shuttingDown && idleBlocks.size() + pendingIdle < maxIdleBlocks;
+    pendingIdle += keep ? 1 : 0;
+    sequence = idleSequence++;
+    budgetAvailable.notify_all();
+  }
+
+  if (keep) {
+    //释放数据区内存，以隐藏文件名保留，不会被任何实例的崩溃恢复读取
+    block->releaseMemory();
+    fs::path idlePath = fs::path(block->getFilePath()).parent_path() /
+                        (idlePrefix + std::to_string(getpid()) + "." +
+                         std::to_string(sequence));
+    bool renamed = block->rename(idlePath.string());
+    std::unique_lock<std::mutex> lock(mtx);
+    pendingIdle--;
+    if (renamed && !shuttingDown) {
+      idleBlocks.emplace(std::make_pair(block->getBacking(),
+                                        block->getBlockSize()),
+                         block);
+      return;
+    }
+  }
+  delete block;
+}
+
+void mmapBlockPool::removeStaleFiles(const std::string &directory) {
+  namespace fs = std::filesystem;
+  std::string prefix = idlePrefix;
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(directory, ec)) {
+    std::string name = entry.path().filename().string();
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    //进程异常退出时没有机会删除池中的空闲缓存块
+    pid_t pid = atoi(name.c_str() + prefix.size());
+    if (pid > 0 && pid != getpid() && kill(pid, 0) != 0 && errno == ESRCH) {
+      fs::remove(entry.path(), ec);
+    }
+  }
+}
+
+bool mmapBlockPool::waitForBudget(
+    size_t blockSize, const std::function<bool()> &ready,
+    std::chrono::steady_clock::time_point deadline) {
+  size_t charge = chargeOf(blockSize);
+  auto available = [&] { return withinBudget(charge) || ready(); };
+  std::unique_lock<std::mutex> lock(mtx);
+  waiters++;
+  bool satisfied = true;
+  if (deadline == std::chrono::steady_clock::time_point::max()) {
+    budgetAvailable.wait(lock, available);
+  } else {
+    satisfied = budgetAvailable.wait_until(lock, deadline, available);
+  }
+  waiters--;
+  return satisfied;
+}
+
+void mmapBlockPool::notifyWaiters() {
+  if (waiters == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mtx);
+  budgetAvailable.notify_all();
+}
+
+bool mmapBlockPool::hasWaiters() const { return waiters > 0; }
+
+void mmapBlockPool::shutdown() {
+  std::multimap<std::pair<blockBacking, size_t>, mmapBlock *> blocks;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    shuttingDown = true;
+    blocks.swap(idleBlocks);
+  }
+  for (auto &[size, block] : blocks) {
+    delete block;
+  }
+}
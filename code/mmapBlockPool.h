@@ -0,0 +1,145 @@
+#ifndef __MMAPBLOCKPOOL__
+#define __MMAPBLOCKPOOL__
+#include "mmapBlock.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief
+ * 进程内所有缓存实例共享的缓存块池，所有缓存块的映射大小计入同一个全局内存预算。
+ * 实例超出初始缓存块数量时从池中借用缓存块，持久化后归还，内存占用随实际负载变化
+ * @note
+ * 归还的缓存块释放数据区内存后以隐藏文件名保留在原目录，借用时重命名到借用方的缓存块路径，
+ * 省去创建和预分配文件的开销
+ */
+class mmapBlockPool {
+public:
+  /**
+   * @brief 获取缓存块池实例
+   * @note 缓存块池在进程退出前不会销毁，退出时删除池中空闲缓存块的文件
+   */
+  static mmapBlockPool &getInstance();
+
+  //删除复制构造函数
+  mmapBlockPool(const mmapBlockPool &) = delete;
+  //删除赋值运算符重载
+  mmapBlockPool &operator=(const mmapBlockPool &) = delete;
+
+  /**
+   * @brief
+   * 设置全局内存预算，为0时不限制，此时各实例的缓存块数量仍受initBuffer的_maxBlockCount限制。
+   * 设置预算后借用只受预算限制，预算耗尽时写入线程等待任意实例归还缓存块或本实例完成持久化
+   * @param bytes 所有实例的缓存块映射大小(包含头部)之和的上限
+   */
+  void setBudget(size_t bytes);
+
+  /**
+   * @brief 获取全局内存预算，0表示不限制
+   */
+  size_t getBudget() const;
+
+  /**
+   * @brief 设置池中保留的空闲缓存块数量上限，超出时归还的缓存块直接删除
+   */
+  void setMaxIdleBlocks(size_t count);
+
+  /**
+   * @brief 获取所有实例正在使用的缓存块映射大小之和
+   */
+  size_t getUsedBytes() const;
+
+  /**
+   * @brief 借用一个缓存块，优先复用池中内存来源和大小都相同的空闲缓存块，否则新建
+   * @param filePath 缓存块文件路径
+   * @param blockSize 缓存块数据区大小
+   * @param backing 缓存块内存的来源
+   * @param owner 借用的缓存实例
+   * @param force 为true时不受预算限制，用于实例的初始缓存块
+   * @return 返回处于封存状态的缓存块，超出预算或创建失败时返回nullptr
+   */
+  mmapBlock *acquire(const std::string &filePath, size_t blockSize,
+                     blockBacking backing, const void *owner,
+                     bool force = false);
+
+  /**
+   * @brief 归还缓存块，缓存块必须已经从实例的环形链表中移除且处于封存状态
+   */
+  void release(mmapBlock *block);
+
+  /**
+   * @brief 删除目录中已退出进程遗留的空闲缓存块文件，这些文件中没有需要恢复的数据
+   * @param directory 缓存块文件所在的目录
+   */
+  static void removeStaleFiles(const std::string &directory);
+
+  /**
+   * @brief 等待预算足够借用一个blockSize大小的缓存块，或者ready返回true
+   * @param blockSize 缓存块数据区大小
+   * @param ready 其他可以结束等待的条件，在持有池的互斥锁时调用
+   * @param deadline 等待的截止时间，默认一直等待
+   * @return 截止时间到达时条件仍未满足返回false
+   * @note ready依赖的状态改变后需调用notifyWaiters
+   */
+  bool waitForBudget(size_t blockSize, const std::function<bool()> &ready,
+                     std::chrono::steady_clock::time_point deadline =
+                         std::chrono::steady_clock::time_point::max());
+
+  /**
+   * @brief 唤醒waitForBudget中等待的线程，没有等待的线程时只进行一次原子读取
+   */
+  void notifyWaiters();
+
+  /**
+   * @brief 是否有线程在waitForBudget中等待
+   */
+  bool hasWaiters() const;
+
+private:
+  /**
+   * @brief 受保护的默认构造函数，只能通过getInstance获取实例
+   */
+  mmapBlockPool() = default;
+
+  //空闲缓存块文件名的前缀，后跟进程号和序号
+  static constexpr const char *idlePrefix = ".mmapBlockPool.";
+
+  /**
+   * @brief 计算缓存块计入预算的大小
+   */
+  static size_t chargeOf(size_t blockSize);
+
+  /**
+   * @brief 判断是否可以再借用charge字节，需持有mtx
+   */
+  bool withinBudget(size_t charge) const;
+
+  /**
+   * @brief 进程退出时删除池中的空闲缓存块，之后归还的缓存块直接删除
+   */
+  void shutdown();
+
+  mutable std::mutex mtx;
+  //归还缓存块或预算调整时通知等待的写入线程
+  std::condition_variable budgetAvailable;
+  //等待预算的线程数量
+  std::atomic_size_t waiters = 0;
+
+  size_t budget = 0;
+  size_t usedBytes = 0;
+  size_t maxIdleBlocks = 8;
+  bool shuttingDown = false;
+
+  //空闲缓存块，按内存来源和数据区大小索引
+  std::multimap<std::pair<blockBacking, size_t>, mmapBlock *> idleBlocks;
+  //空闲缓存块文件名的序号
+  uint64_t idleSequence = 0;
+  //正在放入池中的缓存块数量
+  size_t pendingIdle = 0;
+};
+
+#endif
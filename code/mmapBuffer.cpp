@@ -1,44 +1,212 @@
 #include "mmapBuffer.h"
+#include <algorithm>
+#include <ctime>
+#include <filesystem>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 std::mutex mmapBuffer::instenceMapMutex;
 
 std::unordered_map<std::string, std::shared_ptr<mmapBuffer>>
     mmapBuffer::bufferInstances;
 
-bool mmapBuffer::addBufferBlock(const std::string &_filePath, size_t _blockSize,
-                                mmapBlock *_insertCur) {
-  if (blockCount + 1 <= maxBlockCount) {
-    // head = nullptr,初始化block
-    if (head == nullptr) {
-      head = new mmapBlock(_filePath, _blockSize, nullptr, nullptr);
-      head->prev = head;
-      head->next = head;
-    } else {
-      _insertCur->next =
-          new mmapBlock(_filePath, _blockSize, _insertCur, _insertCur->next);
+thread_local mmapBuffer::stagingSlots mmapBuffer::localSlots;
+
+std::atomic_uint64_t mmapBuffer::nextInstanceId = 1;
+
+namespace {
+
+//合并两个等待时间，-1表示无限等待
+int earlierTimeout(int a, int b) {
+  if (a < 0) {
+    return b;
+  }
+  return b < 0 ? a : std::min(a, b);
+}
+
+} // namespace
+
+mmapBuffer::stagingSlots::~stagingSlots() {
+  //线程退出时发布剩余的暂存数据，实例析构时会等待暂存区的互斥锁
+  for (auto &[id, area] : areas) {
+    std::unique_lock<std::mutex> lock(area->mtx);
+    if (area->owner != nullptr) {
+      area->owner->publishStaging(*area);
     }
-    blockCount++;
-    return true;
-  } else {
+    area->orphaned = true;
+  }
+}
+
+bool mmapBuffer::addBufferBlock(mmapBlock *_insertCur, size_t _blockSize,
+                                bool _force) {
+  mmapBlockPool &pool = mmapBlockPool::getInstance();
+  if (!_force && pool.getBudget() == 0 && blockCount + 1 > maxBlockCount) {
+    return false;
+  }
+  std::string filePath = bufferFileBasePath + std::to_string(blockFileIndex);
+  mmapBlock *block = pool.acquire(filePath, _blockSize, backing, this, _force);
+  if (block == nullptr) {
     return false;
   }
+  blockFileIndex++;
+  block->setIdleSince(std::chrono::steady_clock::now());
+
+  // head = nullptr,初始化block
+  if (head == nullptr) {
+    head = block;
+    block->prev = block;
+    block->next = block;
+  } else {
+    block->prev = _insertCur;
+    block->next = _insertCur->next;
+    _insertCur->next->prev = block;
+    _insertCur->next = block;
+  }
+  blockCount++;
+  return true;
 }
 
 void mmapBuffer::removeBufferBlock(mmapBlock *block) {
   if (block != nullptr) {
     block->prev->next = block->next;
-    close(block->getFd());
-    remove(block->getFilePath().c_str());
-    delete block;
+    block->next->prev = block->prev;
+    if (head == block) {
+      head = block->next;
+    }
+    block->prev = nullptr;
+    block->next = nullptr;
     blockCount--;
   }
 }
 
+size_t mmapBuffer::nextBlockSize() const {
+  size_t size = blockSize;
+  size_t limit = elastic.maxBlockSize;
+  if (limit == 0) {
+    limit = blockSize * 64;
+  }
+  //已借用k个缓存块时，下一个缓存块为初始大小的growthFactor^(k+1)倍
+  unsigned factor = std::max(elastic.growthFactor, 1U);
+  for (size_t i = baseBlockCount; i <= blockCount && factor > 1 && size < limit;
+       i++) {
+    size *= factor;
+  }
+  size = std::min(size, limit) / systemPageSize * systemPageSize;
+  return std::max(size, blockSize);
+}
+
+std::vector<mmapBlock *> mmapBuffer::detachSurplusBlocks() {
+  std::vector<mmapBlock *> surplus;
+  shrinkPending = false;
+  auto now = std::chrono::steady_clock::now();
+
+  if (blockCount > baseBlockCount) {
+    //写入线程正在调整写指针时稍后重试
+    std::unique_lock<std::mutex> writeLock(writeCur_mtx, std::try_to_lock);
+    if (writeLock.owns_lock()) {
+      retireIdleBlocks(now);
+    } else {
+      scheduleShrink(now + std::chrono::milliseconds(1));
+    }
+  }
+
+  //移出缓存环之前读取写指针的线程可能仍持有这些缓存块，它们都离开后才能归还，
+  //之后读取写指针的线程不会再取得移出的缓存块
+  if (!retiredBlocks.empty()) {
+    if (ringReaders.load() == 0) {
+      surplus.swap(retiredBlocks);
+    } else {
+      scheduleShrink(now + std::chrono::milliseconds(1));
+    }
+  }
+  return surplus;
+}
+
+void mmapBuffer::scheduleShrink(std::chrono::steady_clock::time_point at) {
+  if (!shrinkPending || at < shrinkDeadline) {
+    shrinkPending = true;
+    shrinkDeadline = at;
+  }
+}
+
+void mmapBuffer::retireIdleBlocks(std::chrono::steady_clock::time_point now) {
+  //空闲缓存块位于写指针之后、持久化指针之前，空闲时间的限制避免了频繁借用和归还
+  std::vector<mmapBlock *> candidates;
+  for (mmapBlock *block = persistenceCur->prev; block != writeCur;
+       block = block->prev) {
+    //注册为io_uring固定缓冲区的缓存块按地址匹配，不能离开该实例
+    bool registered =
+        persistRing && persistRing->isRegisteredBuffer(block->getData(),
+                                                       block->getBlockSize());
+    if (!registered && block->isEmpty()) {
+      candidates.push_back(block);
+    }
+  }
+
+  //保留较小的缓存块，超出初始数量的部分从最大的开始移除
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](mmapBlock *a, mmapBlock *b) {
+                     return a->getBlockSize() > b->getBlockSize();
+                   });
+  candidates.resize(
+      std::min(candidates.size(), blockCount - baseBlockCount));
+
+  //其他实例等待预算时不等待空闲时间，立即归还
+  bool pressure = mmapBlockPool::getInstance().hasWaiters();
+  auto idleDelay = std::chrono::milliseconds(elastic.idleShrinkMs);
+  for (mmapBlock *block : candidates) {
+    auto eligibleAt = block->getIdleSince() + idleDelay;
+    if (pressure || eligibleAt <= now) {
+      removeBufferBlock(block);
+      retiredBlocks.push_back(block);
+    } else {
+      scheduleShrink(eligibleAt);
+    }
+  }
+}
+
+void mmapBuffer::releaseSurplusBlocks(const std::vector<mmapBlock *> &blocks) {
+  mmapBlockPool &pool = mmapBlockPool::getInstance();
+  for (mmapBlock *block : blocks) {
+    pool.release(block);
+  }
+  pool.notifyWaiters();
+}
+
+bool mmapBuffer::prefaultAhead() {
+  std::vector<mmapBlock *> ahead;
+  {
+    //写入线程正在调整写指针时稍后重试
+    std::unique_lock<std::mutex> writeLock(writeCur_mtx, std::try_to_lock);
+    if (!writeLock.owns_lock()) {
+      return false;
+    }
+    mmapBlock *current = writeCur;
+    if (!current->next->isEmpty()) {
+      addBufferBlock(current, nextBlockSize());
+    }
+    mmapBlock *block = current->next;
+    for (size_t i = 0; i < prefaultBlocks && block != current; i++) {
+      if (block->isEmpty() && !block->isPrefaulted()) {
+        ahead.push_back(block);
+      }
+      block = block->next;
+    }
+  }
+
+  //缓存块只在持久化步骤中移除，锁外预取期间不会被归还
+  for (mmapBlock *block : ahead) {
+    block->prefault(prefaultLock);
+  }
+  return true;
+}
+
 void mmapBuffer::initBuffer(const std::string &_persistenceFilePath,
                             const std::string &_bufferFileBasePath,
                             size_t _maxBlockCount, size_t _blockCount,
                             size_t _blockSize,
-                            unsigned int _persistenceWaitTimeOut,
+                            [[maybe_unused]] unsigned int _persistenceTimeOut,
                             unsigned int _systemPageSize) {
   std::unique_lock<std::mutex> lk(bufferMutex);
   //全局只初始化buffer一次，之后可通过其他方法更改相关配置参数
@@ -48,287 +216,2090 @@ void mmapBuffer::initBuffer(const std::string &_persistenceFilePath,
   initFlag = true;
 
   persistenceFilePath = _persistenceFilePath;
+  rotationBasePath = _persistenceFilePath;
   bufferFileBasePath = _bufferFileBasePath;
-  maxBlockCount = _maxBlockCount;
+  if (backing == blockBacking::shm) {
+    //崩溃恢复同样在tmpfs目录中查找缓存块文件
+    bufferFileBasePath =
+        (std::filesystem::path(shmDirectory) /
+         std::filesystem::path(_bufferFileBasePath).filename())
+            .string();
+  }
+  //跨越缓存块边界的数据需要在下一个缓存块中预留，至少需要两个缓存块
+  maxBlockCount = std::max<size_t>(_maxBlockCount, 2);
   blockSize = _blockSize;
-  persistenceWaitTimeOut = _persistenceWaitTimeOut;
   systemPageSize = _systemPageSize;
+  //一批暂存数据总能在一个缓存块中连续预留，单写入线程时暂存没有意义
+  stagingCapacity = producer == producerPolicy::single
+                        ? 0
+                        : std::min(stagingCapacity, blockSize / 2);
+
+  //持久化线程只在有工作时被唤醒
+  persistEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(persistEventFd >= 0);
 
   //初始化持久化写入文件
   persistenceFileFd =
       ::open(_persistenceFilePath.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0645);
   assert(persistenceFileFd >= 0);
 
-  //初始化缓存block
-  size_t initBlockCount = _blockCount;
-  for (size_t i = 0; i < initBlockCount; i++) {
-    std::string newFilePath = bufferFileBasePath + std::to_string(i);
-    addBufferBlock(newFilePath, _blockSize, head);
+  //溢出文件经过页缓存追加写入，不受O_DIRECT的对齐限制
+  if (overflow.action == overflowAction::spill) {
+    std::string spillPath = overflow.spillFilePath.empty()
+                                ? _persistenceFilePath + ".overflow"
+                                : overflow.spillFilePath;
+    spillFd = ::open(spillPath.c_str(),
+                     O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0645);
+  }
+
+  //恢复上次异常退出时缓存块中尚未持久化的数据，之后从持久化文件末尾继续写入
+  std::string tail;
+  recoverBufferFiles(tail);
+
+  //初始化缓存block，初始缓存块不受全局内存预算限制
+  baseBlockCount = std::max<size_t>(_blockCount, 1);
+  for (size_t i = 0; i < baseBlockCount; i++) {
+    addBufferBlock(head, blockSize, true);
   }
+  assert(blockCount == baseBlockCount);
 
-  //初始化写入指针和持久化指针
+  //初始化写入指针和持久化指针，新建的缓存块处于封存状态，启用第一个缓存块
   writeCur = head;
   persistenceCur = head;
+  if (tail.empty()) {
+    head->reset(blockSequence++);
+  } else {
+    //持久化文件末尾不足一页的部分作为保留的尾部，与强制持久化之后的状态相同
+    memcpy(const_cast<char *>(head->getData()), tail.data(), tail.size());
+    head->resetWithTail(blockSequence++, 0, tail.size());
+    carriedTailLen = tail.size();
+    partialFlushLen = tail.size();
+    persistedOffset = tail.size();
+  }
 
-  std::thread persistWorkThread(
-      [&] { mmapBuffer::getBufferInstance(bufferName)->persist(); });
-  //持久化线程转为后台线程，这里使用detach。当主线程终止，后台线程也会进入终止态并立即被销毁。
-  persistWorkThread.detach();
-}
-
-void mmapBuffer::changePersistFile(const std::string &_persistenceFilePath) {
-  //等待当前缓冲区数据全部持久化
-  waitForBufferPersist();
+  //第一个缓存块在此处预取，之后的缓存块由持久化线程的第一步预取
+  if (prefaultBlocks > 0) {
+    head->prefault(prefaultLock);
+    prefaultPending = true;
+  }
 
-  std::unique_lock<std::mutex> lock(bufferMutex);
+  //初始化io_uring，内核不支持时退回pwrite64
+  if (ioUringDepth > 0) {
+    persistRing = std::make_unique<ioUring>(ioUringDepth);
+    if (!persistRing->isValid()) {
+      persistRing.reset();
+    } else if (ioUringRegisterBuffers) {
+      std::vector<iovec> buffers;
+      mmapBlock *block = head;
+      for (size_t i = 0; i < blockCount; i++) {
+        buffers.push_back(
+            {const_cast<char *>(block->getData()), block->getBlockSize()});
+        block = block->next;
+      }
+      persistRing->registerBuffers(buffers);
+    }
+  }
 
-  //关闭旧持久化文件
-  close(persistenceFileFd);
+  //由调度器的后台任务准备第一个后继文件
+  if (rotation.maxBytes > 0 || rotation.intervalSeconds > 0) {
+    rotationDeadline = std::chrono::steady_clock::now() +
+                       std::chrono::seconds(rotation.intervalSeconds);
+    std::unique_lock<std::mutex> lock(rotation_mtx);
+    scheduleRotationJob();
+  }
 
-  //打开新持久化文件
-  persistenceFilePath = _persistenceFilePath;
-  persistenceFileFd =
-      ::open(persistenceFilePath.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0645);
-  assert(persistenceFileFd >= 0);
+  //持久化工作交给进程内共享的调度器，不再为每个实例创建线程
+  schedulerSourceId = persistScheduler::getInstance().addSource(
+      persistEventFd, schedulingPriority, schedulingWeight,
+      [this] { return persist(); });
+}
 
-  //重置文件长度信息
-  persistenceFileOffset = 0;
-  actualDataLen = 0;
+void mmapBuffer::setSchedulingPolicy(int priority, unsigned weight) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  schedulingPriority = priority;
+  schedulingWeight = std::max(weight, 1U);
 }
 
-void mmapBuffer::persist() {
-  using namespace std::chrono_literals;
-  while (true) {
-    assert(persistenceFileFd >= 0);
+void mmapBuffer::enableIoUring(unsigned queueDepth, bool registerBuffers) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  ioUringDepth = queueDepth;
+  ioUringRegisterBuffers = registerBuffers;
+}
 
-    //涉及条件变量，使用互斥锁保护
-    std::unique_lock<std::mutex> lock(persistCur_mtx);
+size_t mmapBuffer::recoverBufferFiles(std::string &tail) {
+  namespace fs = std::filesystem;
+  struct leftoverBlock {
+    size_t fileIndex; //在bufferFiles中的下标
+    int fd;
+    mmapBlockHeader header;
+  };
 
-    if (persistenceCur->getFreeSpace() > 0) {
-      //当持久化区块未满时，写入指针和持久化指针应该指向同一个区块
-      assert(writeCur == persistenceCur);
+  //缓存块文件名为基础文件名后跟编号
+  fs::path basePath(bufferFileBasePath);
+  fs::path dir = basePath.parent_path().empty() ? fs::path(".")
+                                                : basePath.parent_path();
+  std::string prefix = basePath.filename().string();
+  mmapBlockPool::removeStaleFiles(dir.string());
+  std::error_code ec;
+  std::vector<std::pair<std::string, int>> bufferFiles;
+  for (const auto &entry : fs::directory_iterator(dir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (name.size() <= prefix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        !std::all_of(name.begin() + prefix.size(), name.end(), ::isdigit)) {
+      continue;
+    }
+    //缓存块在生命周期内持有文件锁，加锁失败说明文件属于仍在运行的实例，不恢复也不删除
+    int fd = ::open(entry.path().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+      close(fd);
+      continue;
+    }
+    bufferFiles.emplace_back(entry.path().string(), fd);
+  }
 
-      //线程等待缓存区满，若等待超时，则进一步判断强制写入标志位
-      blockIsFull.wait_for(
-          lock, std::chrono_literals::operator""ms(persistenceWaitTimeOut),
-          [&] { return persistenceCur->getFreeSpace() == 0; });
+  //读取文件头部，筛选出非正常关闭且存在已提交数据的缓存块
+  std::vector<leftoverBlock> leftovers;
+  for (size_t i = 0; i < bufferFiles.size(); i++) {
+    int fd = bufferFiles[i].second;
+    mmapBlockHeader header = {};
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header.magic == mmapBlock::headerMagic && !header.cleanShutdown &&
+        header.committedSpace > header.persistedSpace) {
+      header.committedSpace = std::min(header.committedSpace, header.blockSize);
+      leftovers.push_back({i, fd, header});
     }
+  }
+  std::sort(leftovers.begin(), leftovers.end(),
+            [](const leftoverBlock &a, const leftoverBlock &b) {
+              return a.header.sequence < b.header.sequence;
+            });
 
-    //若缓存区满，则开始持久化
-    //若缓存区未满而执行强制持久化在mmap情景下效率降低，因为缓存不会因为程序崩溃而丢失，所以大可以等到缓存区块满了再进行持久化
-    if (persistenceCur->getFreeSpace() == 0) {
-      size_t writeLen = 0;
-      size_t actualLen = persistenceCur->getUsedSpace();
+  //无论是否有需要恢复的数据，都从持久化文件末尾继续写入。
+  //未压缩时末尾不足一页的部分读入页面缓冲区，与之后的数据拼接后原地重写，文件中不留空洞；
+  //压缩帧按页面对齐，末尾向上对齐
+  struct stat fileStat = {};
+  fstat(persistenceFileFd, &fileStat);
+  size_t fileLen = fileStat.st_size;
+  char *tailPage = nullptr;
+  if (posix_memalign(reinterpret_cast<void **>(&tailPage), systemPageSize,
+                     systemPageSize) != 0) {
+    tailPage = nullptr;
+  }
+  size_t tailLen = 0;
+  //分帧模式下解码后的数据流需要与缓存块的页面对齐，记录已有压缩帧解码后的长度
+  uint64_t decodedLen = 0;
+  if (persistCodec) {
+    persistenceFileOffset =
+        (fileLen + systemPageSize - 1) / systemPageSize * systemPageSize;
+    if (recordFraming && tailPage != nullptr) {
+      decodedLen = decodedFileLen(fileLen, tailPage);
+    }
+  } else {
+    persistenceFileOffset = fileLen / systemPageSize * systemPageSize;
+    actualDataLen = fileLen;
+    tailLen = fileLen - persistenceFileOffset;
+    if (tailLen > 0 && (tailPage == nullptr ||
+                        pread(persistenceFileFd, tailPage, systemPageSize,
+                              persistenceFileOffset) !=
+                            static_cast<ssize_t>(tailLen))) {
+      //无法读取末尾时从下一页开始写入
+      persistenceFileOffset += systemPageSize;
+      tailLen = 0;
+    }
+  }
 
-      //进行写入对齐，对齐到页面大小的整数倍
-      writeLen = blockSize;
+  //按顺序写出，某个缓存块无法完整写出时回到该缓存块之前的位置并停止，之后的缓存块不再写出
+  size_t recoveredLen = 0;
+  size_t recoveredCount = 0;
+  bool failed = tailPage == nullptr;
+  if (failed) {
+    recordPersistError(ENOMEM);
+  }
+  for (const auto &leftover : leftovers) {
+    if (failed) {
+      break;
+    }
+    size_t mapLen = mmapBlock::headerSize + leftover.header.blockSize;
+    void *base = mmap(nullptr, mapLen, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                      leftover.fd, 0);
+    if (base == MAP_FAILED) {
+      recordPersistError(errno);
+      failed = true;
+      break;
+    }
+    //已经写入持久化文件的前缀不再重复写入
+    size_t skipLen = std::min(leftover.header.persistedSpace,
+                              leftover.header.committedSpace);
+    const char *blockData =
+        static_cast<const char *>(base) + mmapBlock::headerSize + skipLen;
+    size_t dataLen = leftover.header.committedSpace - skipLen;
+    size_t startOffset = persistenceFileOffset;
+    uint64_t startDecodedLen = decodedLen;
+    std::string startTail(tailPage, tailLen);
 
-      //持久化数据
-      persistenceCur->writeOut(persistenceFileFd, persistenceFileOffset,
-                               writeLen);
+    if (persistCodec) {
+      //设置了压缩算法时恢复的数据同样写为压缩帧，未分帧时不补零，解码后的数据没有空洞。
+      //分帧模式下从缓存块起点开始的数据先补零到页面边界，接续已写出前缀的数据保持原有位置，
+      //结尾补零到缓存块中的页面边界，解码后的数据流与缓存块的页面对齐
+      std::string data;
+      if (recordFraming && skipLen % systemPageSize == 0) {
+        data.assign(paddingLen(decodedLen), '\0');
+      }
+      data.append(blockData, dataLen);
+      if (recordFraming) {
+        data.append(paddingLen(skipLen + dataLen), '\0');
+      }
+      size_t frameLen =
+          writeFrame(data.data(), data.size(), persistenceFileOffset);
+      failed = frameLen == 0;
+      persistenceFileOffset += frameLen;
+      decodedLen += data.size();
+    } else {
+      //与末尾不足一页的部分拼接，整页写出，之后的整页在映射地址对齐时直接写出
+      size_t pos = 0;
+      while (pos < dataLen && !failed) {
+        if (tailLen == 0 && dataLen - pos >= systemPageSize &&
+            reinterpret_cast<uintptr_t>(blockData + pos) % systemPageSize ==
+                0) {
+          size_t alignedLen =
+              (dataLen - pos) / systemPageSize * systemPageSize;
+          failed = !writeFully(blockData + pos, alignedLen,
+                               persistenceFileOffset);
+          persistenceFileOffset += alignedLen;
+          pos += alignedLen;
+          continue;
+        }
+        size_t copyLen = std::min(systemPageSize - tailLen, dataLen - pos);
+        memcpy(tailPage + tailLen, blockData + pos, copyLen);
+        tailLen += copyLen;
+        pos += copyLen;
+        if (tailLen == systemPageSize) {
+          failed = !writeFully(tailPage, systemPageSize, persistenceFileOffset);
+          persistenceFileOffset += systemPageSize;
+          tailLen = 0;
+        }
+      }
+    }
+    munmap(base, mapLen);
+    if (failed) {
+      //之后的数据从该缓存块写出之前的位置继续，覆盖写入了一部分的数据
+      persistenceFileOffset = startOffset;
+      decodedLen = startDecodedLen;
+      tailLen = startTail.size();
+      memcpy(tailPage, startTail.data(), tailLen);
+      break;
+    }
+    actualDataLen += dataLen;
+    recoveredLen += dataLen;
+    recoveredCount++;
+  }
 
-      //更新持久化文件长度
-      persistenceFileOffset += writeLen;
-      actualDataLen += actualLen;
+  //分帧模式下压缩时写入补零帧，新的缓存块从解码后数据流的页面边界开始
+  bool flushed = true;
+  if (persistCodec && recordFraming && paddingLen(decodedLen) > 0) {
+    std::string padding(paddingLen(decodedLen), '\0');
+    size_t frameLen =
+        writeFrame(padding.data(), padding.size(), persistenceFileOffset);
+    flushed = frameLen != 0;
+    persistenceFileOffset += frameLen;
+  }
 
-      //清空buffer block(状态置为free)
-      persistenceCur->clear();
+  //不足一页的末尾补零写出后交给调用方，作为第一个缓存块保留的尾部，之后原地重写该页面
+  if (tailLen > 0) {
+    memset(tailPage + tailLen, 0, systemPageSize - tailLen);
+    if (recoveredLen > 0 && flushed) {
+      flushed = writeFully(tailPage, systemPageSize, persistenceFileOffset);
+    }
+    tail.assign(tailPage, tailLen);
+  }
+  free(tailPage);
 
-      //缓存持久化指针后移,若持久化指针和写指针相同，则说明当前缓存块是刚刚好满的状态，则不移动持久化指针
-      if (persistenceCur != writeCur) {
-        persistenceCur = persistenceCur->next;
-      }
+  //恢复的数据全部写出并落盘之后才能删除对应的缓存块文件，否则保留所有遗留文件
+  if (recoveredCount > 0 && flushed && fdatasync(persistenceFileFd) != 0) {
+    recordPersistError(errno);
+    flushed = false;
+  }
+  if (!flushed) {
+    recoveredCount = 0;
+  }
+  //出错时保留未完整写出的遗留缓存块文件，等待下次启动时再次恢复。新的缓存块文件编号和启用序号
+  //排在保留的文件之后，不覆盖保留的文件，再次恢复时保留的数据排在本次运行的数据之前
+  std::vector<bool> keep(bufferFiles.size(), false);
+  for (size_t i = recoveredCount; i < leftovers.size(); i++) {
+    keep[leftovers[i].fileIndex] = true;
+    blockSequence = std::max<uint64_t>(blockSequence,
+                                       leftovers[i].header.sequence + 1);
+  }
+  for (size_t i = 0; i < bufferFiles.size(); i++) {
+    const auto &[path, fd] = bufferFiles[i];
+    if (keep[i]) {
+      std::string index = fs::path(path).filename().string().substr(
+          prefix.size());
+      blockFileIndex = std::max<size_t>(blockFileIndex, std::stoull(index) + 1);
+    } else {
+      remove(path.c_str());
+    }
+    close(fd);
+  }
+  return recoveredLen;
+}
 
-      lock.unlock();
-      //发送持久化完成信号
-      blockPersistenceDone.notify_all();
+uint64_t mmapBuffer::decodedFileLen(size_t fileLen, char *pageBuffer) {
+  uint64_t decodedLen = 0;
+  size_t pos = 0;
+  while (pos < fileLen) {
+    mmapFrameHeader header = {};
+    if (pread(persistenceFileFd, pageBuffer, systemPageSize, pos) <
+        static_cast<ssize_t>(sizeof(header))) {
+      break;
+    }
+    memcpy(&header, pageBuffer, sizeof(header));
+    if (header.magic == 0) {
+      //补零的页面
+      pos += systemPageSize;
       continue;
-    } else if (forcePersist &&
-               persistenceCur->getUsedSpace() != 0) { //检测强制持久化标志位
-      //只有当缓冲区未满的时候才有可能调用强制持久化，此时写指针和持久化指针应指向同一block
-      assert(writeCur == persistenceCur);
+    }
+    if (header.magic != mmapCodec::frameMagic) {
+      break;
+    }
+    decodedLen += header.rawLen;
+    size_t frameLen = sizeof(header) + header.compressedLen;
+    pos += (frameLen + systemPageSize - 1) / systemPageSize * systemPageSize;
+  }
+  return decodedLen;
+}
+
+size_t mmapBuffer::paddingLen(uint64_t offset) const {
+  return (systemPageSize - offset % systemPageSize) % systemPageSize;
+}
 
-      size_t writeLen = 0;
-      size_t actualLen = persistenceCur->getUsedSpace();
+void mmapBuffer::enableRecordFraming() {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  recordFraming = true;
+}
 
-      //进行写入对齐，对齐到页面大小的整数倍
-      writeLen = persistenceCur->getUsedPages(systemPageSize) * systemPageSize;
+void mmapBuffer::setCodec(std::shared_ptr<mmapCodec> codec) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  persistCodec = std::move(codec);
+}
 
-      //持久化数据
-      persistenceCur->writeOut(persistenceFileFd, persistenceFileOffset,
-                               writeLen);
+void mmapBuffer::setFlushDeadline(unsigned int deadlineMs) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  flushDeadline = deadlineMs;
+}
 
-      //更新持久化文件长度,这里不计入写入对齐时候的补足长度
-      persistenceFileOffset += writeLen;
-      actualDataLen += actualLen;
+void mmapBuffer::enableThreadStaging(size_t stagingSize,
+                                     unsigned publishIntervalMs) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  stagingCapacity = stagingSize;
+  stagingPublishMs = publishIntervalMs;
+}
 
-      //清空buffer block(状态置为free)
-      persistenceCur->clear();
+void mmapBuffer::setBlockBacking(blockBacking _backing) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  backing = _backing;
+}
 
-      //重置强制持久化标志位
-      forcePersist = false;
+void mmapBuffer::setProducerPolicy(producerPolicy policy) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  producer = policy;
+}
 
-      //发送持久化完成信号
-      blockPersistenceDone.notify_all();
-    } else if (persistenceCur->isEmpty()) {
-      bufferEmpty = true;
-      lock.unlock();
-      //发送信号
-      bufferIsEmpty.notify_all();
-      blockPersistenceDone.notify_all();
-      continue;
-    }
+void mmapBuffer::setOverflowPolicy(const overflowPolicy &policy) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
   }
+  overflow = policy;
 }
 
-void mmapBuffer::waitForBufferPersist() {
-  //获取整体的缓存锁，涉及条件变量，使用互斥锁保护
-  std::unique_lock<std::mutex> lock(persistCur_mtx);
-  //设置缓存不可写
-  enableWrite = false;
-  //设定强制写入标志位
-  forcePersist = true;
-  //等待持久化完成
-  bufferIsEmpty.wait(lock, [&] { return bufferEmpty; });
-  //恢复缓存可写
-  enableWrite = true;
-  lock.unlock();
-  enableWriteFlagChanged.notify_all();
+void mmapBuffer::setCoroutineExecutor(
+    std::function<void(std::coroutine_handle<>)> executor) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  coroutineExecutor = std::move(executor);
+}
+
+void mmapBuffer::setRotationPrologue(
+    std::function<std::vector<std::string>()> prologue) {
+  //持久化线程在rotation_mtx内调用，替换后不会再调用旧的函数
+  std::unique_lock<std::mutex> lock(rotation_mtx);
+  rotationPrologue = std::move(prologue);
+}
+
+uint64_t mmapBuffer::getDroppedBytes() const { return droppedBytes; }
+
+uint64_t mmapBuffer::getSpilledBytes() const { return spilledBytes; }
+
+void mmapBuffer::setPrefaultPolicy(size_t blocksAhead, bool lockMemory) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  prefaultBlocks = blocksAhead;
+  prefaultLock = lockMemory;
+}
+
+void mmapBuffer::setRotationPolicy(const rotationPolicy &policy) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  rotation = policy;
+}
+
+void mmapBuffer::setElasticPolicy(const elasticPolicy &policy) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  elastic = policy;
+}
+
+const std::string &mmapBuffer::getPersistenceFilePath() const {
+  return persistenceFilePath;
 }
 
-bool mmapBuffer::try_append(char *data, size_t len, bool noLose) {
-  // //存在写入动作，设置缓冲区空标志位为false
-  bufferEmpty = false;
+std::string mmapBuffer::makeRotationPath(size_t index) const {
+  std::string path = rotation.namePattern.empty()
+                         ? rotationBasePath + ".{n}"
+                         : rotation.namePattern;
+  for (size_t pos = path.find("{n}"); pos != std::string::npos;
+       pos = path.find("{n}", pos)) {
+    path.replace(pos, 3, std::to_string(index));
+  }
 
-  //写入缓存块，如果写入长度不符，则说明缓存块已满
-  auto [actualLen, isFull] = writeCur->append(data, len);
+  time_t now = time(nullptr);
+  struct tm localTime = {};
+  localtime_r(&now, &localTime);
+  char expanded[PATH_MAX];
+  size_t len = strftime(expanded, sizeof(expanded), path.c_str(), &localTime);
+  return len == 0 ? path : std::string(expanded, len);
+}
 
-  if (actualLen == 0) {
-    //缓冲区已经是满的状态，需要等待指针调整
-    //这里的等待队列是使用notify_one唤醒的
-    std::unique_lock<std::mutex> lock(writeCur_mtx);
-    while (writeCur->getFreeSpace() == 0) {
-      writeCur_cv.wait(lock);
+void mmapBuffer::prepareRotation() {
+  namespace fs = std::filesystem;
+  std::unique_lock<std::mutex> lock(rotation_mtx);
+  while (true) {
+    //关闭切换后的旧文件，关闭可能因回写而耗时，不持有锁
+    while (!retiredFileFds.empty()) {
+      int fd = retiredFileFds.back();
+      retiredFileFds.pop_back();
+      lock.unlock();
+      close(fd);
+      lock.lock();
+    }
+    if (nextFileFd >= 0 || rotationStop) {
+      break;
     }
-    assert(writeCur->getFreeSpace() > 0);
+
+    //后继文件以临时文件名创建在新文件所在目录，切换时重命名，文件名中的时间为切换时间
+    size_t index = ++rotationIndex;
     lock.unlock();
-    try_append(data, len, noLose);
-    writeCur_cv.notify_all(); //通知下一个正在等待的线程
-  } else if (len != actualLen) {
-    //仅写入了部分数据，进行指针调整
-    std::unique_lock<std::mutex> lock(writeCur_mtx);
-    int remainLen = len - actualLen;
-    int dataPos = actualLen;
-    while (1) {
-      if (writeCur->getFreeSpace() > 0) {
-        auto [writeLen, isFull] = writeCur->append(data + dataPos, remainLen);
-        if (writeLen == remainLen && !isFull) {
-          //直接写入完成，并且当前缓冲区不满
-          lock.unlock();
-          writeCur_cv.notify_all(); //通知正在等待的线程
-          return true;
-        } else if (writeLen == remainLen && isFull) {
-          //直接写入完成，但当前缓冲区已满
-          if (writeCur->next->isEmpty()) {
-            writeCur = writeCur->next; //下一个缓冲区可用，直接移动指针
-          } else {
-            if (blockCount + 1 <= maxBlockCount) { //可添加新缓冲区
-              std::string newFilePath =
-                  bufferFileBasePath + std::to_string(blockCount);
-              addBufferBlock(newFilePath, blockSize, writeCur);
-              writeCur = writeCur->next;
-            } else { //无法添加更多的缓冲区，需要等待
-              std::unique_lock<std::mutex> persistLock(persistCur_mtx);
-              blockPersistenceDone.wait(persistLock, [this]() {
-                return writeCur->next->isEmpty() || writeCur->isEmpty();
-              });
-              if (writeCur->isEmpty()) {
-                ;
-              } else {
-                writeCur = writeCur->next;
-              }
-              assert(writeCur->isEmpty());
-            }
-          }
-          lock.unlock();
-          blockIsFull.notify_one();
-          writeCur_cv.notify_all(); //通知一个正在等待的线程
-          return true;
-        } else { //写入未完成，需要更新位置参数，继续写入
-          remainLen = remainLen - writeLen;
-          dataPos += writeLen;
-          blockIsFull.notify_one();
-          continue;
-        }
-      } else if (writeCur->next->isEmpty()) { //下一个缓冲区可用
-        writeCur = writeCur->next;
-        assert(writeCur->isEmpty());
-        continue;
-      } else {
-        if (blockCount + 1 <= maxBlockCount) { //可添加新缓冲区
-          std::string newFilePath =
-              bufferFileBasePath + std::to_string(blockCount);
-          addBufferBlock(newFilePath, blockSize, writeCur);
-          writeCur = writeCur->next;
-          assert(writeCur->isEmpty());
-          continue;
-        } else { //无法添加更多的缓冲区，需要等待
-          std::unique_lock<std::mutex> persistLock(persistCur_mtx);
-          blockPersistenceDone.wait(persistLock, [this]() {
-            return writeCur->next->isEmpty() || writeCur->isEmpty();
-          });
-          if (writeCur->isEmpty()) {
-            ;
-          } else {
-            writeCur = writeCur->next;
-          }
-          assert(writeCur->isEmpty());
-          continue;
-        }
-      }
+    fs::path finalPath;
+    {
+      std::unique_lock<std::mutex> bufferLock(bufferMutex);
+      finalPath = makeRotationPath(index);
     }
-  } else if (len == actualLen && isFull) {
-    //无冲突正常写入,刚好把缓存区填满
-    std::unique_lock<std::mutex> lock(writeCur_mtx);
-    if (writeCur->next->isEmpty()) { //下一个缓冲区可用
-      writeCur = writeCur->next;
-      assert(writeCur->isEmpty());
-    } else {
-      if (blockCount + 1 <= maxBlockCount) { //可添加新缓冲区
-        std::string newFilePath =
-            bufferFileBasePath + std::to_string(blockCount);
-        addBufferBlock(newFilePath, blockSize, writeCur);
-        writeCur = writeCur->next;
-        assert(writeCur->isEmpty());
-      } else { //无法添加更多的缓冲区，需要等待
-        std::unique_lock<std::mutex> persistLock(persistCur_mtx);
-
-        //可能出现等待的时候，持久化线程直接把所有缓存块全部持久化完毕，此时不能移动写指针。
-        //出现这种情况就是单个缓存块设置过小
-        blockPersistenceDone.wait(persistLock, [this]() {
-          return writeCur->next->isEmpty() || writeCur->isEmpty();
-        });
-        if (writeCur->isEmpty()) {
-          ;
-        } else {
-          writeCur = writeCur->next;
-        }
-        assert(writeCur->isEmpty());
-      }
+    fs::path tempPath = finalPath.parent_path() /
+                        ("." + finalPath.filename().string() + "." +
+                         std::to_string(index) + ".next");
+    int fd =
+        ::open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0645);
+    if (fd >= 0) {
+      //预分配空间但不改变文件长度，读取时不会读到未写入的部分
+      size_t preallocLen = rotation.maxBytes > 0 ? rotation.maxBytes
+                                                 : blockSize * maxBlockCount;
+      fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, preallocLen);
     }
-    lock.unlock();
-    blockIsFull.notify_one();
-    writeCur_cv.notify_all(); //通知一个正在等待的线程
-    return true;
-  } else {
-    //无冲突正常写入，且缓冲区不满
-    return true;
+    lock.lock();
+    if (fd < 0) {
+      //无法创建后继文件，在下一个缓存块边界重新提交任务
+      break;
+    }
+    nextFileFd = fd;
+    nextFilePath = tempPath.string();
+    nextFileIndex = index;
   }
-  return true;
+
+  //检查剩余工作与清除标志位在同一临界区内，期间新增的工作会重新提交任务
+  rotationJobPending = false;
+  rotation_cv.notify_all();
+}
+
+void mmapBuffer::scheduleRotationJob() {
+  if (rotationJobPending || rotationStop) {
+    return;
+  }
+  rotationJobPending = true;
+  persistScheduler::getInstance().post([this] { prepareRotation(); });
+}
+
+bool mmapBuffer::rotateIfNeeded(bool sealed) {
+  if (rotation.maxBytes == 0 && rotation.intervalSeconds == 0) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  size_t fileLen = getPersistenceFileLen();
+  if (fileLen == 0) {
+    //文件为空时不轮转，按时间轮转从第一次写入开始计时
+    rotationDeadline = now + std::chrono::seconds(rotation.intervalSeconds);
+    return false;
+  }
+  bool sizeReached = rotation.maxBytes > 0 && fileLen >= rotation.maxBytes;
+  bool timeReached = rotation.intervalSeconds > 0 && now >= rotationDeadline;
+  //未满缓存块已经部分写出时不切换，避免该缓存块的数据分散在两个文件中。
+  //缓存块封存时保留的尾部之后的数据不再变化，可以从尾部之后开始写入新文件
+  size_t splitLen = sealed ? carriedTailLen : 0;
+  if ((!sizeReached && !timeReached) || partialFlushLen > splitLen) {
+    return false;
+  }
+
+  int fd = -1;
+  std::string tempPath;
+  size_t index = 0;
+  {
+    std::unique_lock<std::mutex> lock(rotation_mtx);
+    if (nextFileFd < 0) {
+      //后继文件尚未就绪或创建失败，确保有任务在准备
+      scheduleRotationJob();
+      return false;
+    }
+    fd = nextFileFd;
+    tempPath = nextFilePath;
+    index = nextFileIndex;
+    nextFileFd = -1;
+  }
+
+  //重命名为最终文件名，不覆盖已存在的文件，重名时添加后缀
+  std::unique_lock<std::mutex> bufferLock(bufferMutex);
+  std::string newPath = makeRotationPath(index);
+  std::string candidate = newPath;
+  for (int suffix = 1; suffix < 100; suffix++) {
+    if (renameat2(AT_FDCWD, tempPath.c_str(), AT_FDCWD, candidate.c_str(),
+                  RENAME_NOREPLACE) == 0) {
+      tempPath = candidate;
+      break;
+    }
+    if (errno != EEXIST) {
+      break;
+    }
+    candidate = newPath + "." + std::to_string(suffix);
+  }
+
+  //有线程等待落盘时旧文件需要先完成同步，保留的尾部所在页面截去补足部分
+  int retiredFd = persistenceFileFd;
+  if (fileLen != persistenceFileOffset) {
+    ftruncate(retiredFd, fileLen);
+  }
+  if (syncRequest > durableOffset) {
+    fdatasync(retiredFd);
+  }
+  persistenceFileFd = fd;
+  persistenceFilePath = tempPath;
+  persistenceFileOffset = 0;
+  actualDataLen = 0;
+  bufferLock.unlock();
+  rotationDeadline = now + std::chrono::seconds(rotation.intervalSeconds);
+  writeRotationPrologue();
+
+  //旧文件交给调度器的后台任务关闭，同时准备下一个后继文件
+  std::unique_lock<std::mutex> lock(rotation_mtx);
+  retiredFileFds.push_back(retiredFd);
+  scheduleRotationJob();
+  return true;
+}
+
+void mmapBuffer::writeRotationPrologue() {
+  std::vector<std::string> records;
+  {
+    std::unique_lock<std::mutex> lock(rotation_mtx);
+    if (!recordFraming || !rotationPrologue) {
+      return;
+    }
+    records = rotationPrologue();
+  }
+  std::string data;
+  for (const auto &record : records) {
+    if (record.empty() || record.size() > mmapRecord::maxLength) {
+      continue;
+    }
+    char header[mmapRecord::headerSize];
+    mmapRecord::encodeHeader(record.size(), header);
+    data.append(header, sizeof(header)).append(record);
+  }
+  if (data.empty()) {
+    return;
+  }
+
+  //补足部分填零，读取时按页面填充跳过，压缩时同样补足，解码后的数据流保持页面对齐
+  size_t paddedLen =
+      (data.size() + systemPageSize - 1) / systemPageSize * systemPageSize;
+  data.resize(paddedLen, '\0');
+  if (persistCodec) {
+    persistenceFileOffset += writeFrame(data.data(), paddedLen, 0);
+  } else {
+    char *staging = getStagingBuffer(paddedLen);
+    if (staging == nullptr) {
+      return;
+    }
+    memcpy(staging, data.data(), paddedLen);
+    size_t written = 0;
+    while (written < paddedLen) {
+      ssize_t writeLen = pwrite64(persistenceFileFd, staging + written,
+                                  paddedLen - written, written);
+      if (writeLen < 0 && errno == EINTR) {
+        continue;
+      }
+      if (writeLen <= 0) {
+        return;
+      }
+      written += writeLen;
+    }
+    persistenceFileOffset += paddedLen;
+  }
+  actualDataLen += paddedLen;
+}
+
+void mmapBuffer::changePersistFile(const std::string &_persistenceFilePath) {
+  //等待当前缓冲区数据全部持久化，不保留尾部，旧文件截断到实际长度
+  flushBuffer(false);
+
+  std::unique_lock<std::mutex> lock(bufferMutex);
+
+  //关闭旧持久化文件
+  close(persistenceFileFd);
+
+  //打开新持久化文件并清空已有内容，之后轮转的文件名以新文件路径为基础。
+  //此时缓存块可能已有新写入的数据，无法像initBuffer一样把文件末尾不足一页的部分放入缓存块起点
+  persistenceFilePath = _persistenceFilePath;
+  rotationBasePath = _persistenceFilePath;
+  persistenceFileFd = ::open(persistenceFilePath.c_str(),
+                             O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0645);
+  assert(persistenceFileFd >= 0);
+
+  //重置文件长度信息
+  persistenceFileOffset = 0;
+  actualDataLen = 0;
+  carriedTailLen = 0;
+}
+
+int mmapBuffer::persist() {
+  assert(persistenceFileFd >= 0);
+
+  //填满写缓存块的线程没有等待新缓存块时，由持久化线程代为调整写指针
+  completeHandOff();
+  //代为写入挂起的协程数据，恢复已完成的协程
+  resumeAwaiters();
+  //写指针进入新缓存块后，预取之后的缓存块
+  if (prefaultPending.exchange(false) && !prefaultAhead()) {
+    prefaultPending = true;
+  }
+  //发布停留时间已到的线程暂存数据
+  int stagingTimeout = publishDueStaging();
+
+  //涉及条件变量，使用互斥锁保护
+  std::unique_lock<std::mutex> lock(persistCur_mtx);
+
+  //没有待处理的工作时交还调度器，由事件或写出期限再次唤醒，空闲时不占用CPU
+  int timeout = persistWaitTimeout();
+  if (timeout != 0) {
+    //当持久化区块未满时，写入指针和持久化指针应该指向同一个区块
+    assert(writeCur == persistenceCur);
+    //写入线程正在调整写指针，稍后重新预取
+    if (prefaultPending) {
+      timeout = earlierTimeout(timeout, 1);
+    }
+    timeout = earlierTimeout(timeout, stagingTimeout);
+    if (!shrinkPending) {
+      return timeout;
+    }
+    //空闲时间到期的借用缓存块归还缓存块池，未到期时与写出期限一起等待
+    auto remain = std::chrono::ceil<std::chrono::milliseconds>(
+        shrinkDeadline - std::chrono::steady_clock::now());
+    if (remain.count() > 0) {
+      return earlierTimeout(timeout, remain.count());
+    }
+    auto surplus = detachSurplusBlocks();
+    lock.unlock();
+    releaseSurplusBlocks(surplus);
+    return 0;
+  }
+  //写出失败后间隔一段时间再重试，未写出的数据保留在缓存块中
+  int retryDelay = persistRetryDelay();
+  if (retryDelay > 0) {
+    return earlierTimeout(retryDelay, stagingTimeout);
+  }
+
+  //若缓存区满，则开始持久化
+  //若缓存区未满而执行强制持久化在mmap情景下效率降低，因为缓存不会因为程序崩溃而丢失，所以大可以等到缓存区块满了再进行持久化
+  if (persistenceCur->getFreeSpace() == 0) {
+    //持久化数据，写出时需要等待缓存块中的预留区间全部提交，
+    //而填满缓存块的线程在调整写指针后才会提交，可能正在等待持久化完成，因此写出期间释放锁
+    lock.unlock();
+    //满足轮转条件时先切换持久化文件
+    rotateIfNeeded();
+    auto blocks = collectFullBlocks(persistRing ? persistRing->getEntries()
+                                                : IOV_MAX);
+    if (blocks.empty()) {
+      //持久化指针所在的缓存块仍有未提交的预留区间，或者写指针所在的缓存块已满、
+      //等待获得writeCur_mtx后调整写指针，稍后重试
+      return 1;
+    }
+    size_t writtenLen = 0;
+    if (persistCodec) {
+      //逐块压缩后写出
+      writtenLen = persistBlocksCompressed(blocks);
+    } else {
+      //使用io_uring同时写出多个已满缓存块，或使用一次pwritev2写出所有连续的已满缓存块
+      size_t written = persistRing ? persistBlocksAsync(blocks)
+                                   : persistBlocksVectored(blocks);
+      //写入出错时只释放完整写出的缓存块，其余缓存块留在缓存环中稍后重写
+      size_t count = 0;
+      while (count < blocks.size() &&
+             writtenLen + blocks[count]->getBlockSize() <= written) {
+        writtenLen += blocks[count++]->getBlockSize();
+      }
+      blocks.resize(count);
+    }
+    //写出后立即在缓存块头部记录，此后崩溃时恢复跳过这些缓存块
+    for (mmapBlock *block : blocks) {
+      block->setPersistedSpace(block->getBlockSize());
+    }
+    lock.lock();
+
+    //更新持久化文件长度，清空缓存块并后移持久化指针
+    if (!blocks.empty()) {
+      releasePersistedBlocks(blocks, writtenLen);
+    }
+    syncIfRequested(lock);
+    auto surplus = detachSurplusBlocks();
+
+    lock.unlock();
+    //发送持久化完成信号，空闲时间到期的借用缓存块归还缓存块池
+    blockPersistenceDone.notify_all();
+    releaseSurplusBlocks(surplus);
+    return 0;
+  } else if (sealedLen == 0 && flushRequest > persistedOffset) {
+    //有线程等待未满缓存块中的数据，写出已提交的部分，写入线程可以继续写入
+    assert(writeCur == persistenceCur);
+    lock.unlock();
+    size_t flushedLen = flushPartialBlock();
+    lock.lock();
+    if (flushedLen > 0) {
+      persistedOffset = persistenceCur->getStreamOffset() + flushedLen;
+      syncIfRequested(lock);
+    }
+    lock.unlock();
+    blockPersistenceDone.notify_all();
+    return 0;
+  } else if (sealedLen != 0 ||
+             forcePersistDone < forcePersistRequest) { //检测强制持久化请求
+    //只有当缓冲区未满的时候才有可能调用强制持久化，此时写指针和持久化指针应指向同一block
+    assert(writeCur == persistenceCur);
+    uint64_t request = forcePersistRequest;
+    //关闭或更换持久化文件之前不保留尾部
+    bool keepTail = dropTailRequest <= forcePersistDone;
+
+    //封存缓存块，之后的写入等待其重新启用，封存前缓存块已被写满时按已满缓存块处理。
+    //上一次写出失败时缓存块仍处于封存状态，直接重试
+    size_t actualLen = sealedLen;
+    size_t headLen = sealedHeadLen;
+    if (actualLen == 0) {
+      if (persistenceCur->getUsedSpace() == (keepTail ? carriedTailLen : 0)) {
+        forcePersistDone = request;
+        lock.unlock();
+        bufferIsEmpty.notify_all();
+        return 0;
+      }
+      if (!persistenceCur->trySeal(actualLen)) {
+        return 0;
+      }
+      //切换文件时保留的尾部留在旧文件中，新文件从尾部之后开始
+      headLen = rotateIfNeeded(true) ? carriedTailLen : 0;
+    }
+    //封存之前的预留区间尚未全部提交时保持封存，稍后重试，不在工作线程中等待
+    if (!persistenceCur->isCommitted(actualLen)) {
+      sealedLen = actualLen;
+      sealedHeadLen = headLen;
+      return 1;
+    }
+    const char *blockData = persistenceCur->getData();
+
+    //文件中的数据按页面对齐写出，不足一页的尾部保留在缓存块起点，下一次写出时原地重写该页面
+    size_t dataLen = actualLen - headLen;
+    size_t tailLen = keepTail ? dataLen % systemPageSize : 0;
+    size_t writeLen =
+        (dataLen + systemPageSize - 1) / systemPageSize * systemPageSize;
+    bool written = true;
+    if (persistCodec) {
+      //压缩帧只包含上次写出之后的数据，不包含补足部分，解码后的数据同样没有空洞
+      writeLen = 0;
+      if (actualLen > partialFlushLen) {
+        writeLen = writeFrame(blockData + partialFlushLen,
+                              actualLen - partialFlushLen,
+                              persistenceFileOffset);
+        written = writeLen != 0;
+      }
+    } else if (headLen == 0) {
+      //补足部分填零，分帧模式的读取依赖零字节识别填充
+      persistenceCur->zeroFillTail(actualLen, writeLen);
+      written = writeFully(blockData, writeLen, persistenceFileOffset);
+    } else if (char *staging = getStagingBuffer(writeLen)) {
+      //尾部之后的数据不再按页面对齐，拷贝到暂存缓冲区后写出
+      memcpy(staging, blockData + headLen, dataLen);
+      memset(staging + dataLen, 0, writeLen - dataLen);
+      written = writeFully(staging, writeLen, persistenceFileOffset);
+    } else {
+      recordPersistError(ENOMEM);
+      written = false;
+    }
+    if (!written) {
+      //缓存块保持封存，文件长度和数据流偏移量不变，稍后从相同位置重试
+      sealedLen = actualLen;
+      sealedHeadLen = headLen;
+      lock.unlock();
+      bufferIsEmpty.notify_all();
+      blockPersistenceDone.notify_all();
+      return 0;
+    }
+    sealedLen = 0;
+    sealedHeadLen = 0;
+
+    if (persistCodec) {
+      persistenceFileOffset += writeLen;
+    } else if (keepTail) {
+      persistenceFileOffset += dataLen - tailLen;
+    } else {
+      //文件即将关闭或更换，截去补足部分
+      ftruncate(persistenceFileFd, persistenceFileOffset + dataLen);
+      persistenceFileOffset += writeLen;
+    }
+    //保留的尾部已经计入实际数据长度
+    actualDataLen += actualLen - carriedTailLen;
+
+    //重新启用缓存块，写指针仍指向该缓存块，之后唤醒等待的写入线程
+    uint64_t streamOffset =
+        persistenceCur->getStreamOffset() + actualLen - tailLen;
+    persistenceCur->setStreamOffset(streamOffset);
+    {
+      std::unique_lock<std::mutex> writeLock(writeCur_mtx);
+      persistenceCur->resetWithTail(blockSequence++, actualLen - tailLen,
+                                    tailLen);
+    }
+    notifyWriters();
+    carriedTailLen = tailLen;
+    partialFlushLen = tailLen;
+    persistedOffset = streamOffset + tailLen;
+    syncIfRequested(lock);
+
+    //请求之前写入的数据都已写出
+    forcePersistDone = request;
+
+    //发送持久化完成信号
+    lock.unlock();
+    bufferIsEmpty.notify_all();
+    blockPersistenceDone.notify_all();
+    return 0;
+  } else if (syncRequest > durableOffset) {
+    //等待落盘的数据已经写出，例如由写出期限或其他等待线程写出，只执行同步
+    syncIfRequested(lock);
+    lock.unlock();
+    blockPersistenceDone.notify_all();
+    return 0;
+  }
+  return 0;
+}
+
+void mmapBuffer::notifyPersist() {
+  uint64_t count = 1;
+  write(persistEventFd, &count, sizeof(count));
+}
+
+int mmapBuffer::persistWaitTimeout() {
+  if (persistenceCur->getFreeSpace() == 0 || flushRequest > persistedOffset ||
+      forcePersistDone < forcePersistRequest) {
+    return 0;
+  }
+  //等待落盘的数据已经写出，只需同步，出错之后不再同步
+  if (syncRequest > durableOffset && persistedOffset > durableOffset &&
+      persistError == 0) {
+    return 0;
+  }
+  if (flushDeadline == 0) {
+    return -1;
+  }
+
+  //先标记空闲再检查数据，与写入线程先预留再检查标记相对应，新数据不会被遗漏。
+  //单写入线程不检查该标记，空闲时按写出期限的一半轮询
+  bool polling = producer == producerPolicy::single;
+  persistIdle = !polling;
+  uint64_t streamEnd =
+      persistenceCur->getStreamOffset() + persistenceCur->getUsedSpace();
+  if (streamEnd <= persistedOffset) {
+    dirty = false;
+    return polling ? (flushDeadline + 1) / 2 : -1;
+  }
+  persistIdle = false;
+
+  //从发现未写出的数据开始计时，到期后写出未满缓存块中已提交的部分
+  auto now = std::chrono::steady_clock::now();
+  if (!dirty) {
+    dirty = true;
+    dirtySince = now;
+  }
+  auto remain = std::chrono::ceil<std::chrono::milliseconds>(
+      dirtySince + std::chrono::milliseconds(flushDeadline) - now);
+  if (remain.count() <= 0) {
+    raiseRequest(flushRequest, streamEnd);
+    dirty = false;
+    return 0;
+  }
+  return remain.count();
+}
+
+int mmapBuffer::persistRetryDelay() const {
+  if (persistError == 0) {
+    return 0;
+  }
+  auto remain = std::chrono::ceil<std::chrono::milliseconds>(
+      retryAfter - std::chrono::steady_clock::now());
+  return remain.count() > 0 ? remain.count() : 0;
+}
+
+void mmapBuffer::recordPersistError(int err) {
+  int expected = 0;
+  persistError.compare_exchange_strong(expected, err != 0 ? err : EIO);
+  retryAfter = std::chrono::steady_clock::now() +
+               std::chrono::milliseconds(errorRetryMs);
+}
+
+bool mmapBuffer::writeFully(const char *data, size_t len, size_t fileOffset) {
+  //处理不完整的写入，从未写入的位置继续
+  size_t written = 0;
+  while (written < len) {
+    ssize_t writeLen = pwrite64(persistenceFileFd, data + written,
+                                len - written, fileOffset + written);
+    if (writeLen < 0 && errno == EINTR) {
+      continue;
+    }
+    if (writeLen <= 0) {
+      //返回0时没有设置errno，按空间不足处理
+      recordPersistError(writeLen < 0 ? errno : ENOSPC);
+      return false;
+    }
+    written += writeLen;
+  }
+  return true;
+}
+
+std::vector<mmapBlock *> mmapBuffer::collectFullBlocks(size_t maxCount) {
+  //只加入预留区间已经全部提交的缓存块，不在调度器的工作线程中等待仍在拷贝或调整写指针的线程。
+  //写指针尚未离开的缓存块不能写出
+  std::vector<mmapBlock *> blocks;
+  mmapBlock *block = persistenceCur;
+  while (blocks.size() < maxCount && block->getFreeSpace() == 0 &&
+         block->isCommitted() && !(handOffPending && block == writeCur)) {
+    blocks.push_back(block);
+    block = block->next;
+  }
+  return blocks;
+}
+
+size_t
+mmapBuffer::persistBlocksVectored(const std::vector<mmapBlock *> &blocks) {
+  std::vector<iovec> iov;
+  for (mmapBlock *block : blocks) {
+    iov.push_back(
+        {const_cast<char *>(block->getData()), block->getBlockSize()});
+  }
+
+  //处理不完整的写入，从未写入的位置继续
+  size_t written = 0;
+  size_t iovIndex = 0;
+  while (iovIndex < iov.size()) {
+    ssize_t writeLen =
+        pwritev2(persistenceFileFd, iov.data() + iovIndex,
+                 iov.size() - iovIndex, persistenceFileOffset + written, 0);
+    if (writeLen < 0 && errno == EINTR) {
+      continue;
+    }
+    if (writeLen <= 0) {
+      //内核不支持pwritev2等情况下逐段写出剩余部分，仍然失败时停止
+      for (; iovIndex < iov.size(); iovIndex++) {
+        if (!writeFully(static_cast<const char *>(iov[iovIndex].iov_base),
+                        iov[iovIndex].iov_len,
+                        persistenceFileOffset + written)) {
+          break;
+        }
+        written += iov[iovIndex].iov_len;
+      }
+      break;
+    }
+    written += writeLen;
+    while (iovIndex < iov.size() &&
+           static_cast<size_t>(writeLen) >= iov[iovIndex].iov_len) {
+      writeLen -= iov[iovIndex].iov_len;
+      iovIndex++;
+    }
+    if (writeLen > 0) {
+      iov[iovIndex].iov_base =
+          static_cast<char *>(iov[iovIndex].iov_base) + writeLen;
+      iov[iovIndex].iov_len -= writeLen;
+    }
+  }
+  return written;
+}
+
+size_t mmapBuffer::persistBlocksAsync(const std::vector<mmapBlock *> &blocks) {
+  //每个缓存块按ioUring::maxWriteLen拆分为一个或多个写入请求，缓存块大小可能不同
+  struct writeRequest {
+    size_t dataOffset; //请求在缓存块数据区中的起点
+    size_t len;
+    size_t written; //已经完成的长度
+    const char *data;
+    size_t fileOffset;
+  };
+  std::vector<writeRequest> requests;
+  size_t fileOffset = persistenceFileOffset;
+  for (mmapBlock *block : blocks) {
+    size_t blockSize = block->getBlockSize();
+    for (size_t pos = 0; pos < blockSize; pos += ioUring::maxWriteLen) {
+      requests.push_back({pos, std::min(blockSize - pos, ioUring::maxWriteLen),
+                          0, block->getData(), fileOffset});
+    }
+    fileOffset += blockSize;
+  }
+
+  //提交队列有空间时继续添加请求，添加的请求在等待完成事件时一次提交；
+  //不完整的写入重新提交剩余部分，出错后不再提交新的请求，只等待已提交的请求完成
+  std::deque<size_t> pending;
+  for (size_t i = 0; i < requests.size(); i++) {
+    pending.push_back(i);
+  }
+  size_t inFlight = 0;
+  bool failed = false;
+  bool ringBroken = false;
+  while (!pending.empty() || inFlight > 0) {
+    while (!failed && !pending.empty()) {
+      const writeRequest &request = requests[pending.front()];
+      size_t pos = request.dataOffset + request.written;
+      if (!persistRing->prepareWrite(persistenceFileFd, request.data + pos,
+                                     request.len - request.written,
+                                     request.fileOffset + pos,
+                                     pending.front())) {
+        break;
+      }
+      pending.pop_front();
+      inFlight++;
+    }
+    uint64_t index = 0;
+    int result = 0;
+    if (inFlight == 0) {
+      //出错之后没有已提交的请求时结束，否则提交队列无法添加请求
+      ringBroken = !failed;
+      break;
+    }
+    if (!persistRing->waitCompletion(index, result) ||
+        index >= requests.size()) {
+      ringBroken = true;
+      break;
+    }
+    inFlight--;
+    writeRequest &request = requests[index];
+    if (result == -EINTR || result == -EAGAIN) {
+      pending.push_front(index);
+    } else if (result <= 0) {
+      //返回0时没有错误码，按空间不足处理
+      recordPersistError(result < 0 ? -result : ENOSPC);
+      failed = true;
+    } else {
+      request.written += result;
+      if (request.written < request.len) {
+        pending.push_front(index);
+      }
+    }
+  }
+
+  if (ringBroken) {
+    //无法获取完成事件，未完成的部分依次同步写出，之后退回pwrite64
+    for (writeRequest &request : requests) {
+      size_t pos = request.dataOffset + request.written;
+      if (request.written < request.len &&
+          !writeFully(request.data + pos, request.len - request.written,
+                      request.fileOffset + pos)) {
+        break;
+      }
+      request.written = request.len;
+    }
+    persistRing.reset();
+  }
+
+  //返回从文件当前长度起连续完成的长度
+  size_t written = 0;
+  for (const writeRequest &request : requests) {
+    written += request.written;
+    if (request.written < request.len) {
+      break;
+    }
+  }
+  return written;
+}
+
+size_t mmapBuffer::persistBlocksCompressed(std::vector<mmapBlock *> &blocks) {
+  //所有缓存块共用一个暂存缓冲区，因此逐块压缩并同步写出
+  //第一个缓存块中已经写出的部分不再重复写出
+  size_t fileOffset = persistenceFileOffset;
+  size_t skipLen = partialFlushLen;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    size_t len = blocks[i]->getBlockSize();
+    if (skipLen < len) {
+      size_t frameLen = writeFrame(blocks[i]->getData() + skipLen,
+                                   len - skipLen, fileOffset);
+      if (frameLen == 0) {
+        //写入失败的缓存块及之后的缓存块留在缓存环中，下一次从该位置重写
+        blocks.resize(i);
+        break;
+      }
+      fileOffset += frameLen;
+    }
+    //逐块压缩耗时较长，每写出一块就记录，崩溃时恢复跳过已写出的缓存块
+    blocks[i]->setPersistedSpace(len);
+    skipLen = 0;
+  }
+  return fileOffset - persistenceFileOffset;
+}
+
+char *mmapBuffer::getStagingBuffer(size_t len) {
+  //O_DIRECT要求写入的内存按页面对齐，按需扩大暂存缓冲区
+  if (len > frameBufferLen) {
+    free(frameBuffer);
+    if (posix_memalign(reinterpret_cast<void **>(&frameBuffer),
+                       systemPageSize, len) != 0) {
+      frameBuffer = nullptr;
+      frameBufferLen = 0;
+      return nullptr;
+    }
+    frameBufferLen = len;
+  }
+  return frameBuffer;
+}
+
+size_t mmapBuffer::writeFrame(const char *data, size_t len,
+                              size_t fileOffset) {
+  size_t bound = mmapCodec::frameBound(*persistCodec, len, systemPageSize);
+  if (getStagingBuffer(bound) == nullptr) {
+    recordPersistError(ENOMEM);
+    return 0;
+  }
+  size_t frameLen = mmapCodec::encodeFrame(*persistCodec, data, len,
+                                           frameBuffer, systemPageSize);
+  return writeFully(frameBuffer, frameLen, fileOffset) ? frameLen : 0;
+}
+
+size_t mmapBuffer::flushPartialBlock() {
+  mmapBlock *block = persistenceCur;
+  size_t prefixLen = block->waitForCommittedPrefix();
+  if (prefixLen <= partialFlushLen) {
+    return prefixLen;
+  }
+
+  //写入失败时不更新已写出的长度，下一次从相同位置重写
+  if (persistCodec) {
+    //压缩帧只包含上次写出之后的新数据，文件长度随之增加
+    size_t frameLen = writeFrame(block->getData() + partialFlushLen,
+                                 prefixLen - partialFlushLen,
+                                 persistenceFileOffset);
+    if (frameLen == 0) {
+      return 0;
+    }
+    persistenceFileOffset += frameLen;
+  } else {
+    //原地写入缓存块在文件中的位置，从上次写出的最后一个页面开始，整页部分直接从映射写出
+    size_t alignedStart = partialFlushLen / systemPageSize * systemPageSize;
+    size_t alignedEnd = prefixLen / systemPageSize * systemPageSize;
+    if (alignedEnd > alignedStart &&
+        !writeFully(block->getData() + alignedStart, alignedEnd - alignedStart,
+                    persistenceFileOffset + alignedStart)) {
+      return 0;
+    }
+    //最后一个页面之后的部分可能正在被写入，拷贝已提交的部分并补零后写出
+    if (prefixLen > alignedEnd) {
+      char *tailPage = getStagingBuffer(systemPageSize);
+      if (tailPage == nullptr) {
+        recordPersistError(ENOMEM);
+        return 0;
+      }
+      memcpy(tailPage, block->getData() + alignedEnd, prefixLen - alignedEnd);
+      memset(tailPage + prefixLen - alignedEnd, 0,
+             systemPageSize - (prefixLen - alignedEnd));
+      if (!writeFully(tailPage, systemPageSize,
+                      persistenceFileOffset + alignedEnd)) {
+        return 0;
+      }
+    }
+  }
+  partialFlushLen = prefixLen;
+  block->setPersistedSpace(prefixLen);
+  return prefixLen;
+}
+
+void mmapBuffer::syncIfRequested(std::unique_lock<std::mutex> &lock) {
+  uint64_t offset = persistedOffset;
+  if (syncRequest <= durableOffset || offset <= durableOffset) {
+    return;
+  }
+  //同步失败后页缓存中的数据可能已被丢弃，之后的同步成功也不能保证之前的数据已落盘，
+  //因此出错之后不再推进落盘偏移量
+  if (persistError != 0) {
+    return;
+  }
+  int fd = persistenceFileFd;
+  lock.unlock();
+  int res = fdatasync(fd);
+  int err = errno;
+  lock.lock();
+  if (res != 0) {
+    recordPersistError(err);
+    return;
+  }
+  durableOffset = offset;
+}
+
+bool mmapBuffer::waitUntilPersisted(uint64_t ticket) {
+  std::unique_lock<std::mutex> lock(persistCur_mtx);
+  if (persistedOffset >= ticket) {
+    return true;
+  }
+  //多个线程的请求合并为一次写出
+  raiseRequest(flushRequest, ticket);
+  notifyPersist();
+  blockPersistenceDone.wait(
+      lock, [&] { return persistedOffset >= ticket || persistError != 0; });
+  return persistedOffset >= ticket;
+}
+
+bool mmapBuffer::waitUntilDurable(uint64_t ticket) {
+  std::unique_lock<std::mutex> lock(persistCur_mtx);
+  if (durableOffset >= ticket) {
+    return true;
+  }
+  raiseRequest(flushRequest, ticket);
+  raiseRequest(syncRequest, ticket);
+  notifyPersist();
+  blockPersistenceDone.wait(
+      lock, [&] { return durableOffset >= ticket || persistError != 0; });
+  return durableOffset >= ticket;
+}
+
+uint64_t mmapBuffer::getPersistedOffset() const { return persistedOffset; }
+
+int mmapBuffer::getPersistError() const { return persistError; }
+
+void mmapBuffer::raiseRequest(std::atomic_uint64_t &request, uint64_t target) {
+  uint64_t current = request.load();
+  while (current < target && !request.compare_exchange_weak(current, target)) {
+  }
+}
+
+mmapBuffer::appendAwaiter mmapBuffer::append(const char *data, size_t len) {
+  return appendAwaiter(this, data, len);
+}
+
+mmapBuffer::persistAwaiter mmapBuffer::persisted(uint64_t ticket) {
+  return persistAwaiter(this, ticket);
+}
+
+bool mmapBuffer::appendAwaiter::await_ready() {
+  //已有挂起的写入时排在其后，保持写入顺序
+  return buffer->appendWaiterCount == 0 && buffer->appendNoWait(*this);
+}
+
+bool mmapBuffer::appendAwaiter::await_suspend(std::coroutine_handle<> _handle) {
+  //加入队列后协程可能立即在持久化线程上恢复并销毁等待体，之后只使用局部变量
+  mmapBuffer *owner = buffer;
+  handle = _handle;
+  {
+    std::unique_lock<std::mutex> lock(owner->await_mtx);
+    if (owner->appendWaiters.empty() && owner->appendNoWait(*this)) {
+      return false;
+    }
+    owner->appendWaiters.push_back(this);
+    owner->appendWaiterCount++;
+  }
+  //缓存空间可能在加入队列之前已经释放，由持久化线程重试一次
+  owner->notifyPersist();
+  return true;
+}
+
+bool mmapBuffer::persistAwaiter::await_ready() const {
+  return buffer->persistedOffset >= ticket || buffer->persistError != 0;
+}
+
+bool mmapBuffer::persistAwaiter::await_resume() const {
+  return buffer->persistedOffset >= ticket;
+}
+
+bool mmapBuffer::persistAwaiter::await_suspend(
+    std::coroutine_handle<> _handle) {
+  mmapBuffer *owner = buffer;
+  handle = _handle;
+  {
+    std::unique_lock<std::mutex> lock(owner->await_mtx);
+    if (owner->persistedOffset >= ticket || owner->persistError != 0) {
+      return false;
+    }
+    owner->persistWaiters.push_back(this);
+    owner->persistWaiterCount++;
+    //与waitUntilPersisted的请求合并为一次写出
+    raiseRequest(owner->flushRequest, ticket);
+  }
+  owner->notifyPersist();
+  return true;
+}
+
+bool mmapBuffer::appendNoWait(appendAwaiter &op) {
+  size_t headerLen = recordFraming ? mmapRecord::headerSize : 0;
+  if (recordFraming &&
+      (op.len == 0 || op.len > mmapRecord::maxLength ||
+       op.len + headerLen >= blockSize)) {
+    return true;
+  }
+  while (op.written < op.len) {
+    //分帧模式下记录头部和数据在同一段中预留，否则超过单个缓存块大小的数据分段写入
+    size_t reserveLen = recordFraming
+                            ? op.len + headerLen
+                            : std::min(op.len - op.written, blockSize);
+    auto res = reserveRaw(reserveLen, recordFraming,
+                          overflowAction::dropNewest);
+    if (!res.isValid()) {
+      return false;
+    }
+    const char *src = op.data + op.written;
+    char *dst = res.first.data;
+    if (recordFraming) {
+      mmapRecord::encodeHeader(op.len, dst);
+      dst += headerLen;
+    }
+    memcpy(dst, src, res.first.len - headerLen);
+    if (res.second.data != nullptr) {
+      memcpy(res.second.data, src + res.first.len, res.second.len);
+    }
+    commit(res);
+    op.written += reserveLen - headerLen;
+    op.ticket = res.ticket;
+  }
+  return true;
+}
+
+void mmapBuffer::resumeAwaiters() {
+  if (appendWaiterCount == 0 && persistWaiterCount == 0) {
+    return;
+  }
+  std::vector<std::coroutine_handle<>> ready;
+  {
+    std::unique_lock<std::mutex> lock(await_mtx);
+    //按挂起顺序代为写入，遇到仍无法写入的数据时停止，之后的写入继续等待
+    while (!appendWaiters.empty() && appendNoWait(*appendWaiters.front())) {
+      ready.push_back(appendWaiters.front()->handle);
+      appendWaiters.pop_front();
+    }
+    appendWaiterCount = appendWaiters.size();
+
+    //写出出错时恢复所有等待的协程，由await_resume返回结果
+    uint64_t offset = persistError != 0 ? UINT64_MAX : persistedOffset.load();
+    auto done = std::partition(
+        persistWaiters.begin(), persistWaiters.end(),
+        [offset](const persistAwaiter *op) { return op->ticket > offset; });
+    for (auto it = done; it != persistWaiters.end(); it++) {
+      ready.push_back((*it)->handle);
+    }
+    persistWaiters.erase(done, persistWaiters.end());
+    persistWaiterCount = persistWaiters.size();
+  }
+
+  //释放锁后恢复，恢复的协程可以再次写入
+  for (auto handle : ready) {
+    if (coroutineExecutor) {
+      coroutineExecutor(handle);
+    } else {
+      handle.resume();
+    }
+  }
+}
+
+void mmapBuffer::releasePersistedBlocks(const std::vector<mmapBlock *> &blocks,
+                                        size_t writtenLen) {
+  persistenceFileOffset += writtenLen;
+  partialFlushLen = 0;
+  if (!blocks.empty()) {
+    persistedOffset =
+        blocks.back()->getStreamOffset() + blocks.back()->getBlockSize();
+  }
+  auto now = std::chrono::steady_clock::now();
+  for (mmapBlock *persisted : blocks) {
+    //所有预留区间提交时写指针必定已经离开该缓存块
+    assert(persisted == persistenceCur && persisted != writeCur);
+    actualDataLen += persisted->getUsedSpace() - carriedTailLen;
+    carriedTailLen = 0;
+    //清空buffer block(状态置为free)，缓存持久化指针后移
+    persisted->clear();
+    persisted->setIdleSince(now);
+    persistenceCur = persistenceCur->next;
+  }
+  //唤醒等待空闲缓存块的写入线程，调用方在释放persistCur_mtx后通知
+  ringGeneration++;
+}
+
+bool mmapBuffer::waitForBufferPersist() { return flushBuffer(true); }
+
+bool mmapBuffer::flushBuffer(bool keepTail) {
+  //各线程暂存的数据一并写出
+  publishAllStaging(false);
+
+  //获取整体的缓存锁，涉及条件变量，使用互斥锁保护
+  std::unique_lock<std::mutex> lock(persistCur_mtx);
+  //设置缓存不可写
+  enableWrite = false;
+  //登记强制持久化请求，等待持久化线程处理该请求
+  uint64_t request = ++forcePersistRequest;
+  if (!keepTail) {
+    dropTailRequest = request;
+  }
+  notifyPersist();
+  //关闭或更换持久化文件之前必须写出全部数据，出错时继续等待持久化线程重试
+  bufferIsEmpty.wait(lock, [&] {
+    return forcePersistDone >= request || (keepTail && persistError != 0);
+  });
+  bool done = forcePersistDone >= request;
+  //恢复缓存可写
+  enableWrite = true;
+  lock.unlock();
+  enableWriteFlagChanged.notify_all();
+  return done;
+}
+
+bool mmapBuffer::try_append(char *data, size_t len, bool noLose,
+                            uint64_t *ticket) {
+  iovec iov = {data, len};
+  return try_appendv(&iov, 1, noLose, ticket);
+}
+
+bool mmapBuffer::try_appendv(const iovec *iov, int iovcnt, bool noLose,
+                             uint64_t *ticket) {
+  if (ticket != nullptr) {
+    *ticket = 0;
+  }
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  //分帧模式下在数据前添加记录头部，整条记录只进行一次预留
+  char recordHeader[mmapRecord::headerSize];
+  size_t headerLen = 0;
+  if (recordFraming) {
+    if (len == 0) {
+      return true;
+    }
+    if (len > mmapRecord::maxLength ||
+        len + mmapRecord::headerSize >= blockSize) {
+      return false;
+    }
+    mmapRecord::encodeHeader(len, recordHeader);
+    headerLen = mmapRecord::headerSize;
+    len += headerLen;
+  }
+
+  overflowAction action = noLose ? overflowAction::block : overflow.action;
+
+  //启用线程暂存时小记录拷贝到本线程的暂存区，其余写入先发布暂存区以保持本线程的写入顺序
+  stagingArea *area = stagingCapacity > 0 ? localStagingArea(true) : nullptr;
+  std::unique_lock<std::mutex> stagingLock;
+  if (area != nullptr) {
+    stagingLock = std::unique_lock<std::mutex>(area->mtx);
+    bool staged = ticket == nullptr && len > 0 && len <= stagingCapacity;
+    if (!staged || area->len + len > stagingCapacity) {
+      publishStaging(*area, true, noLose);
+    }
+    if (!staged) {
+      stagingLock.unlock();
+    }
+  }
+
+  //按顺序将记录头部和数据分段拷贝到预留区间中
+  size_t headerOffset = 0;
+  int iovIndex = 0;
+  size_t iovOffset = 0;
+  auto copyOut = [&](char *dst, size_t copyLen) {
+    size_t headerPart = std::min(copyLen, headerLen - headerOffset);
+    if (headerPart > 0) {
+      memcpy(dst, recordHeader + headerOffset, headerPart);
+      headerOffset += headerPart;
+      dst += headerPart;
+      copyLen -= headerPart;
+    }
+    while (copyLen > 0) {
+      size_t segLen = std::min(copyLen, iov[iovIndex].iov_len - iovOffset);
+      memcpy(dst, static_cast<char *>(iov[iovIndex].iov_base) + iovOffset,
+             segLen);
+      dst += segLen;
+      copyLen -= segLen;
+      iovOffset += segLen;
+      if (iovOffset == iov[iovIndex].iov_len) {
+        iovIndex++;
+        iovOffset = 0;
+      }
+    }
+  };
+
+  if (stagingLock.owns_lock()) {
+    //暂存区从空变为非空时开始计算停留时间
+    if (area->len == 0) {
+      area->stagedSince = std::chrono::steady_clock::now();
+      if (stagedAreas++ == 0) {
+        notifyPersist();
+      }
+    }
+    copyOut(area->data.get() + area->len, len);
+    area->len += len;
+    area->records++;
+    return true;
+  }
+
+  //超过单个缓存块大小的数据分段写入
+  while (len > 0) {
+    size_t reserveLen = std::min(len, blockSize);
+    auto res = reserveRaw(reserveLen, recordFraming, action);
+    if (!res.isValid()) {
+      //缓存写满，剩余数据写入溢出文件，丢弃时不进行拷贝
+      std::string spilled;
+      if (spillFd >= 0) {
+        spilled.resize(len);
+        copyOut(spilled.data(), len);
+      }
+      return handleOverflow(spilled.data(), spilled.size(), len - headerLen);
+    }
+    copyOut(res.first.data, res.first.len);
+    copyOut(res.second.data, res.second.len);
+    commit(res);
+    if (ticket != nullptr) {
+      *ticket = res.ticket;
+    }
+    len -= reserveLen;
+  }
+  return true;
+}
+
+mmapBuffer::reservation mmapBuffer::reserve(size_t len) {
+  //预留的区间直接位于缓存块中，先写入本线程暂存的数据
+  if (stagingCapacity > 0) {
+    if (stagingArea *area = localStagingArea(false)) {
+      std::unique_lock<std::mutex> lock(area->mtx);
+      publishStaging(*area);
+    }
+  }
+  if (!recordFraming) {
+    return reserveRaw(len);
+  }
+  if (len == 0 || len > mmapRecord::maxLength ||
+      len + mmapRecord::headerSize >= blockSize) {
+    return reservation();
+  }
+
+  //记录不会跨越缓存块边界，头部和数据位于同一段中
+  reservation res = reserveRaw(len + mmapRecord::headerSize, true);
+  mmapRecord::encodeHeader(len, res.first.data);
+
+  //返回的区间跳过头部
+  res.first.data += mmapRecord::headerSize;
+  res.first.len -= mmapRecord::headerSize;
+  return res;
+}
+
+mmapBuffer::reservation mmapBuffer::reserveRaw(size_t len, bool contiguous,
+                                               overflowAction action) {
+  return producer == producerPolicy::single
+             ? reserveRawAs<producerPolicy::single>(len, contiguous, action)
+             : reserveRawAs<producerPolicy::multi>(len, contiguous, action);
+}
+
+template <producerPolicy Policy>
+mmapBuffer::reservation
+mmapBuffer::reserveRawAs(size_t len, bool contiguous, overflowAction action) {
+  using clock = std::chrono::steady_clock;
+  reservation res;
+  if (len == 0 || len > blockSize || (contiguous && len == blockSize)) {
+    return res;
+  }
+
+  while (true) {
+    //预留成功后缓存块中有未提交的区间，不会被清空和移出缓存环，只需保护读取写指针到预留完成
+    enterRing<Policy>();
+    mmapBlock *block = writeCur;
+    auto [writePtr, reservedLen, isFull] = block->reserve<Policy>(len);
+    leaveRing<Policy>();
+
+    if (reservedLen == 0) {
+      //丢弃和溢出时不获取任何锁，直接返回
+      if (action == overflowAction::dropNewest ||
+          action == overflowAction::spill) {
+        return res;
+      }
+      //缓冲区已经是满的状态，等待填满缓冲区的线程调整写指针后重试
+      if (action == overflowAction::block) {
+        waitForWriteCur(block);
+      } else if (!waitForWriteCur(block,
+                                  clock::now() + std::chrono::milliseconds(
+                                                     overflow.timeoutMs))) {
+        return res;
+      }
+      continue;
+    }
+
+    //移出缓存环的缓存块在所有读取写指针的线程离开之前保持封存，预留成功的缓存块一定属于本实例
+    assert(block->getOwner() == this);
+    res.first = {writePtr, reservedLen, block, reservedLen};
+    if (isFull) {
+      //当前线程填满了缓冲区，负责调整写指针，跨越边界的剩余部分在新缓冲区的起始位置预留
+      std::unique_lock<std::mutex> lock(writeCur_mtx, std::defer_lock);
+      bool handedOff = true;
+      if (action == overflowAction::block) {
+        lock.lock();
+        handOffFullBlock(res, len, contiguous, lock);
+      } else if (action == overflowAction::blockWithTimeout) {
+        lock.lock();
+        handedOff = handOffFullBlock(
+            res, len, contiguous, lock,
+            clock::now() + std::chrono::milliseconds(overflow.timeoutMs));
+      } else if (lock.try_lock()) {
+        //不借用也不等待，只使用空闲的后继缓存块
+        handedOff = handOffFullBlock(res, len, contiguous, lock,
+                                     clock::time_point::min());
+      } else if (len == reservedLen) {
+        //区间恰好填满缓存块，数据仍可写入，只将调整写指针交给持久化线程
+        handOffPending = true;
+      } else {
+        handedOff = false;
+        deferHandOff(res);
+      }
+      if (lock.owns_lock()) {
+        lock.unlock();
+      }
+      notifyPersist();
+      if (!handedOff) {
+        return reservation();
+      }
+    } else if (Policy == producerPolicy::multi && flushDeadline > 0 &&
+               persistIdle && persistIdle.exchange(false)) {
+      //持久化线程空闲时由第一个写入的线程唤醒，开始计算写出期限
+      notifyPersist();
+    }
+
+    //持久化凭据为区间末尾在数据流中的偏移量
+    const auto &last = res.second.block != nullptr ? res.second : res.first;
+    res.ticket = last.block->getStreamOffset() +
+                 (last.data - last.block->getData()) + last.reservedLen;
+    return res;
+  }
+}
+
+bool mmapBuffer::tryReserveRaw(size_t len, bool contiguous,
+                               reservation &res) {
+  //持有writeCur_mtx且写指针之后有空闲缓存块时，调整写指针不会等待
+  std::unique_lock<std::mutex> lock(writeCur_mtx, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return false;
+  }
+  mmapBlock *block = writeCur;
+  if (block->next == block || !block->next->isEmpty()) {
+    return false;
+  }
+  auto [writePtr, reservedLen, isFull] = block->reserve(len);
+  if (reservedLen == 0) {
+    //填满该缓存块的线程正在等待writeCur_mtx
+    return false;
+  }
+  res.first = {writePtr, reservedLen, block, reservedLen};
+  if (isFull) {
+    handOffFullBlock(res, len, contiguous, lock);
+    lock.unlock();
+    notifyPersist();
+  }
+  const auto &last = res.second.block != nullptr ? res.second : res.first;
+  res.ticket = last.block->getStreamOffset() +
+               (last.data - last.block->getData()) + last.reservedLen;
+  return true;
+}
+
+bool mmapBuffer::handOffFullBlock(
+    reservation &res, size_t len, bool contiguous,
+    std::unique_lock<std::mutex> &lock,
+    std::chrono::steady_clock::time_point deadline) {
+  mmapBlock *block = res.first.block;
+  size_t reservedLen = res.first.reservedLen;
+  size_t remainLen = len - reservedLen;
+  bool padded = contiguous && remainLen > 0;
+  if (padded) {
+    //不允许拆分时缓冲区末尾填零作为填充，整个区间在新缓冲区的起始位置预留
+    memset(res.first.data, 0, reservedLen);
+    remainLen = len;
+  }
+  char *remainPtr = advanceWriteCur(remainLen, lock, deadline);
+  if (remainPtr == nullptr) {
+    //没有可用的新缓存块，区间恰好填满缓存块时数据仍可写入，否则放弃本次写入
+    if (remainLen == 0) {
+      handOffPending = true;
+      return true;
+    }
+    deferHandOff(res);
+    return false;
+  }
+  if (padded) {
+    //写指针离开后才能提交填充，提交后该缓存块可能立即被持久化
+    block->commit(reservedLen);
+    res.first = {remainPtr, remainLen, writeCur, remainLen};
+  } else if (remainLen > 0) {
+    res.second = {remainPtr, remainLen, writeCur, remainLen};
+  }
+  return true;
+}
+
+bool mmapBuffer::waitForWriteCur(
+    mmapBlock *block, std::chrono::steady_clock::time_point deadline) {
+  using clock = std::chrono::steady_clock;
+  auto ready = [&] {
+    enterRing<producerPolicy::multi>();
+    mmapBlock *current = writeCur;
+    bool available = current != block ||
+                     (!current->isSealed() && current->getFreeSpace() > 0);
+    leaveRing<producerPolicy::multi>();
+    return available;
+  };
+  //填满缓存块的线程调整写指针只需很短时间，先让出CPU重试
+  for (int i = 0; i < handOffSpins && !ringExhausted; i++) {
+    if (ready()) {
+      return true;
+    }
+    std::this_thread::yield();
+  }
+  //先读取计数再检查条件，检查之后的调整都会改变计数，休眠不会错过唤醒
+  while (true) {
+    uint32_t epoch = writeCurEpoch.load();
+    if (ready()) {
+      return true;
+    }
+    if (deadline == clock::time_point::max()) {
+      writeCurEpoch.wait(epoch);
+    } else if (clock::now() >= deadline) {
+      return false;
+    } else {
+      //原子等待不支持超时，限时等待时轮询
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+}
+
+void mmapBuffer::notifyWriters() {
+  writeCurEpoch++;
+  writeCurEpoch.notify_all();
+  //挂起的协程写入由持久化线程重试
+  if (appendWaiterCount > 0) {
+    notifyPersist();
+  }
+}
+
+void mmapBuffer::deferHandOff(const reservation &res) {
+  //撤销预留而不是填充，非分帧模式的输出中不会出现零字节，缓存块仍未写满，写指针不需要调整
+  mmapBlock *block = res.first.block;
+  block->releaseTail(res.first.data - block->getData());
+  growPending = true;
+  //预留失败后等待的线程可以重新预留
+  notifyWriters();
+}
+
+void mmapBuffer::completeHandOff() {
+  if (!handOffPending && !growPending) {
+    return;
+  }
+  //其他线程正在调整缓存环时留到下一轮
+  std::unique_lock<std::mutex> lock(writeCur_mtx, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  //持久化线程不在写入路径上，可以创建缓存块文件，但不等待持久化和内存预算
+  auto now = std::chrono::steady_clock::now();
+  if (handOffPending) {
+    if (advanceWriteCur(0, lock, now) == nullptr) {
+      return;
+    }
+    handOffPending = false;
+  }
+  //写指针之后没有空闲缓存块时借用一个，下一次填满缓存块的写入线程可以立即调整写指针
+  if (growPending.exchange(false)) {
+    mmapBlock *block = writeCur;
+    if (!block->next->isEmpty()) {
+      addBufferBlock(block, nextBlockSize());
+    }
+  }
+}
+
+bool mmapBuffer::handleOverflow(const char *data, size_t len,
+                                size_t payloadLen) {
+  if (spillFd >= 0 && len > 0) {
+    std::unique_lock<std::mutex> lock(spillMutex);
+    size_t written = 0;
+    while (written < len) {
+      ssize_t n = write(spillFd, data + written, len - written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      written += n;
+    }
+    if (written == len) {
+      spilledBytes += payloadLen;
+      return true;
+    }
+  }
+  droppedBytes += payloadLen;
+  return false;
+}
+
+mmapBuffer::stagingArea *mmapBuffer::localStagingArea(bool create) {
+  stagingSlots &slots = localSlots;
+  if (slots.lastId == instanceId) {
+    return slots.last;
+  }
+  auto it = slots.areas.find(instanceId);
+  if (it == slots.areas.end()) {
+    if (!create) {
+      return nullptr;
+    }
+    //清理已析构实例的暂存区
+    for (auto iter = slots.areas.begin(); iter != slots.areas.end();) {
+      std::unique_lock<std::mutex> lock(iter->second->mtx);
+      bool closed = iter->second->owner == nullptr;
+      lock.unlock();
+      iter = closed ? slots.areas.erase(iter) : std::next(iter);
+    }
+    auto area = std::make_shared<stagingArea>();
+    area->owner = this;
+    area->data = std::make_unique<char[]>(stagingCapacity);
+    {
+      //同时清理已退出线程的空暂存区
+      std::unique_lock<std::mutex> lock(stagingMutex);
+      std::erase_if(stagingAreas, [](const auto &other) {
+        std::unique_lock<std::mutex> otherLock(other->mtx);
+        return other->orphaned && other->len == 0;
+      });
+      stagingAreas.push_back(area);
+    }
+    it = slots.areas.emplace(instanceId, std::move(area)).first;
+  }
+  slots.lastId = instanceId;
+  slots.last = it->second.get();
+  return slots.last;
+}
+
+bool mmapBuffer::publishStaging(stagingArea &area, bool wait, bool noLose) {
+  if (area.len == 0) {
+    return true;
+  }
+  //暂存区不超过缓存块大小的一半，分帧模式下整批记录位于同一个缓存块中
+  reservation res;
+  if (wait) {
+    res = reserveRaw(area.len, recordFraming,
+                     noLose ? overflowAction::block : overflow.action);
+  } else if (!tryReserveRaw(area.len, recordFraming, res)) {
+    return false;
+  }
+  bool published = res.isValid();
+  if (published) {
+    memcpy(res.first.data, area.data.get(), res.first.len);
+    if (res.second.data != nullptr) {
+      memcpy(res.second.data, area.data.get() + res.first.len,
+             res.second.len);
+    }
+    commit(res);
+  } else {
+    //缓存写满时整批暂存数据按溢出策略处理
+    size_t headerLen = recordFraming ? mmapRecord::headerSize : 0;
+    handleOverflow(area.data.get(), spillFd >= 0 ? area.len : 0,
+                   area.len - area.records * headerLen);
+  }
+  area.len = 0;
+  area.records = 0;
+  stagedAreas--;
+  return published;
+}
+
+int mmapBuffer::publishDueStaging() {
+  if (stagedAreas == 0) {
+    return -1;
+  }
+  //持久化线程不能等待写入线程持有的锁，无法立即发布时稍后重试
+  std::unique_lock<std::mutex> lock(stagingMutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return 1;
+  }
+  auto now = std::chrono::steady_clock::now();
+  int timeout = -1;
+  for (auto &area : stagingAreas) {
+    std::unique_lock<std::mutex> areaLock(area->mtx, std::try_to_lock);
+    if (!areaLock.owns_lock()) {
+      timeout = earlierTimeout(timeout, 1);
+      continue;
+    }
+    if (area->len == 0) {
+      continue;
+    }
+    auto remain = std::chrono::ceil<std::chrono::milliseconds>(
+        area->stagedSince + std::chrono::milliseconds(stagingPublishMs) - now);
+    if (remain.count() > 0) {
+      timeout = earlierTimeout(timeout, remain.count());
+    } else if (!publishStaging(*area, false)) {
+      timeout = earlierTimeout(timeout, 1);
+    }
+  }
+  return timeout;
+}
+
+void mmapBuffer::publishAllStaging(bool close) {
+  if (stagingCapacity == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(stagingMutex);
+  for (auto &area : stagingAreas) {
+    std::unique_lock<std::mutex> areaLock(area->mtx);
+    publishStaging(*area);
+    if (close) {
+      area->owner = nullptr;
+      area->data.reset();
+    }
+  }
+  if (close) {
+    stagingAreas.clear();
+  }
+}
+
+void mmapBuffer::commit(const reservation &res) {
+  if (producer == producerPolicy::single) {
+    commitAs<producerPolicy::single>(res);
+  } else {
+    commitAs<producerPolicy::multi>(res);
+  }
+}
+
+template <producerPolicy Policy>
+void mmapBuffer::commitAs(const reservation &res) {
+  if (res.first.block != nullptr) {
+    res.first.block->commit<Policy>(res.first.reservedLen);
+  }
+  if (res.second.block != nullptr) {
+    res.second.block->commit<Policy>(res.second.reservedLen);
+  }
+}
+
+char *mmapBuffer::advanceWriteCur(
+    size_t remainLen, std::unique_lock<std::mutex> &lock,
+    std::chrono::steady_clock::time_point deadline) {
+  using clock = std::chrono::steady_clock;
+  //只有填满写指针所在缓存块的线程会调整写指针，释放锁等待期间写指针不会改变
+  mmapBlock *block = writeCur;
+  while (true) {
+    //先读取计数再检查后继缓存块，检查之后完成的持久化都会改变计数
+    uint64_t generation = ringGeneration;
+    if (block->next->isEmpty()) { //下一个缓冲区可用
+      break;
+    }
+    if (deadline == clock::time_point::min()) {
+      //不等待时也不借用，创建缓存块文件在磁盘停顿时同样会阻塞
+      return nullptr;
+    }
+    if (addBufferBlock(block, nextBlockSize())) {
+      //从缓存块池借用新缓冲区
+      break;
+    }
+    if (clock::now() >= deadline) {
+      return nullptr;
+    }
+
+    //等待时释放writeCur_mtx，持久化线程持有persistCur_mtx时也会获取该锁
+    ringExhausted = true;
+    lock.unlock();
+    auto advanced = [&] { return ringGeneration != generation; };
+    bool ready = true;
+    if (mmapBlockPool::getInstance().getBudget() > 0) {
+      //全局内存预算耗尽，等待本实例完成持久化或其他实例归还缓存块
+      ready = mmapBlockPool::getInstance().waitForBudget(nextBlockSize(),
+                                                          advanced, deadline);
+    } else { //无法添加更多的缓冲区，需要等待
+      std::unique_lock<std::mutex> persistLock(persistCur_mtx);
+      if (deadline == clock::time_point::max()) {
+        blockPersistenceDone.wait(persistLock, advanced);
+      } else {
+        ready =
+            blockPersistenceDone.wait_until(persistLock, deadline, advanced);
+      }
+    }
+    lock.lock();
+    ringExhausted = false;
+    if (!ready && !block->next->isEmpty()) {
+      return nullptr;
+    }
+  }
+
+  //在写指针指向新缓存块之前启用它并预留剩余部分，其他线程无法抢先写入
+  mmapBlock *nextBlock = block->next;
+  assert(nextBlock->isEmpty());
+  nextBlock->setStreamOffset(block->getStreamOffset() + block->getBlockSize());
+  char *remainPtr = nextBlock->reset(blockSequence++, remainLen);
+  writeCur = nextBlock;
+  notifyWriters();
+  if (prefaultBlocks > 0) {
+    prefaultPending = true;
+    notifyPersist();
+  }
+  return remainPtr;
 }
 
 size_t mmapBuffer::getPersistenceFileLen() const {
-  return persistenceFileOffset;
+  //压缩帧自身按页面对齐，不保留未写完的页面
+  return persistCodec ? persistenceFileOffset
+                      : persistenceFileOffset + carriedTailLen;
 }
 
 size_t mmapBuffer::getActualDataLen() const { return actualDataLen; }
\ No newline at end of file
@@ -1,17 +1,147 @@
 #ifndef __MMAPBUFFER__
 #define __MMAPBUFFER__
 
+#include "ioUring.h"
 #include "mmapBlock.h"
+#include "mmapBlockPool.h"
+#include "mmapCodec.h"
+#include "mmapReader.h"
+#include "persistScheduler.h"
 #include <atomic>
+#include <chrono>
+#include <climits>
 #include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <sys/uio.h>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 class mmapBuffer {
+public:
+  /**
+   * @brief
+   * 缓存中预留的写入区间。数据跨越缓存块边界时分为两段，second位于下一个缓存块的起始位置
+   */
+  struct reservation {
+    struct segment {
+      char *data = nullptr;       //可直接写入的缓存地址
+      size_t len = 0;             //该段的长度
+      mmapBlock *block = nullptr; //该段所在的缓存块
+      size_t reservedLen = 0; //该段在缓存块中实际预留的长度，分帧模式下包含记录头部
+    };
+    segment first;
+    segment second;
+    //持久化凭据，即预留区间末尾在数据流中的偏移量，可传入waitUntilPersisted
+    uint64_t ticket = 0;
+
+    //预留是否成功
+    bool isValid() const { return first.data != nullptr; }
+    //预留的总长度
+    size_t size() const { return first.len + second.len; }
+  };
+
+  /**
+   * @brief 持久化文件轮转策略，满足任一条件时在缓存块边界切换到新文件
+   */
+  struct rotationPolicy {
+    //当前文件达到该长度后切换，0表示不限制
+    size_t maxBytes = 0;
+    //当前文件写入超过该时间后切换，0表示不限制
+    unsigned intervalSeconds = 0;
+    //新文件的路径格式，{n}替换为轮转序号，其余部分按strftime展开。
+    //为空时使用持久化文件路径后跟.{n}
+    std::string namePattern;
+  };
+
+  /**
+   * @brief 缓存写满时的处理方式
+   */
+  enum class overflowAction {
+    block,            //阻塞等待持久化释放缓存块
+    blockWithTimeout, //阻塞等待，超时后丢弃
+    dropNewest,       //立即丢弃本次写入的数据
+    spill             //立即将本次写入的数据追加到溢出文件
+  };
+
+  /**
+   * @brief 缓存写满时的溢出策略，只作用于noLose为false的写入
+   */
+  struct overflowPolicy {
+    overflowAction action = overflowAction::block;
+    // blockWithTimeout的最长等待时间(ms)
+    unsigned timeoutMs = 0;
+    //溢出文件路径，为空时使用持久化文件路径后跟.overflow
+    std::string spillFilePath;
+  };
+
+  /**
+   * @brief 缓存块伸缩策略，超出初始数量的缓存块按几何级数增大，空闲一段时间后归还缓存块池
+   */
+  struct elasticPolicy {
+    //超出初始数量的空闲缓存块在空闲该时间后归还，0表示持久化后立即归还
+    unsigned idleShrinkMs = 1000;
+    //每借用一个缓存块，下一个缓存块的大小乘以该倍数，1表示所有缓存块大小相同
+    unsigned growthFactor = 1;
+    //增长后单个缓存块大小的上限，0表示初始缓存块大小的64倍
+    size_t maxBlockSize = 0;
+  };
+
+  /**
+   * @brief
+   * co_await append()的等待体。缓存有空间时在当前线程直接写入，不挂起协程；
+   * 没有可用的缓存空间时挂起协程，持久化线程清空缓存块后按挂起顺序代为写入，之后恢复协程
+   */
+  class appendAwaiter {
+  public:
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> _handle);
+    /**
+     * @return 返回持久化凭据，可传入persisted；分帧模式下记录为空或过长时返回0
+     */
+    uint64_t await_resume() const { return ticket; }
+
+  private:
+    friend class mmapBuffer;
+    appendAwaiter(mmapBuffer *_buffer, const char *_data, size_t _len)
+        : buffer(_buffer), data(_data), len(_len) {}
+
+    mmapBuffer *buffer;
+    const char *data;
+    size_t len;
+    //已写入的长度，超过单个缓存块大小的数据分段写入，挂起后从该位置继续
+    size_t written = 0;
+    uint64_t ticket = 0;
+    std::coroutine_handle<> handle;
+  };
+
+  /**
+   * @brief
+   * co_await persisted()的等待体。数据已写出时不挂起，否则请求写出后挂起协程，由持久化线程恢复
+   */
+  class persistAwaiter {
+  public:
+    bool await_ready() const;
+    bool await_suspend(std::coroutine_handle<> _handle);
+    //数据已写出时返回true，出错且数据尚未写出时返回false
+    bool await_resume() const;
+
+  private:
+    friend class mmapBuffer;
+    persistAwaiter(mmapBuffer *_buffer, uint64_t _ticket)
+        : buffer(_buffer), ticket(_ticket) {}
+
+    mmapBuffer *buffer;
+    uint64_t ticket;
+    std::coroutine_handle<> handle;
+  };
+
 private:
   //全局构造锁
   static std::mutex instenceMapMutex;
@@ -29,39 +159,106 @@ private:
   //整体buffer的互斥锁
   std::mutex bufferMutex;
 
+  //保护缓存环的结构和写指针的调整，只在调整时短暂持有，等待持久化或内存预算时不持有
   std::mutex writeCur_mtx;
   std::mutex persistCur_mtx;
 
-  std::condition_variable writeCur_cv;
+  //写指针调整或封存的缓存块重新启用时加一，等待的写入线程在该计数上休眠
+  std::atomic_uint32_t writeCurEpoch = 0;
+  //填满缓存块的线程正在等待持久化或内存预算，此时等待的写入线程直接休眠
+  std::atomic_bool ringExhausted = false;
+  //缓存块被持久化清空时加一，填满缓存块的线程据此判断是否有新的空闲缓存块
+  std::atomic_uint64_t ringGeneration = 0;
+  //等待写指针调整时休眠前让出CPU重试的次数
+  static constexpr int handOffSpins = 64;
+
+  //强制持久化请求计数，每次调用waitForBufferPersist加一
+  uint64_t forcePersistRequest = 0;
+  //持久化线程已完成的强制持久化请求计数
+  uint64_t forcePersistDone = 0;
+  //最近一次不保留尾部的强制持久化请求，关闭或更换持久化文件之前使用
+  uint64_t dropTailRequest = 0;
 
-  //强制持久化标志位
-  bool forcePersist = false;
-  //整体buffer为空标志位
-  bool bufferEmpty = false;
+  //保护协程的等待队列，持有时只进行不等待的写入
+  std::mutex await_mtx;
+  //挂起的协程写入，按挂起顺序代为写入
+  std::deque<appendAwaiter *> appendWaiters;
+  //挂起等待数据写出的协程
+  std::vector<persistAwaiter *> persistWaiters;
+  //等待队列的长度，没有挂起的协程时写入和持久化线程只进行一次原子读取
+  std::atomic_size_t appendWaiterCount = 0;
+  std::atomic_size_t persistWaiterCount = 0;
+  //恢复协程的执行器，为空时在持久化线程上直接恢复
+  std::function<void(std::coroutine_handle<>)> coroutineExecutor;
   //允许写入标志位
   bool enableWrite = true;
 
-  // buffer block 已满的条件变量
-  std::condition_variable blockIsFull;
+  //唤醒持久化线程的eventfd，缓存块写满、请求写出或强制持久化时写入
+  int persistEventFd = -1;
+  //持久化线程空闲等待时为true，写入线程据此唤醒持久化线程开始计算写出期限
+  std::atomic_bool persistIdle = false;
+  //未写出数据的最长停留时间(ms)，为0时只在缓存块写满或请求写出时写出
+  unsigned int flushDeadline = 0;
+  //写入线程的并发策略
+  producerPolicy producer = producerPolicy::multi;
+  //缓存写满时的溢出策略
+  overflowPolicy overflow;
+  //溢出文件标识符，未使用spill或打开失败时为-1
+  int spillFd = -1;
+  //保证每次溢出的数据在溢出文件中连续
+  std::mutex spillMutex;
+  //因缓存写满被丢弃的数据长度
+  std::atomic_uint64_t droppedBytes = 0;
+  //因缓存写满写入溢出文件的数据长度
+  std::atomic_uint64_t spilledBytes = 0;
+  //填满写缓存块的线程无法立即获得新缓存块时置位，由持久化线程代为调整写指针
+  std::atomic_bool handOffPending = false;
+  //放弃写入的线程撤销预留后置位，由持久化线程为写指针所在的缓存块借用后继缓存块
+  std::atomic_bool growPending = false;
+  //当前未写出的数据最早被发现的时间
+  std::chrono::steady_clock::time_point dirtySince;
+  //是否存在已计时的未写出数据
+  bool dirty = false;
+  //写指针之后预取的缓存块数量，为0时不预取
+  size_t prefaultBlocks = 1;
+  //预取时是否锁定缓存块内存
+  bool prefaultLock = false;
+  //写指针进入新缓存块后置位，由持久化线程预取之后的缓存块
+  std::atomic_bool prefaultPending = false;
   // buffer block 持久化完成的条件变量
   std::condition_variable blockPersistenceDone;
-  //整体buffer空的条件变量
+  //强制持久化完成的条件变量
   std::condition_variable bufferIsEmpty;
   //允许写入标志位发生变更的条件变量
   std::condition_variable enableWriteFlagChanged;
 
   //缓存块头部指针
   mmapBlock *head = nullptr;
-  //缓存块写指针
-  mmapBlock *writeCur = nullptr;
+  //缓存块写指针，写入线程不加锁读取，只由填满当前缓存块的线程调整
+  std::atomic<mmapBlock *> writeCur = nullptr;
+  //正在读取写指针并在其缓存块中预留的写入线程数量，单独占用一个缓存行，
+  //移出缓存环的缓存块只在该计数为零后才归还缓存块池
+  alignas(64) std::atomic_uint32_t ringReaders = 0;
   //缓存块持久化指针
   mmapBlock *persistenceCur = nullptr;
 
-  //当前缓存块数量
-  size_t blockCount = 0;
-  //最大缓存块数量
+  //当前缓存块数量，在writeCur_mtx下修改，持久化线程不加锁读取
+  std::atomic_size_t blockCount = 0;
+  //最大缓存块数量，设置全局内存预算时不生效
   size_t maxBlockCount = 0;
-  //缓存块大小
+  //初始缓存块数量，超出的缓存块从缓存块池借用，持久化后归还
+  size_t baseBlockCount = 0;
+  //下一个缓存块文件的编号，只增不减，归还和借用缓存块后文件名不会重复
+  size_t blockFileIndex = 0;
+  //缓存块伸缩策略
+  elasticPolicy elastic;
+  //下一次检查空闲缓存块的时间，没有超出初始数量的缓存块时不检查
+  std::chrono::steady_clock::time_point shrinkDeadline;
+  //是否需要在shrinkDeadline检查空闲缓存块
+  bool shrinkPending = false;
+  //已移出缓存环、等待读取写指针的线程全部离开后归还的缓存块，只由持久化线程访问
+  std::vector<mmapBlock *> retiredBlocks;
+  //初始缓存块大小，也是单次写入长度的上限，借用的缓存块可能更大
   size_t blockSize = 0;
   //系统页面大小
   size_t systemPageSize = 4096;
@@ -71,9 +268,15 @@ private:
 
   //实际的数据长度，不计页面对齐时的补足字节
   size_t actualDataLen = 0;
+  //强制持久化后保留在持久化指针所在缓存块起点的不足一页的尾部，已经写入文件且计入actualDataLen。
+  //persistenceFileOffset始终按页面对齐，下一次写出时原地重写该页面，文件中不留补足的空洞
+  size_t carriedTailLen = 0;
 
-  //持久化等待超时，即等待缓冲区满的时间间隔
-  unsigned int persistenceWaitTimeOut = 0;
+  //缓存块启用序号计数，写入缓存块文件头部，崩溃恢复时按序号顺序写入
+  std::atomic_uint64_t blockSequence = 0;
+
+  //记录分帧模式，开启后每条记录前添加长度头部，可通过mmapReader逐条读取
+  bool recordFraming = false;
 
   //持久化文件路径
   std::string persistenceFilePath = "";
@@ -81,30 +284,527 @@ private:
   int persistenceFileFd = 0;
   // mmap临时文件的基础文件名，新建的文件会在后面跟上编号（从0开始）
   std::string bufferFileBasePath = "";
+  //缓存块内存的来源
+  blockBacking backing = blockBacking::file;
+  // shm模式下缓存块文件所在的tmpfs目录
+  static constexpr const char *shmDirectory = "/dev/shm";
+
+  // io_uring提交队列深度，为0时使用pwrite64同步写出
+  unsigned ioUringDepth = 0;
+  //是否将缓存块注册为io_uring固定缓冲区
+  bool ioUringRegisterBuffers = false;
+  //持久化线程使用的io_uring实例，内核不支持时为空
+  std::unique_ptr<ioUring> persistRing;
+
+  //写入或同步失败后重试的间隔(ms)
+  static constexpr int errorRetryMs = 100;
+  //已写入持久化文件的数据流偏移量，之前的数据都已写出
+  std::atomic_uint64_t persistedOffset = 0;
+  //已通过fdatasync落盘的数据流偏移量
+  std::atomic_uint64_t durableOffset = 0;
+  //等待写出的最大持久化凭据
+  std::atomic_uint64_t flushRequest = 0;
+  //等待落盘的最大持久化凭据
+  std::atomic_uint64_t syncRequest = 0;
+  //第一次写入或同步持久化文件失败时的errno，置位后不再清除
+  std::atomic_int persistError = 0;
+  //出错之后到该时间才重试写出，持续的错误不会占满调度器的工作线程
+  std::chrono::steady_clock::time_point retryAfter;
+  //持久化指针指向的未满缓存块中已经写出的长度
+  size_t partialFlushLen = 0;
+  //强制持久化封存的缓存块长度和切换文件时留在旧文件中的尾部长度。封存之前的预留区间未全部提交
+  //或写出失败时缓存块保持封存直到重试写出成功，为0表示没有待重试的封存缓存块
+  size_t sealedLen = 0;
+  size_t sealedHeadLen = 0;
+
+  //持久化文件轮转策略
+  rotationPolicy rotation;
+  //轮转文件名的基础路径，即initBuffer或changePersistFile指定的持久化文件路径
+  std::string rotationBasePath = "";
+  //当前文件按时间轮转的截止时间
+  std::chrono::steady_clock::time_point rotationDeadline;
+  //已分配的轮转序号
+  size_t rotationIndex = 0;
+  //保护后继文件状态的互斥锁
+  std::mutex rotation_mtx;
+  //后台任务结束时通知析构函数
+  std::condition_variable rotation_cv;
+  //是否已向调度器提交了准备后继文件的后台任务
+  bool rotationJobPending = false;
+  //已打开并预分配空间的后继文件，尚未就绪时为-1
+  int nextFileFd = -1;
+  //后继文件的临时路径，切换时重命名
+  std::string nextFilePath = "";
+  //后继文件的轮转序号
+  size_t nextFileIndex = 0;
+  //切换后有待后台任务关闭的旧文件
+  std::vector<int> retiredFileFds;
+  //析构时置位，之后不再提交后台任务
+  bool rotationStop = false;
+  //轮转后写在新文件开头的记录，由rotation_mtx保护
+  std::function<std::vector<std::string>()> rotationPrologue;
+
+  //在持久化调度器中的来源编号
+  uint64_t schedulerSourceId = 0;
+  //调度优先级，数值越大越先被处理
+  int schedulingPriority = 0;
+  //每次被调度时最多连续执行的持久化步数
+  unsigned schedulingWeight = 1;
+
+  /**
+   * @brief 一个线程在一个缓存实例上的暂存区，小记录先在此累积，再一次预留写入缓存块
+   */
+  struct stagingArea {
+    //所属线程追加时持有，其他线程发布时持有
+    std::mutex mtx;
+    //所属缓存实例，实例析构后为nullptr
+    mmapBuffer *owner = nullptr;
+    //暂存的数据，分帧模式下包含记录头部
+    std::unique_ptr<char[]> data;
+    size_t len = 0;
+    //暂存的记录数量，用于计算溢出的数据长度
+    size_t records = 0;
+    //暂存区从空变为非空的时间
+    std::chrono::steady_clock::time_point stagedSince;
+    //所属线程已经退出
+    bool orphaned = false;
+  };
+
+  /**
+   * @brief 线程本地的暂存区表，线程退出时发布剩余的暂存数据
+   */
+  struct stagingSlots {
+    //实例编号到暂存区的映射
+    std::unordered_map<uint64_t, std::shared_ptr<stagingArea>> areas;
+    //最近使用的暂存区，避免每次追加都查找
+    uint64_t lastId = 0;
+    stagingArea *last = nullptr;
+    ~stagingSlots();
+  };
+
+  //当前线程的暂存区表
+  static thread_local stagingSlots localSlots;
+  //下一个缓存实例的编号
+  static std::atomic_uint64_t nextInstanceId;
+  //实例编号，实例地址可能被复用，线程暂存区按编号查找
+  const uint64_t instanceId = nextInstanceId++;
+  //线程暂存区大小，为0时不启用线程暂存
+  size_t stagingCapacity = 0;
+  //暂存数据的最长停留时间(ms)
+  unsigned stagingPublishMs = 0;
+  //保护stagingAreas
+  std::mutex stagingMutex;
+  //所有线程在该实例上的暂存区
+  std::vector<std::shared_ptr<stagingArea>> stagingAreas;
+  //有数据的暂存区数量，从0变为1时唤醒持久化线程开始计时
+  std::atomic_size_t stagedAreas = 0;
+
+  //持久化压缩算法，为空时直接写出缓存块数据
+  std::shared_ptr<mmapCodec> persistCodec;
+  //压缩帧和部分写出的页对齐暂存缓冲区，只由持久化线程使用
+  char *frameBuffer = nullptr;
+  //暂存缓冲区长度
+  size_t frameBufferLen = 0;
 
   /**
    * @brief
-   * 添加一个缓存块，会进行缓存块限制检查和缓存块初始化检查（即头部指针为空的情况）
-   * @param _mmapFd 打开的缓存块文件标识符
-   * @param _filePath 缓存块文件路径
-   * @param _blockSize 缓存块大小
+   * 从缓存块池借用一个缓存块加入环形链表，会进行缓存块限制检查和缓存块初始化检查（即头部指针为空的情况）。
+   * 未设置全局内存预算时数量受maxBlockCount限制，否则只受预算限制
    * @param _insertCur 在该指针指向的缓存块后插入新缓存块
+   * @param _blockSize 缓存块大小
+   * @param _force 为true时不受数量和预算限制，用于初始缓存块
    * @return 操作成功返回true
    */
-  bool addBufferBlock(const std::string &_filePath, size_t _blockSize,
-                      mmapBlock *_insertCur);
+  bool addBufferBlock(mmapBlock *_insertCur, size_t _blockSize,
+                      bool _force = false);
 
   /**
-   * @brief 删除一个缓存块，会同时删除被映射的文件
-   * @param block 要删除的缓存块指针
-   * @return none
+   * @brief 按伸缩策略计算下一个借用的缓存块大小
+   */
+  size_t nextBlockSize() const;
+
+  /**
+   * @brief 将一个缓存块从环形链表中移除，不归还缓存块池
+   * @param block 要移除的缓存块指针，必须为空闲的缓存块
    */
   void removeBufferBlock(mmapBlock *block);
 
   /**
-   * @brief 执行数据持久化逻辑
+   * @brief
+   * 移除超出初始数量且空闲时间达到idleShrinkMs的缓存块，优先移除较大的缓存块，
+   * 需持有persistCur_mtx。同时更新下一次检查的时间，写入线程正在调整写指针时不等待，稍后重试。
+   * 移除的缓存块先放入retiredBlocks，没有线程正在读取写指针时才交给调用方归还
+   * @return 返回已移除、需要归还缓存块池的缓存块，调用方在释放锁之后归还
+   */
+  std::vector<mmapBlock *> detachSurplusBlocks();
+
+  /**
+   * @brief 将空闲时间已到的超出初始数量的缓存块移出缓存环，放入retiredBlocks，需持有writeCur_mtx
+   * @param now 当前时间
+   */
+  void retireIdleBlocks(std::chrono::steady_clock::time_point now);
+
+  /**
+   * @brief 在at之前再检查一次空闲缓存块
+   */
+  void scheduleShrink(std::chrono::steady_clock::time_point at);
+
+  /**
+   * @brief 将detachSurplusBlocks移除的缓存块归还缓存块池，调用时不持有persistCur_mtx
+   */
+  void releaseSurplusBlocks(const std::vector<mmapBlock *> &blocks);
+
+  /**
+   * @brief
+   * 预取写指针之后的缓存块，写指针之后没有空闲缓存块时先从缓存块池借用一个，
+   * 写入线程到达缓存块边界时不会在创建文件和缺页上停顿。在持久化线程上调用
+   * @return 写入线程正在调整写指针时不等待，返回false，稍后重试
+   */
+  bool prefaultAhead();
+
+  /**
+   * @brief 执行一步数据持久化逻辑，由持久化调度器的工作线程调用，同一时刻只有一个线程执行
+   * @return 还有待处理的工作时返回0，空闲时返回-1，否则返回距写出期限的毫秒数
+   */
+  int persist();
+
+  /**
+   * @brief 唤醒持久化线程
+   */
+  void notifyPersist();
+
+  /**
+   * @brief
+   * 计算持久化线程的等待时间，需持有persistCur_mtx。写出期限到达时登记对未满缓存块的写出请求
+   * @return 有待处理的工作时返回0，没有未写出的数据时返回-1表示无限等待，否则返回距写出期限的毫秒数
+   */
+  int persistWaitTimeout();
+
+  /**
+   * @brief 出错之后距离下一次重试写出的时间(ms)，不需要等待时返回0
+   */
+  int persistRetryDelay() const;
+
+  /**
+   * @brief
+   * 查找bufferFileBasePath下上次异常退出遗留的缓存块文件，将其中已提交的数据按启用序号顺序追加到持久化文件末尾，落盘后删除这些文件。
+   * 仍被其他运行中实例持有文件锁的缓存块文件被跳过。写入或同步失败时记录错误码，未能写出并落盘的缓存块文件保留到下次启动时再次恢复，
+   * 新的缓存块文件编号和启用序号排在保留的文件之后
+   * @param tail
+   * 未压缩时持久化文件末尾不足一页的部分，由调用方放入第一个缓存块起点作为保留的尾部
+   * @return 返回恢复的数据长度
+   * @note 缓存块写出后、在头部记录已写出长度之前崩溃时该缓存块会被重复恢复，即恢复提供至少一次的语义。
+   * 没有需要恢复的数据时同样从持久化文件末尾继续写入
+   */
+  size_t recoverBufferFiles(std::string &tail);
+
+  /**
+   * @brief 按帧头部累加持久化文件中压缩帧解码后的长度，不解压数据
+   * @param fileLen 持久化文件长度
+   * @param pageBuffer 按页面对齐、长度为一个页面的缓冲区，满足O_DIRECT读取的要求
+   * @return 遇到无法识别的头部时返回此前的累计长度
+   */
+  uint64_t decodedFileLen(size_t fileLen, char *pageBuffer);
+
+  /**
+   * @brief 返回从offset补零到下一个页面边界的长度，已对齐时返回0
+   */
+  size_t paddingLen(uint64_t offset) const;
+
+  /**
+   * @brief 从持久化指针开始收集连续的已满缓存块，调用时不持有persistCur_mtx
+   * @param maxCount 收集数量上限
+   * @return 已满且预留区间全部提交的缓存块，至少包含持久化指针指向的缓存块
+   */
+  std::vector<mmapBlock *> collectFullBlocks(size_t maxCount);
+
+  /**
+   * @brief 使用一次pwritev2将连续的已满缓存块写入持久化文件，处理不完整的写入
+   * @param blocks collectFullBlocks收集的缓存块
+   * @return 返回从持久化文件当前长度起连续写入的字节数，出错时小于缓存块的总长度
+   */
+  size_t persistBlocksVectored(const std::vector<mmapBlock *> &blocks);
+
+  /**
+   * @brief 使用io_uring将连续的已满缓存块同时写入持久化文件，全部完成或出错后返回
+   * @param blocks collectFullBlocks收集的缓存块
+   * @return 返回从持久化文件当前长度起连续完成的字节数，出错时小于缓存块的总长度
+   */
+  size_t persistBlocksAsync(const std::vector<mmapBlock *> &blocks);
+
+  /**
+   * @brief 后台任务的执行逻辑，预先打开并预分配后继文件，关闭切换后的旧文件
+   */
+  void prepareRotation();
+
+  /**
+   * @brief 尚未提交时向调度器提交准备后继文件的后台任务，需持有rotation_mtx
+   */
+  void scheduleRotationJob();
+
+  /**
+   * @brief
+   * 满足轮转条件且后继文件已经就绪时切换持久化文件，只由持久化线程在写出之前调用。
+   * 后继文件尚未就绪时不等待，在下一个缓存块边界再次尝试
+   * @param sealed
+   * 为true时调用方已封存持久化指针所在的缓存块，只有保留的尾部已经写出时也可以切换
+   * @return 切换了持久化文件时返回true，保留的尾部留在旧文件中，旧文件截断到实际长度
+   */
+  bool rotateIfNeeded(bool sealed = false);
+
+  /**
+   * @brief 在刚切换的持久化文件开头写入rotationPrologue返回的记录，之后的数据从其后开始写出
+   */
+  void writeRotationPrologue();
+
+  /**
+   * @brief 阻塞等待缓冲区的所有内容被持久化
+   * @param keepTail
+   * 为false时不保留不足一页的尾部，文件截断到实际长度，用于关闭或更换持久化文件之前
+   * @return 全部写出时返回true。keepTail为true时写入出错后返回false，否则一直等待重试成功
+   */
+  bool flushBuffer(bool keepTail);
+
+  /**
+   * @brief 按轮转策略生成新文件的路径
+   * @param index 轮转序号
+   */
+  std::string makeRotationPath(size_t index) const;
+
+  /**
+   * @brief
+   * 在写入继续进行的同时写出持久化指针指向的未满缓存块中已提交的前缀。
+   * 未压缩时原地写入该缓存块在文件中的位置，缓存块写满后整体覆盖；压缩时追加一个只包含新数据的压缩帧
+   * @return 返回已写出的前缀长度，缓存块在此期间被填满时返回0
+   */
+  size_t flushPartialBlock();
+
+  /**
+   * @brief 有线程等待落盘时对持久化文件执行fdatasync，需持有persistCur_mtx，同步期间释放锁
+   * @param lock 持有persistCur_mtx的锁
+   */
+  void syncIfRequested(std::unique_lock<std::mutex> &lock);
+
+  /**
+   * @brief 获取至少len字节的页对齐暂存缓冲区
+   * @return 分配失败时返回nullptr
+   */
+  char *getStagingBuffer(size_t len);
+
+  /**
+   * @brief 将每个已满缓存块压缩为一个压缩帧，依次写入持久化文件
+   * @param blocks collectFullBlocks收集的缓存块，写入失败时移除未写出的缓存块
+   * @return 返回写入持久化文件的长度
+   */
+  size_t persistBlocksCompressed(std::vector<mmapBlock *> &blocks);
+
+  /**
+   * @brief 将数据编码为一个压缩帧写入持久化文件末尾，不更新持久化文件长度
+   * @param data 原始数据
+   * @param len 原始数据长度
+   * @param fileOffset 写入位置
+   * @return 返回写入的帧长度，已按页面大小对齐，写入失败时返回0
    */
-  void persist();
+  size_t writeFrame(const char *data, size_t len, size_t fileOffset);
+
+  /**
+   * @brief 将数据完整写入持久化文件，处理不完整的写入和信号中断
+   * @param data 数据起始地址
+   * @param len 数据长度
+   * @param fileOffset 写入位置
+   * @return 全部写入时返回true，出错时记录错误码并返回false
+   */
+  bool writeFully(const char *data, size_t len, size_t fileOffset);
+
+  /**
+   * @brief 记录写入或同步持久化文件的错误，只保留第一次的错误码，并推迟下一次写出
+   * @param err 错误码
+   */
+  void recordPersistError(int err);
+
+  /**
+   * @brief 更新持久化文件长度，清空已写出的缓存块并后移持久化指针，需持有persistCur_mtx
+   * @param blocks 已写出的缓存块
+   * @param writtenLen 写入持久化文件的长度
+   */
+  void releasePersistedBlocks(const std::vector<mmapBlock *> &blocks,
+                              size_t writtenLen);
+
+  /**
+   * @brief 在缓存中预留原始写入区间，不处理记录分帧
+   * @param len 预留长度，不能超过单个缓存块大小
+   * @param contiguous
+   * 为true时区间不跨越缓存块边界，当前缓存块剩余空间不足时末尾填零，在下一个缓存块中预留，
+   * 此时len必须小于单个缓存块大小
+   * @param action
+   * 缓存写满时的处理方式，block时等待，其余方式按溢出策略的含义等待或直接返回无效区间
+   * @return 预留的写入区间
+   */
+  reservation reserveRaw(size_t len, bool contiguous = false,
+                         overflowAction action = overflowAction::block);
+
+  /**
+   * @brief reserveRaw按写入线程的并发策略特化的实现
+   * @tparam Policy 写入线程的并发策略，single时不检查持久化线程的空闲标记
+   */
+  template <producerPolicy Policy>
+  reservation reserveRawAs(size_t len, bool contiguous, overflowAction action);
+
+  /**
+   * @brief 不等待地写入协程的数据，不借用缓存块，也不经过线程暂存区
+   * @param op 协程写入的等待体，written和ticket随写入更新
+   * @return 全部写入或记录无效时返回true，缓存没有可用空间时返回false
+   */
+  bool appendNoWait(appendAwaiter &op);
+
+  /**
+   * @brief
+   * 由持久化线程调用，按挂起顺序代为写入挂起的协程数据，恢复写入完成和数据已写出的协程
+   */
+  void resumeAwaiters();
+
+  /**
+   * @brief 将请求计数提高到target，多个线程同时提高时保留最大值
+   */
+  static void raiseRequest(std::atomic_uint64_t &request, uint64_t target);
+
+  /**
+   * @brief commit按写入线程的并发策略特化的实现
+   */
+  template <producerPolicy Policy> void commitAs(const reservation &res);
+
+  /**
+   * @brief
+   * 与reserveRaw相同，但不会等待：写入线程正在调整写指针、当前缓存块已满或写指针之后没有空闲缓存块时直接返回。
+   * 用于在持久化线程上发布暂存数据
+   * @param res 预留成功时存储预留的写入区间
+   * @return 预留成功返回true
+   */
+  bool tryReserveRaw(size_t len, bool contiguous, reservation &res);
+
+  /**
+   * @brief
+   * 预留区间填满了当前缓存块时调整写指针，在新缓存块中预留剩余部分
+   * @param res 已在当前缓存块中预留的区间，调整后更新为最终的预留区间
+   * @param len 预留的总长度
+   * @param contiguous 为true时当前缓存块中的部分填零，整个区间在新缓存块中预留
+   * @param lock 已持有的writeCur_mtx，等待新缓存块期间释放
+   * @param deadline 等待新缓存块的截止时间，默认一直等待
+   * @return 截止时间之前没有获得新缓存块时返回false，此时已调用deferHandOff
+   */
+  bool handOffFullBlock(reservation &res, size_t len, bool contiguous,
+                        std::unique_lock<std::mutex> &lock,
+                        std::chrono::steady_clock::time_point deadline =
+                            std::chrono::steady_clock::time_point::max());
+
+  /**
+   * @brief
+   * 等待其他线程调整写指针或重新启用封存的缓存块，调整只需很短时间，先让出CPU重试，
+   * 缓存环耗尽或缓存块封存时在writeCurEpoch上休眠，不获取任何锁
+   * @param block 预留失败的缓存块
+   * @param deadline 等待的截止时间，默认一直等待
+   * @return 写指针可以重新预留时返回true，超时返回false
+   */
+  bool waitForWriteCur(mmapBlock *block,
+                       std::chrono::steady_clock::time_point deadline =
+                           std::chrono::steady_clock::time_point::max());
+
+  /**
+   * @brief
+   * 开始读取写指针，在leaveRing之前取得的缓存块不会被归还缓存块池，读取到的缓存块即使已移出缓存环，
+   * 也仍处于封存状态，预留只会失败
+   * @tparam Policy
+   * 写入线程的并发策略，多写入线程时为一次原子加法，单写入线程时为一次原子存储
+   */
+  template <producerPolicy Policy> void enterRing() {
+    if constexpr (Policy == producerPolicy::single) {
+      ringReaders.store(1);
+    } else {
+      ringReaders.fetch_add(1);
+    }
+  }
+
+  /**
+   * @brief 结束读取写指针，之后只能访问已在其中预留成功的缓存块
+   */
+  template <producerPolicy Policy> void leaveRing() {
+    if constexpr (Policy == producerPolicy::single) {
+      ringReaders.store(0, std::memory_order_release);
+    } else {
+      ringReaders.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  /**
+   * @brief 写指针调整或缓存块重新启用后唤醒等待的写入线程
+   */
+  void notifyWriters();
+
+  /**
+   * @brief
+   * 填满写缓存块的线程放弃本次写入：撤销当前缓存块中预留的部分，缓存块重新接受之后的写入，
+   * 数据流中不留下填充；扩充缓存环交给持久化线程
+   * @param res 在当前缓存块中预留的区间
+   */
+  void deferHandOff(const reservation &res);
+
+  /**
+   * @brief
+   * 在持久化线程上代替放弃写入的线程调整写指针或借用后继缓存块，可以借用但不会等待，
+   * 无法立即调整时留到下一轮
+   */
+  void completeHandOff();
+
+  /**
+   * @brief 按溢出策略处理未能写入缓存的数据，写入溢出文件或计入丢弃长度
+   * @param data 数据指针
+   * @param len 数据长度
+   * @param payloadLen 用户数据的长度，分帧模式下不含记录头部
+   * @return 写入溢出文件时返回true
+   */
+  bool handleOverflow(const char *data, size_t len, size_t payloadLen);
+
+  /**
+   * @brief 获取当前线程在该实例上的暂存区
+   * @param create 不存在时是否创建
+   * @return 不存在且不创建时返回nullptr
+   */
+  stagingArea *localStagingArea(bool create);
+
+  /**
+   * @brief 将暂存区中的数据一次预留写入缓存块，需持有暂存区的互斥锁
+   * @param wait 为false时使用tryReserveRaw，不会等待
+   * @param noLose 为false时缓存写满后按溢出策略处理暂存的数据
+   * @return 发布成功或暂存区为空时返回true
+   */
+  bool publishStaging(stagingArea &area, bool wait = true, bool noLose = true);
+
+  /**
+   * @brief 在持久化线程上发布停留时间已到的暂存区，不会等待
+   * @return 返回距离下一个暂存区到期的毫秒数，没有暂存数据时返回-1
+   */
+  int publishDueStaging();
+
+  /**
+   * @brief 发布所有线程的暂存区
+   * @param close 为true时同时解除暂存区与实例的关联，用于析构
+   */
+  void publishAllStaging(bool close);
+
+  /**
+   * @brief
+   * 写缓存块已满时调整写指针，只由填满该缓存块的线程调用，因此不需要与其他写入线程竞争
+   * @param remainLen 跨越缓存块边界的剩余数据需要在新缓存块起始位置预留的长度
+   * @param lock
+   * 已持有的writeCur_mtx，等待持久化或内存预算期间释放，返回时重新持有，不会在持有时等待persistCur_mtx
+   * @param deadline
+   * 等待新缓存块的截止时间，默认一直等待；已经过去时可以借用但不等待；
+   * 为time_point::min()时只使用空闲的后继缓存块，不借用也不等待
+   * @return 新缓存块中预留区间的头指针，截止时间之前没有可用的缓存块时返回nullptr
+   */
+  char *advanceWriteCur(size_t remainLen, std::unique_lock<std::mutex> &lock,
+                        std::chrono::steady_clock::time_point deadline =
+                            std::chrono::steady_clock::time_point::max());
 
   /**
    * @brief 受保护的默认构造函数，防止在程序的其他位置被构造
@@ -136,8 +836,17 @@ public:
    * @param _bufferName 缓存实例的名称
    */
   static void removeBufferInstance(const std::string &_bufferName) {
-    std::unique_lock<std::mutex> lock(instenceMapMutex);
-    bufferInstances.erase(_bufferName);
+    std::shared_ptr<mmapBuffer> instance;
+    {
+      std::unique_lock<std::mutex> lock(instenceMapMutex);
+      auto it = bufferInstances.find(_bufferName);
+      if (it == bufferInstances.end()) {
+        return;
+      }
+      instance = std::move(it->second);
+      bufferInstances.erase(it);
+    }
+    //析构需要等待数据写出，在锁外进行，不阻塞其他实例的获取
   }
 
   /**
@@ -145,10 +854,12 @@ public:
    * @param _persistenceFilePath 持久化文件的路径
    * @param _bufferFileBasePath
    * buffer文件的基本路径，多个buffer会自动在基本路径后添加编号
-   * @param _maxBlockCount 最大缓存块数量
-   * @param _blockCount 初始缓存块数量
-   * @param _blockSize 单个缓存块大小
-   * @param _persistenceTimeOut 持久化等待超时(ms)
+   * @param _maxBlockCount
+   * 最大缓存块数量，至少为2。通过mmapBlockPool设置全局内存预算后不再生效，缓存块数量只受预算限制
+   * @param _blockCount 初始缓存块数量，超出的缓存块从缓存块池借用，空闲后归还
+   * @param _blockSize 初始缓存块大小，按伸缩策略借用的缓存块可能更大
+   * @param _persistenceTimeOut
+   * 已不再使用，传入的值被忽略，仅为保持接口兼容而保留。持久化线程由事件唤醒，写出期限通过setFlushDeadline设置
    * @param _systemPageSize 系统页面大小(bytes)默认4k
    * @return none
    */
@@ -160,44 +871,307 @@ public:
              unsigned int _persistenceTimeOut = 10,
              unsigned int _systemPageSize = 4096);
 
+  /**
+   * @brief
+   * 设置该实例在持久化调度器中的优先级和权重，需在initBuffer之前调用。
+   * 所有实例共享固定数量的工作线程，线程数量可通过persistScheduler::configure设置
+   * @param priority 优先级，数值越大越先被处理，默认为0
+   * @param weight 每次被调度时最多连续写出的批次数，默认为1
+   */
+  void setSchedulingPolicy(int priority, unsigned weight = 1);
+
+  /**
+   * @brief
+   * 设置缓存块伸缩策略，需在initBuffer之前调用。小实例以较小的初始缓存块启动，
+   * 突发写入时借用逐渐增大的缓存块，空闲后归还，稳定时的内存占用接近初始缓存块大小之和
+   * @param policy 伸缩策略，增长后的缓存块大小按页面大小对齐
+   */
+  void setElasticPolicy(const elasticPolicy &policy);
+
+  /**
+   * @brief
+   * 启用线程暂存，需在initBuffer之前调用。每个线程的小记录先累积在线程自己的暂存区中，
+   * 暂存区满、停留时间到期、调用waitForBufferPersist或线程退出时一次预留写入缓存块，
+   * 共享的预留计数的竞争按批量大小减少
+   * @param stagingSize 每个线程的暂存区大小，不超过缓存块大小的一半
+   * @param publishIntervalMs 暂存数据的最长停留时间(ms)
+   * @note
+   * 启用后只保证同一线程写入的数据按顺序排列。需要持久化凭据的写入、超过暂存区大小的写入和reserve会先发布本线程的暂存区，
+   * 然后直接写入缓存块
+   */
+  void enableThreadStaging(size_t stagingSize = 64 * 1024,
+                           unsigned publishIntervalMs = 5);
+
+  /**
+   * @brief 设置缓存块内存的来源，需在initBuffer之前调用
+   * @param _backing
+   * file为默认的磁盘文件，进程崩溃后可恢复，但内核会将脏页写回缓存块文件，数据写入磁盘两次；
+   * shm将缓存块文件放在/dev/shm，文件名取_bufferFileBasePath的文件名部分，进程崩溃后仍可恢复；
+   * memfd和anonymous不产生写回，进程退出后未持久化的数据丢失，anonymous优先使用大页减少TLB缺失
+   */
+  void setBlockBacking(blockBacking _backing);
+
+  /**
+   * @brief 设置写入线程的并发策略，需在initBuffer之前调用
+   * @param policy
+   * multi为默认策略，允许任意多个线程同时写入；single时预留和提交只进行普通的原子存储，
+   * 没有原子加法和比较交换，写入开销接近一次memcpy，同时不启用线程暂存
+   * @note
+   * single要求同一时刻只有一个线程调用try_append、try_appendv、reserve和commit，
+   * waitForBufferPersist、changePersistFile和析构只能由该线程调用或在其停止写入后调用。
+   * 写入不再唤醒空闲的持久化线程，设置写出期限时持久化线程空闲时按期限的一半轮询，
+   * 数据的最长停留时间为期限的1.5倍
+   */
+  void setProducerPolicy(producerPolicy policy);
+
+  /**
+   * @brief 设置缓存写满时的溢出策略，需在initBuffer之前调用，默认一直阻塞等待
+   * @param policy
+   * dropNewest和spill在缓存写满时立即返回，不等待writeCur_mtx和persistCur_mtx，磁盘停顿时写入延迟仍有上限；
+   * blockWithTimeout最多等待timeoutMs后丢弃。溢出文件打开失败时spill按dropNewest处理
+   * @note
+   * 只作用于noLose为false的try_append和try_appendv，reserve总是阻塞等待。
+   * 填满缓存块的写入被丢弃时，其在缓存块末尾预留的部分以零填充。
+   * 溢出文件中的数据按溢出的顺序排列，与持久化文件中的数据没有顺序关系，不附带持久化凭据。
+   * 启用线程暂存时整批暂存数据在发布时按策略处理，此时被丢弃的数据只计入getDroppedBytes
+   */
+  void setOverflowPolicy(const overflowPolicy &policy);
+
+  /**
+   * @brief 获取因缓存写满被丢弃的数据长度，分帧模式下不含记录头部
+   */
+  uint64_t getDroppedBytes() const;
+
+  /**
+   * @brief 获取因缓存写满写入溢出文件的数据长度，分帧模式下不含记录头部
+   */
+  uint64_t getSpilledBytes() const;
+
+  /**
+   * @brief 使用io_uring异步写出已满的缓存块，需在initBuffer之前调用，内核不支持时退回pwrite64
+   * @param queueDepth 同时写出的缓存块数量上限
+   * @param registerBuffers
+   * 是否将缓存块注册为固定缓冲区，只对初始缓存块生效，注册失败时忽略
+   */
+  void enableIoUring(unsigned queueDepth = 8, bool registerBuffers = false);
+
+  /**
+   * @brief
+   * 开启记录分帧模式，需在initBuffer之前调用。开启后每次写入作为一条记录，前面添加长度头部，
+   * 缓存块末尾的填充为零字节，持久化文件可以通过mmapReader零拷贝地逐条读取。
+   * 记录不跨越缓存块边界，缓存块剩余空间不足时末尾填零，因此轮转后的每个文件都可以单独读取
+   * @note 分帧模式下单条记录加上头部必须小于单个缓存块大小，空记录不会被写入
+   */
+  void enableRecordFraming();
+
+  /**
+   * @brief
+   * 设置持久化压缩算法，需在initBuffer之前调用。设置后每个缓存块压缩为一个页对齐的压缩帧写入持久化文件，
+   * 可通过mmapCodec::decodeFrames解码，mmapReader会自动识别并解码
+   * @param codec 压缩算法，例如内置的lzCodec
+   * @note 压缩在持久化线程上进行，不影响写入线程。同一个持久化文件不能混合压缩与未压缩的数据
+   */
+  void setCodec(std::shared_ptr<mmapCodec> codec);
+
+  /**
+   * @brief
+   * 设置未写出数据的最长停留时间，需在initBuffer之前调用。存在未写出的数据超过该时间时，
+   * 持久化线程写出未满缓存块中已提交的部分，没有未写出的数据时持久化线程不会被唤醒
+   * @param deadlineMs 最长停留时间(ms)，为0时只在缓存块写满或请求写出时写出
+   */
+  void setFlushDeadline(unsigned int deadlineMs);
+
+  /**
+   * @brief
+   * 设置缓存块预取，需在initBuffer之前调用。写指针进入新缓存块后，
+   * 持久化线程预先建立之后若干个缓存块的页表映射，写入线程追加数据时不会触发缺页
+   * @param blocksAhead 写指针之后预取的缓存块数量，默认为1，为0时不预取
+   * @param lockMemory 为true时锁定预取的缓存块内存，受RLIMIT_MEMLOCK限制，锁定失败时只预取
+   */
+  void setPrefaultPolicy(size_t blocksAhead, bool lockMemory = false);
+
+  /**
+   * @brief
+   * 设置持久化文件轮转策略，需在initBuffer之前调用。后台任务预先打开后继文件并预分配空间，
+   * 持久化线程在缓存块边界切换文件，写入线程不会因轮转而停顿
+   * @param policy 轮转策略，maxBytes和intervalSeconds都为0时不轮转
+   * @note
+   * 轮转只在写出已满缓存块或强制持久化时进行，因此文件长度可能超过maxBytes一批缓存块的大小，
+   * 写入停止时按时间轮转也会推迟到下一次写出
+   */
+  void setRotationPolicy(const rotationPolicy &policy);
+
+  /**
+   * @brief
+   * 设置轮转后写入新文件开头的记录，使每个轮转文件可以单独解析，可以在initBuffer之后调用
+   * @param prologue
+   * 在持久化线程上调用，返回的每个字符串作为一条记录写在新文件开头，传入空函数时取消。
+   * 其中不能向缓存写入或等待持久化，否则持久化线程会死锁
+   * @note 只在分帧模式下生效，开头记录按页面补齐后写出，不经过缓存也不占用持久化凭据
+   */
+  void setRotationPrologue(std::function<std::vector<std::string>()> prologue);
+
+  /**
+   * @brief 获取当前持久化文件的路径，轮转后为新文件的路径
+   * @note 该函数并非线程安全，数据读取时不加锁
+   */
+  const std::string &getPersistenceFilePath() const;
+
   /**
    * @brief 更改持久化写入文件
    * @param _persistenceFilePath 新文件的路径
+   * @note 与initBuffer不同，新文件已存在时其内容被清空，从文件起点开始写入
    */
   void changePersistFile(const std::string &_persistenceFilePath);
 
   /**
    * @brief 阻塞等待缓冲区的所有内容被持久化到硬盘
+   * @return 全部写出时返回true，写入持久化文件出错时返回false，错误码由getPersistError获取
    */
-  void waitForBufferPersist();
+  bool waitForBufferPersist();
 
   /**
    * @brief 析构时释放所有block，关闭持久化文件和临时文件，并删除临时文件
    */
   ~mmapBuffer() {
     if (head != nullptr) {
-      waitForBufferPersist();
-      for (size_t i = 0; i < blockCount - 1; i++) {
+      //线程暂存区中的数据先写入缓存块，之后线程退出时不再访问该实例
+      publishAllStaging(true);
+      //不保留尾部，持久化文件截断到实际长度
+      flushBuffer(false);
+      //注销后调度器不会再执行该实例的持久化工作
+      persistScheduler::getInstance().removeSource(schedulerSourceId);
+      {
+        //等待后台任务结束，删除未使用的后继文件，关闭剩余的旧文件
+        std::unique_lock<std::mutex> lock(rotation_mtx);
+        rotationStop = true;
+        rotation_cv.wait(lock, [this] { return !rotationJobPending; });
+        if (nextFileFd >= 0) {
+          close(nextFileFd);
+          remove(nextFilePath.c_str());
+        }
+        for (int fd : retiredFileFds) {
+          close(fd);
+        }
+      }
+      //缓存块封存后归还缓存块池，注册的固定缓冲区随io_uring实例一同释放
+      persistRing.reset();
+      for (size_t i = 0; i < blockCount; i++) {
         mmapBlock *next = head->next;
-        delete head;
+        head->clear();
+        mmapBlockPool::getInstance().release(head);
         head = next;
       }
-      delete head;
+      //析构时已没有写入线程，移出缓存环的缓存块直接归还
+      for (mmapBlock *block : retiredBlocks) {
+        mmapBlockPool::getInstance().release(block);
+      }
       close(persistenceFileFd);
+      close(persistEventFd);
+      if (spillFd >= 0) {
+        close(spillFd);
+      }
     }
+    free(frameBuffer);
   }
 
   /**
    * @brief 写入缓存
    * @param data 写入数据的指针
    * @param len 写入长度
-   * @param noLose true：缓存区满时阻塞等待，false：缓存区满丢弃数据，默认丢弃
-   * @return 写入成功返回true
+   * @param noLose true：缓存区满时阻塞等待，false：缓存区满时按setOverflowPolicy设置的策略处理
+   * @param ticket 不为空时写入持久化凭据，可传入waitUntilPersisted或waitUntilDurable
+   * @return 数据写入缓存或溢出文件时返回true，被丢弃时返回false
+   */
+  bool try_append(char *data, size_t len, bool noLose = false,
+                  uint64_t *ticket = nullptr);
+
+  /**
+   * @brief 将分散在多个缓冲区中的一条数据写入缓存，只进行一次空间预留
+   * @param iov 数据分段数组
+   * @param iovcnt 数据分段数量
+   * @param noLose true：缓存区满时阻塞等待，false：缓存区满时按setOverflowPolicy设置的策略处理
+   * @param ticket 不为空时写入持久化凭据，可传入waitUntilPersisted或waitUntilDurable
+   * @return 数据写入缓存或溢出文件时返回true，被丢弃时返回false
+   * @note 与try_append相同，总长度超过单个缓存块大小时分多次预留写入
+   */
+  bool try_appendv(const iovec *iov, int iovcnt, bool noLose = false,
+                   uint64_t *ticket = nullptr);
+
+  /**
+   * @brief 阻塞等待持久化凭据之前的数据全部写入持久化文件，其他线程可以继续写入
+   * @param ticket 写入时获得的持久化凭据
+   * @note
+   * 数据位于未满的缓存块时持久化线程写出其中已提交的部分，同时等待的多个线程共享一次写出
+   * @return 数据已写出时返回true，写入持久化文件出错且数据尚未写出时返回false，错误码由getPersistError获取
+   */
+  bool waitUntilPersisted(uint64_t ticket);
+
+  /**
+   * @brief 与waitUntilPersisted相同，写出后再通过fdatasync等待数据落盘
+   * @param ticket 写入时获得的持久化凭据
+   * @return 数据已落盘时返回true，出错且数据尚未落盘时返回false
+   * @note fdatasync失败后页缓存中的数据可能已被丢弃，之后不再推进落盘偏移量
+   */
+  bool waitUntilDurable(uint64_t ticket);
+
+  /**
+   * @brief 获取第一次写入或同步持久化文件失败时的errno，没有出错时返回0
+   * @note 出错之后持久化线程每隔errorRetryMs重试写出，未写出的缓存块保留在缓存环中
+   */
+  int getPersistError() const;
+
+  /**
+   * @brief 获取已写入持久化文件的数据流偏移量，持久化凭据不超过该值的数据都已写出
    */
-  bool try_append(char *data, size_t len, bool noLose = false);
+  uint64_t getPersistedOffset() const;
 
   /**
-   * @brief 获取目前已经写入的持久化文件的大小
+   * @brief
+   * 协程写入，co_await返回持久化凭据。缓存有空间时直接写入，否则挂起协程而不阻塞线程，
+   * 持久化线程清空缓存块后代为写入并恢复协程
+   * @param data 写入数据的指针，协程恢复前必须保持有效
+   * @param len 写入长度
+   * @note
+   * 协程写入不经过线程暂存区，与同一线程的try_append之间不保证顺序；挂起的写入之间按挂起顺序写入。
+   * 单写入线程策略下挂起期间不能有其他写入。缓存实例析构前所有挂起的协程都需已恢复
+   */
+  appendAwaiter append(const char *data, size_t len);
+
+  /**
+   * @brief 协程等待持久化凭据之前的数据全部写入持久化文件，挂起期间不阻塞线程
+   * @param ticket 写入时获得的持久化凭据
+   */
+  persistAwaiter persisted(uint64_t ticket);
+
+  /**
+   * @brief
+   * 设置恢复挂起协程的执行器，需在initBuffer之前调用。默认在持久化线程上直接恢复，
+   * 协程恢复后的工作会占用持久化线程，通常应设置为投递到协程所属的执行器
+   * @param executor 接收待恢复的协程句柄，不能在其中等待
+   */
+  void setCoroutineExecutor(
+      std::function<void(std::coroutine_handle<>)> executor);
+
+  /**
+   * @brief 在缓存中预留写入区间，调用方直接写入映射内存后调用commit提交，避免额外的拷贝
+   * @param len 预留长度，不能超过单个缓存块大小
+   * @return 预留的写入区间，跨越缓存块边界时分为两段；len为0或超过缓存块大小时返回无效区间
+   * @note 缓存块在其中所有预留区间提交前不会被持久化，预留后应尽快提交。
+   * 分帧模式下记录头部已经写入，返回的区间只包含记录数据，且总是只有一段
+   */
+  reservation reserve(size_t len);
+
+  /**
+   * @brief 提交reserve预留的写入区间
+   * @param res reserve返回的写入区间
+   */
+  void commit(const reservation &res);
+
+  /**
+   * @brief
+   * 获取目前已经写入的持久化文件的大小，设置压缩算法时为压缩后的大小。
+   * 强制持久化不在文件中留下页对齐的补足，未压缩时与getActualDataLen相等
    * @note 该函数并非线程安全，数据读取时不加锁
    */
   size_t getPersistenceFileLen() const;
@@ -0,0 +1,286 @@
+#include "mmapCodec.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+//最短匹配长度
+constexpr size_t minMatch = 4;
+//数据末尾必须以字面量结尾的长度
+constexpr size_t lastLiterals = 5;
+//距数据末尾小于该长度的位置不再开始匹配
+constexpr size_t matchFindLimit = 12;
+//哈希表大小的对数
+constexpr unsigned hashLog = 16;
+//匹配的最大回溯距离
+constexpr size_t maxOffset = 65535;
+
+uint32_t read32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t hash32(uint32_t v) { return (v * 2654435761U) >> (32 - hashLog); }
+
+//写入长度的扩展字节，每个255字节表示继续
+char *writeLength(char *op, size_t len) {
+  while (len >= 255) {
+    *op++ = static_cast<char>(255);
+    len -= 255;
+  }
+  *op++ = static_cast<char>(len);
+  return op;
+}
+
+//读取长度的扩展字节
+bool readLength(const char *src, size_t len, size_t &ip, size_t &value) {
+  unsigned char b;
+  do {
+    if (ip >= len) {
+      return false;
+    }
+    b = static_cast<unsigned char>(src[ip++]);
+    value += b;
+  } while (b == 255);
+  return true;
+}
+
+//写入一个序列：字面量加一个匹配，matchLen为0时只写入字面量
+char *writeSequence(char *op, const char *literals, size_t literalLen,
+                    size_t offset, size_t matchLen) {
+  char *token = op++;
+  unsigned char tokenValue = 0;
+  if (literalLen >= 15) {
+    tokenValue = 15 << 4;
+    op = writeLength(op, literalLen - 15);
+  } else {
+    tokenValue = literalLen << 4;
+  }
+  memcpy(op, literals, literalLen);
+  op += literalLen;
+  if (matchLen > 0) {
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    size_t ml = matchLen - minMatch;
+    if (ml >= 15) {
+      tokenValue |= 15;
+      op = writeLength(op, ml - 15);
+    } else {
+      tokenValue |= ml;
+    }
+  }
+  *token = static_cast<char>(tokenValue);
+  return op;
+}
+
+size_t alignUp(size_t len, size_t pageSize) {
+  return (len + pageSize - 1) / pageSize * pageSize;
+}
+
+std::mutex codecMapMutex;
+
+std::unordered_map<uint32_t, std::shared_ptr<mmapCodec>> &codecMap() {
+  static std::unordered_map<uint32_t, std::shared_ptr<mmapCodec>> codecs = {
+      {lzCodec::codecId, std::make_shared<lzCodec>()}};
+  return codecs;
+}
+
+} // namespace
+
+void mmapCodec::registerCodec(const std::shared_ptr<mmapCodec> &codec) {
+  std::unique_lock<std::mutex> lock(codecMapMutex);
+  codecMap()[codec->getId()] = codec;
+}
+
+std::shared_ptr<mmapCodec> mmapCodec::getCodec(uint32_t id) {
+  std::unique_lock<std::mutex> lock(codecMapMutex);
+  auto it = codecMap().find(id);
+  return it == codecMap().end() ? nullptr : it->second;
+}
+
+size_t mmapCodec::frameBound(const mmapCodec &codec, size_t len,
+                             size_t pageSize) {
+  return alignUp(sizeof(mmapFrameHeader) +
+                     std::max(codec.compressBound(len), len),
+                 pageSize);
+}
+
+size_t mmapCodec::encodeFrame(const mmapCodec &codec, const char *src,
+                              size_t len, char *dst, size_t pageSize) {
+  mmapFrameHeader header = {frameMagic, codec.getId(), len, 0, 0};
+  char *payload = dst + sizeof(header);
+  header.compressedLen = codec.compress(src, len, payload);
+  if (header.compressedLen == 0 || header.compressedLen >= len) {
+    //数据不可压缩，原样存储
+    header.codecId = storedCodecId;
+    header.compressedLen = len;
+    memcpy(payload, src, len);
+  }
+  memcpy(dst, &header, sizeof(header));
+
+  //帧尾补零对齐到页面大小
+  size_t frameLen = sizeof(header) + header.compressedLen;
+  size_t alignedLen = alignUp(frameLen, pageSize);
+  memset(dst + frameLen, 0, alignedLen - frameLen);
+  return alignedLen;
+}
+
+bool mmapCodec::decodeFrames(const char *data, size_t len, std::string &out,
+                             size_t pageSize) {
+  size_t pos = 0;
+  while (pos + sizeof(mmapFrameHeader) <= len) {
+    mmapFrameHeader header;
+    memcpy(&header, data + pos, sizeof(header));
+    if (header.magic != frameMagic) {
+      if (header.magic == 0) {
+        //补零的页面
+        pos += pageSize;
+        continue;
+      }
+      return false;
+    }
+    const char *payload = data + pos + sizeof(header);
+    if (header.compressedLen > len - pos - sizeof(header)) {
+      return false;
+    }
+    //分配输出空间之前校验原始长度，损坏的帧头部不会导致过大的分配
+    std::shared_ptr<mmapCodec> codec;
+    if (header.codecId == storedCodecId) {
+      if (header.rawLen != header.compressedLen) {
+        return false;
+      }
+    } else {
+      codec = getCodec(header.codecId);
+      if (codec == nullptr ||
+          header.rawLen > codec->decompressBound(header.compressedLen)) {
+        return false;
+      }
+    }
+
+    size_t outPos = out.size();
+    out.resize(outPos + header.rawLen);
+    if (codec == nullptr) {
+      memcpy(out.data() + outPos, payload, header.rawLen);
+    } else if (!codec->decompress(payload, header.compressedLen,
+                                  out.data() + outPos, header.rawLen)) {
+      out.resize(outPos);
+      return false;
+    }
+    pos = alignUp(pos + sizeof(header) + header.compressedLen, pageSize);
+  }
+  return true;
+}
+
+bool mmapCodec::isFramed(const char *data, size_t len) {
+  uint32_t magic = 0;
+  if (len < sizeof(mmapFrameHeader)) {
+    return false;
+  }
+  memcpy(&magic, data, sizeof(magic));
+  return magic == frameMagic;
+}
+
+uint32_t lzCodec::getId() const { return codecId; }
+
+size_t lzCodec::compressBound(size_t len) const {
+  return len + len / 255 + 16;
+}
+
+size_t lzCodec::decompressBound(size_t len) const {
+  //每个长度扩展字节最多表示255字节的匹配，其余字节展开后不会更长
+  return len * 255;
+}
+
+size_t lzCodec::compress(const char *src, size_t len, char *dst) const {
+  char *op = dst;
+  size_t anchor = 0;
+  if (len > matchFindLimit) {
+    //哈希表记录4字节序列最近出现的位置加1，0表示空
+    std::vector<uint32_t> table(1U << hashLog, 0);
+    size_t ip = 0;
+    size_t matchLimit = len - lastLiterals;
+    size_t ipLimit = len - matchFindLimit;
+    size_t misses = 0;
+    while (ip < ipLimit) {
+      uint32_t sequence = read32(src + ip);
+      uint32_t h = hash32(sequence);
+      size_t ref = table[h];
+      table[h] = ip + 1;
+      if (ref > 0 && ip - (ref - 1) <= maxOffset &&
+          read32(src + ref - 1) == sequence) {
+        size_t refPos = ref - 1;
+        size_t matchLen = minMatch;
+        while (ip + matchLen < matchLimit &&
+               src[refPos + matchLen] == src[ip + matchLen]) {
+          matchLen++;
+        }
+        op = writeSequence(op, src + anchor, ip - anchor, ip - refPos,
+                           matchLen);
+        ip += matchLen;
+        anchor = ip;
+        misses = 0;
+      } else {
+        //连续未命中时加大步长，快速跳过不可压缩的数据
+        ip += 1 + (misses++ >> 6);
+      }
+    }
+  }
+  //末尾的字面量
+  op = writeSequence(op, src + anchor, len - anchor, 0, 0);
+  return op - dst;
+}
+
+bool lzCodec::decompress(const char *src, size_t len, char *dst,
+                         size_t rawLen) const {
+  size_t ip = 0;
+  size_t op = 0;
+  while (ip < len) {
+    unsigned char token = static_cast<unsigned char>(src[ip++]);
+
+    size_t literalLen = token >> 4;
+    if (literalLen == 15 && !readLength(src, len, ip, literalLen)) {
+      return false;
+    }
+    if (literalLen > len - ip || literalLen > rawLen - op) {
+      return false;
+    }
+    memcpy(dst + op, src + ip, literalLen);
+    ip += literalLen;
+    op += literalLen;
+    if (ip == len) { //最后一个序列只有字面量
+      break;
+    }
+
+    if (len - ip < 2) {
+      return false;
+    }
+    size_t offset = static_cast<unsigned char>(src[ip]) |
+                    static_cast<unsigned char>(src[ip + 1]) << 8;
+    ip += 2;
+    if (offset == 0 || offset > op) {
+      return false;
+    }
+    size_t matchLen = token & 15;
+    if (matchLen == 15 && !readLength(src, len, ip, matchLen)) {
+      return false;
+    }
+    matchLen += minMatch;
+    if (matchLen > rawLen - op) {
+      return false;
+    }
+    //匹配区间可能与输出区间重叠，重叠时逐字节拷贝
+    if (offset >= matchLen) {
+      memcpy(dst + op, dst + op - offset, matchLen);
+    } else {
+      for (size_t i = 0; i < matchLen; i++) {
+        dst[op + i] = dst[op - offset + i];
+      }
+    }
+    op += matchLen;
+  }
+  return op == rawLen;
+}
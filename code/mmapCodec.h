@@ -0,0 +1,130 @@
+#ifndef __MMAPCODEC__
+#define __MMAPCODEC__
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @brief 压缩帧头部，持久化线程对每个缓存块的数据生成一个压缩帧
+ * @note 压缩帧总是从页面边界开始，帧尾补零对齐到页面大小以满足O_DIRECT的要求
+ */
+struct mmapFrameHeader {
+  uint32_t magic;         //帧标识
+  uint32_t codecId;       //压缩算法编号，0表示未压缩
+  uint64_t rawLen;        //原始数据长度
+  uint64_t compressedLen; //帧数据长度，不含头部和补齐
+  uint64_t reserved;      //保留字段，置零
+};
+
+/**
+ * @brief 持久化压缩算法接口，实现需要是无状态的，可以被多个线程同时调用
+ */
+class mmapCodec {
+public:
+  //压缩帧标识 "MBZF"
+  static constexpr uint32_t frameMagic = 0x465a424d;
+  //未压缩帧的算法编号
+  static constexpr uint32_t storedCodecId = 0;
+
+  virtual ~mmapCodec() = default;
+
+  /**
+   * @brief 获取算法编号，写入帧头部，解码时据此查找算法，不能为0
+   */
+  virtual uint32_t getId() const = 0;
+
+  /**
+   * @brief 获取压缩len字节数据时输出长度的上界
+   */
+  virtual size_t compressBound(size_t len) const = 0;
+
+  /**
+   * @brief 获取len字节压缩数据解压后长度的上界，解码时拒绝原始长度超过该值的帧头部
+   */
+  virtual size_t decompressBound(size_t len) const = 0;
+
+  /**
+   * @brief 压缩数据
+   * @param src 原始数据
+   * @param len 原始数据长度
+   * @param dst 输出缓冲区，长度至少为compressBound(len)
+   * @return 返回压缩后的长度，失败返回0
+   */
+  virtual size_t compress(const char *src, size_t len, char *dst) const = 0;
+
+  /**
+   * @brief 解压数据
+   * @param src 压缩数据
+   * @param len 压缩数据长度
+   * @param dst 输出缓冲区，长度为rawLen
+   * @param rawLen 原始数据长度
+   * @return 数据完整且解压后长度恰好为rawLen时返回true
+   */
+  virtual bool decompress(const char *src, size_t len, char *dst,
+                          size_t rawLen) const = 0;
+
+  /**
+   * @brief 注册压缩算法，供解码时按编号查找，内置算法无需注册
+   */
+  static void registerCodec(const std::shared_ptr<mmapCodec> &codec);
+
+  /**
+   * @brief 按编号查找压缩算法
+   * @return 未注册的编号返回nullptr
+   */
+  static std::shared_ptr<mmapCodec> getCodec(uint32_t id);
+
+  /**
+   * @brief 计算编码len字节数据的帧在补齐后长度的上界
+   */
+  static size_t frameBound(const mmapCodec &codec, size_t len,
+                           size_t pageSize);
+
+  /**
+   * @brief 将数据编码为一个压缩帧，压缩后没有变小时以未压缩帧存储
+   * @param codec 压缩算法
+   * @param src 原始数据
+   * @param len 原始数据长度
+   * @param dst 输出缓冲区，长度至少为frameBound
+   * @param pageSize 帧尾补零对齐的页面大小
+   * @return 返回补齐后的帧长度
+   */
+  static size_t encodeFrame(const mmapCodec &codec, const char *src,
+                            size_t len, char *dst, size_t pageSize);
+
+  /**
+   * @brief 解码连续的压缩帧，跳过帧之间的补零
+   * @param data 压缩帧数据，通常是映射的持久化文件
+   * @param len 数据长度
+   * @param out 解码后的原始数据追加到该字符串末尾
+   * @param pageSize 写入时使用的页面大小
+   * @return 所有帧都解码成功返回true，遇到损坏或未知算法的帧时停止并返回false
+   * @note 帧头部中的原始长度先与帧数据长度校验，再分配输出空间
+   */
+  static bool decodeFrames(const char *data, size_t len, std::string &out,
+                           size_t pageSize = 4096);
+
+  /**
+   * @brief 判断数据是否以压缩帧开始
+   */
+  static bool isFramed(const char *data, size_t len);
+};
+
+/**
+ * @brief 内置的LZ77类压缩算法，输出LZ4块格式，速度优先，适合日志文本
+ */
+class lzCodec : public mmapCodec {
+public:
+  //算法编号
+  static constexpr uint32_t codecId = 1;
+
+  uint32_t getId() const override;
+  size_t compressBound(size_t len) const override;
+  size_t decompressBound(size_t len) const override;
+  size_t compress(const char *src, size_t len, char *dst) const override;
+  bool decompress(const char *src, size_t len, char *dst,
+                  size_t rawLen) const override;
+};
+
+#endif
@@ -0,0 +1,436 @@
+#include "mmapLogger.h"
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+namespace {
+
+//每个线程上一次格式化的秒级时间文本
+struct secondsCache {
+  int64_t second = INT64_MIN;
+  char text[logClock::secondsTextLen] = {};
+};
+
+thread_local secondsCache localSeconds;
+
+//进程内注册的格式字符串，下标加一为格式编号
+struct formatRegistry {
+  std::mutex mtx;
+  std::vector<std::pair<logSite, const char *>> sites;
+};
+
+formatRegistry &registry() {
+  static formatRegistry instance;
+  return instance;
+}
+
+template <typename T> T get(const char *pos) {
+  T value;
+  memcpy(&value, pos, sizeof(value));
+  return value;
+}
+
+template <typename T> void append(std::string &out, T value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+/**
+ * @brief 按转换说明格式化一个值并追加到末尾，超过栈上缓冲区时再分配
+ */
+template <typename T>
+void appendFormatted(std::string &out, const std::string &spec, T value) {
+  char text[256];
+  int len = snprintf(text, sizeof(text), spec.c_str(), value);
+  if (len < 0) {
+    return;
+  }
+  if (static_cast<size_t>(len) < sizeof(text)) {
+    out.append(text, len);
+    return;
+  }
+  size_t oldLen = out.size();
+  out.resize(oldLen + len + 1);
+  snprintf(&out[oldLen], len + 1, spec.c_str(), value);
+  out.resize(oldLen + len);
+}
+
+} // namespace
+
+int64_t logClock::realtimeNow() {
+  struct timespec ts = {};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void logClock::formatSeconds(int64_t realtimeNs, char *out) {
+  int64_t second = realtimeNs / 1000000000;
+  if (realtimeNs < 0 && realtimeNs % 1000000000 != 0) {
+    second--;
+  }
+  secondsCache &cache = localSeconds;
+  if (second != cache.second) {
+    if (cache.second != INT64_MIN && second / 60 == cache.second / 60) {
+      //同一分钟内只改写秒数
+      int64_t sec = second % 60;
+      cache.text[17] = static_cast<char>(sec / 10 + '0');
+      cache.text[18] = static_cast<char>(sec % 10 + '0');
+    } else {
+      time_t rawtime = static_cast<time_t>(second);
+      struct tm local = {};
+      char text[64];
+      localtime_r(&rawtime, &local);
+      strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+      memcpy(cache.text, text, secondsTextLen);
+    }
+    cache.second = second;
+  }
+  memcpy(out, cache.text, secondsTextLen);
+}
+
+mmapLogger::mmapLogger(std::shared_ptr<mmapBuffer> _buffer, bool _noLose)
+    : buffer(std::move(_buffer)), noLose(_noLose),
+      defined(new std::atomic_bool[maxFormats]()) {
+  int64_t timestamp = logClock::now();
+  lastSync.store(timestamp - syncIntervalNs, std::memory_order_relaxed);
+  writeSync(timestamp);
+  buffer->setRotationPrologue([this] { return rotationPrologue(); });
+}
+
+mmapLogger::~mmapLogger() { buffer->setRotationPrologue(nullptr); }
+
+uint32_t mmapLogger::registerFormat(const logSite &site,
+                                    const char *signature) {
+  formatRegistry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mtx);
+  if (reg.sites.size() + 1 >= maxFormats) {
+    return controlId;
+  }
+  reg.sites.emplace_back(site, signature);
+  return static_cast<uint32_t>(reg.sites.size());
+}
+
+void mmapLogger::defineFormat(uint32_t formatId) {
+  std::lock_guard<std::mutex> lock(defineMutex);
+  if (defined[formatId].load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::string record = definitionRecord(formatId);
+
+  //写入期间发生轮转时新文件开头同样包含该定义，写入失败时下一次调用重新写入
+  definingId.store(formatId);
+  //携带凭据的写入不经过线程暂存区，之后任何线程的日志记录都排在定义之后
+  uint64_t ticket = 0;
+  if (buffer->try_append(record.data(), record.size(), true, &ticket)) {
+    defined[formatId].store(true, std::memory_order_release);
+  }
+  definingId.store(controlId);
+}
+
+std::string mmapLogger::definitionRecord(uint32_t formatId) {
+  std::pair<logSite, const char *> entry;
+  {
+    formatRegistry &reg = registry();
+    std::lock_guard<std::mutex> registryLock(reg.mtx);
+    entry = reg.sites[formatId - 1];
+  }
+  const logSite &site = entry.first;
+  std::string record;
+  append(record, controlId);
+  append(record, static_cast<uint8_t>(formatDefinition));
+  append(record, formatId);
+  record.append(entry.second).push_back('\0');
+  record.append(site.format).push_back('\0');
+  record.append(site.file).push_back('\0');
+  append(record, site.line);
+  return record;
+}
+
+std::string mmapLogger::syncRecord(int64_t timestamp) {
+  std::string record;
+  append(record, controlId);
+  append(record, static_cast<uint8_t>(clockSync));
+  append(record, timestamp);
+  append(record, logClock::realtimeNow());
+  return record;
+}
+
+void mmapLogger::writeSync(int64_t timestamp) {
+  int64_t last = lastSync.load(std::memory_order_relaxed);
+  if (timestamp - last < syncIntervalNs ||
+      !lastSync.compare_exchange_strong(last, timestamp,
+                                        std::memory_order_relaxed)) {
+    return;
+  }
+  std::string record = syncRecord(timestamp);
+  //同样不经过线程暂存区，保证第一条同步记录位于所有日志记录之前
+  uint64_t ticket = 0;
+  buffer->try_append(record.data(), record.size(), true, &ticket);
+}
+
+std::vector<std::string> mmapLogger::rotationPrologue() {
+  std::vector<std::string> records;
+  records.push_back(syncRecord(logClock::now()));
+  //先读取正在写入的编号：此时尚未开始的定义在轮转之后写入，位于新文件中；
+  //已经完成的定义在之后扫描时已标记
+  uint32_t inFlight = definingId.load();
+  if (inFlight != controlId) {
+    records.push_back(definitionRecord(inFlight));
+  }
+  for (uint32_t formatId = 1; formatId < maxFormats; formatId++) {
+    if (formatId != inFlight &&
+        defined[formatId].load(std::memory_order_acquire)) {
+      records.push_back(definitionRecord(formatId));
+    }
+  }
+  return records;
+}
+
+bool mmapLogDecoder::decode(std::string_view record, std::string &out) {
+  if (record.size() < sizeof(uint32_t)) {
+    skippedRecords++;
+    return false;
+  }
+  uint32_t formatId = get<uint32_t>(record.data());
+  if (formatId == mmapLogger::controlId) {
+    decodeControl(record);
+    return false;
+  }
+  auto it = formats.find(formatId);
+  if (it == formats.end() || record.size() < mmapLogger::recordHeaderLen) {
+    skippedRecords++;
+    return false;
+  }
+  const formatEntry &entry = it->second;
+  int64_t timestamp = get<int64_t>(record.data() + sizeof(uint32_t));
+
+  //按参数类型串取出参数
+  args.clear();
+  size_t pos = mmapLogger::recordHeaderLen;
+  for (char type : entry.signature) {
+    argValue arg = {type, 0, {}};
+    if (type == 's') {
+      if (record.size() - pos < sizeof(uint32_t)) {
+        skippedRecords++;
+        return false;
+      }
+      uint32_t len = get<uint32_t>(record.data() + pos);
+      pos += sizeof(uint32_t);
+      if (record.size() - pos < len) {
+        skippedRecords++;
+        return false;
+      }
+      arg.str = record.substr(pos, len);
+      pos += len;
+    } else {
+      if (record.size() - pos < sizeof(uint64_t)) {
+        skippedRecords++;
+        return false;
+      }
+      arg.bits = get<uint64_t>(record.data() + pos);
+      pos += sizeof(uint64_t);
+    }
+    args.push_back(arg);
+  }
+
+  //原始时间戳按最近的同步记录换算为系统时间
+  int64_t realtime = syncRealtime + (timestamp - syncTimestamp);
+  int64_t nanos = realtime % 1000000000;
+  if (nanos < 0) {
+    nanos += 1000000000;
+  }
+  char timeText[logClock::secondsTextLen + 11];
+  logClock::formatSeconds(realtime, timeText);
+  char *digit = timeText + logClock::secondsTextLen;
+  *digit++ = '.';
+  for (int i = 8; i >= 0; i--) {
+    digit[i] = static_cast<char>('0' + nanos % 10);
+    nanos /= 10;
+  }
+  digit[9] = ' ';
+  out.append(timeText, sizeof(timeText));
+
+  formatText(entry.format, out);
+  if (out.empty() || out.back() != '\n') {
+    out.push_back('\n');
+  }
+  return true;
+}
+
+void mmapLogDecoder::decodeControl(std::string_view record) {
+  size_t pos = sizeof(uint32_t);
+  if (record.size() <= pos) {
+    skippedRecords++;
+    return;
+  }
+  uint8_t type = static_cast<uint8_t>(record[pos++]);
+  if (type == mmapLogger::clockSync) {
+    if (record.size() - pos < 2 * sizeof(int64_t)) {
+      skippedRecords++;
+      return;
+    }
+    syncTimestamp = get<int64_t>(record.data() + pos);
+    syncRealtime = get<int64_t>(record.data() + pos + sizeof(int64_t));
+    return;
+  }
+  if (type != mmapLogger::formatDefinition ||
+      record.size() - pos < sizeof(uint32_t)) {
+    skippedRecords++;
+    return;
+  }
+  uint32_t formatId = get<uint32_t>(record.data() + pos);
+  pos += sizeof(uint32_t);
+
+  //依次取出以'\0'结尾的参数类型串、格式字符串和文件名
+  std::string_view fields[3];
+  for (auto &field : fields) {
+    size_t end = record.find('\0', pos);
+    if (end == std::string_view::npos) {
+      skippedRecords++;
+      return;
+    }
+    field = record.substr(pos, end - pos);
+    pos = end + 1;
+  }
+  if (record.size() - pos < sizeof(uint32_t)) {
+    skippedRecords++;
+    return;
+  }
+  formatEntry &entry = formats[formatId];
+  entry.signature = fields[0];
+  entry.format = fields[1];
+  entry.file = fields[2];
+  entry.line = get<uint32_t>(record.data() + pos);
+}
+
+void mmapLogDecoder::formatText(const std::string &format, std::string &out) {
+  size_t argIndex = 0;
+  auto nextArg = [&]() -> const argValue * {
+    return argIndex < args.size() ? &args[argIndex++] : nullptr;
+  };
+  //按转换说明需要的类型读取参数
+  auto asSigned = [](const argValue &arg) -> long long {
+    switch (arg.type) {
+    case 'd':
+      return static_cast<long long>(get<double>(
+          reinterpret_cast<const char *>(&arg.bits)));
+    case 's':
+      return 0;
+    default:
+      return static_cast<long long>(arg.bits);
+    }
+  };
+  auto asDouble = [](const argValue &arg) -> double {
+    switch (arg.type) {
+    case 'd':
+      return get<double>(reinterpret_cast<const char *>(&arg.bits));
+    case 'i':
+      return static_cast<double>(static_cast<int64_t>(arg.bits));
+    case 's':
+      return 0;
+    default:
+      return static_cast<double>(arg.bits);
+    }
+  };
+
+  std::string spec;
+  size_t i = 0;
+  while (i < format.size()) {
+    size_t percent = format.find('%', i);
+    if (percent == std::string::npos) {
+      out.append(format, i, std::string::npos);
+      break;
+    }
+    out.append(format, i, percent - i);
+    i = percent + 1;
+    if (i < format.size() && format[i] == '%') {
+      out.push_back('%');
+      i++;
+      continue;
+    }
+
+    //标志、宽度和精度原样保留，'*'替换为参数值，长度修饰符按实际参数类型重写
+    spec.assign("%");
+    while (i < format.size() && strchr("-+ #0'", format[i]) != nullptr) {
+      spec.push_back(format[i++]);
+    }
+    for (int part = 0; part < 2 && i < format.size(); part++) {
+      if (part == 1) {
+        if (format[i] != '.') {
+          break;
+        }
+        spec.push_back(format[i++]);
+      }
+      if (i < format.size() && format[i] == '*') {
+        const argValue *arg = nextArg();
+        spec += std::to_string(arg != nullptr ? asSigned(*arg) : 0);
+        i++;
+      }
+      while (i < format.size() && format[i] >= '0' && format[i] <= '9') {
+        spec.push_back(format[i++]);
+      }
+    }
+    while (i < format.size() && strchr("hlLqjzt", format[i]) != nullptr) {
+      i++;
+    }
+    if (i >= format.size()) {
+      out.append(spec);
+      break;
+    }
+    char conv = format[i++];
+    if (strchr("diuoxXcfFeEgGaAsp", conv) == nullptr) {
+      //不支持的转换说明原样输出
+      out.append(spec).push_back(conv);
+      continue;
+    }
+    const argValue *arg = nextArg();
+    if (arg == nullptr) {
+      out.append("<missing>");
+      continue;
+    }
+    switch (conv) {
+    case 'd':
+    case 'i':
+      spec.append("ll").push_back(conv);
+      appendFormatted(out, spec, asSigned(*arg));
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      spec.append("ll").push_back(conv);
+      appendFormatted(out, spec,
+                      static_cast<unsigned long long>(asSigned(*arg)));
+      break;
+    case 'c':
+      spec.push_back(conv);
+      appendFormatted(out, spec, static_cast<int>(asSigned(*arg)));
+      break;
+    case 's': {
+      std::string text;
+      if (arg->type == 's') {
+        text = arg->str;
+      } else if (arg->type == 'd') {
+        text = std::to_string(asDouble(*arg));
+      } else if (arg->type == 'i') {
+        text = std::to_string(static_cast<int64_t>(arg->bits));
+      } else {
+        text = std::to_string(arg->bits);
+      }
+      spec.push_back(conv);
+      appendFormatted(out, spec, text.c_str());
+      break;
+    }
+    case 'p':
+      spec.push_back(conv);
+      appendFormatted(out, spec,
+                      reinterpret_cast<void *>(
+                          static_cast<uintptr_t>(asSigned(*arg))));
+      break;
+    default:
+      spec.push_back(conv);
+      appendFormatted(out, spec, asDouble(*arg));
+      break;
+    }
+  }
+}
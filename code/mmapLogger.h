@@ -0,0 +1,350 @@
+#ifndef __MMAPLOGGER__
+#define __MMAPLOGGER__
+#include "mmapBuffer.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 日志时钟。写入端只读取原始时间戳，格式化时按线程缓存当前秒的文本
+ */
+class logClock {
+public:
+  //格式化后秒级时间文本的长度，格式为"YYYY-mm-dd HH:MM:SS"
+  static constexpr size_t secondsTextLen = 19;
+
+  /**
+   * @brief 原始时间戳，steady_clock的纳秒数，通过vDSO读取，不进入内核也不加锁
+   */
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /**
+   * @brief 当前系统时间，自1970年起的纳秒数
+   */
+  static int64_t realtimeNow();
+
+  /**
+   * @brief 将系统时间格式化为本地时间的秒级文本
+   * @param realtimeNs 自1970年起的纳秒数
+   * @param out 输出缓冲区，写入secondsTextLen个字符，不写入结尾的'\0'
+   * @note
+   * 每个线程缓存上一次格式化的结果，同一秒内只拷贝文本，同一分钟内只改写秒数，
+   * 跨分钟时才调用localtime_r和strftime，线程之间不共享状态
+   */
+  static void formatSeconds(int64_t realtimeNs, char *out);
+
+  /**
+   * @brief 将当前系统时间格式化为秒级文本，等价于formatSeconds(realtimeNow(), out)
+   */
+  static void formatNow(char *out) { formatSeconds(realtimeNow(), out); }
+};
+
+/**
+ * @brief 日志调用点的静态信息，由MMAP_LOG宏生成
+ */
+struct logSite {
+  const char *format; //printf风格的格式字符串
+  const char *file;
+  uint32_t line;
+};
+
+/**
+ * @brief
+ * 延迟格式化的二进制日志前端。写入端只把格式字符串编号、原始时间戳和参数的二进制值
+ * 写入缓存，格式化由mmapLogDecoder在持久化之后或离线工具中完成。
+ * @note
+ * 缓存实例需要在initBuffer之前调用enableRecordFraming，每次日志调用写入一条记录，
+ * 记录中的数值按本机字节序存储，只能在相同字节序的机器上解码。
+ * 记录格式：
+ * 日志记录 [uint32 格式编号][int64 时间戳][参数...]；
+ * 控制记录 [uint32 0][uint8 类型][内容...]，类型1为格式定义
+ * [uint32 编号][参数类型串\0][格式字符串\0][文件名\0][uint32 行号]，
+ * 类型2为时钟同步[int64 时间戳][int64 系统时间]。
+ * 参数类型：'i'为int64，'u'为uint64，'d'为double，'p'为指针(uint64)，
+ * 's'为字符串[uint32 长度][内容]。
+ * 每个格式字符串第一次在某个日志实例中使用时先写入它的格式定义，
+ * 格式定义不经过线程暂存区，因此在数据流中总是位于使用它的日志记录之前；
+ * 时钟同步记录在创建时和之后每隔syncIntervalNs写入一次，解码时把原始时间戳换算为系统时间。
+ * 持久化文件轮转时，新文件开头重新写入已定义的全部格式和一条时钟同步记录，
+ * 每个轮转文件都可以单独解码。一个缓存实例上只能创建一个日志实例
+ */
+class mmapLogger {
+public:
+  //格式编号0保留给控制记录
+  static constexpr uint32_t controlId = 0;
+  //进程内可注册的格式字符串数量上限
+  static constexpr uint32_t maxFormats = 65536;
+  //时钟同步记录的写入间隔(ns)
+  static constexpr int64_t syncIntervalNs = 1000000000;
+  //日志记录头部长度，格式编号和时间戳
+  static constexpr size_t recordHeaderLen = sizeof(uint32_t) + sizeof(int64_t);
+
+  enum controlType : uint8_t { formatDefinition = 1, clockSync = 2 };
+
+  /**
+   * @brief 在缓存实例之上创建日志前端，并写入第一条时钟同步记录
+   * @param _buffer 已调用enableRecordFraming和initBuffer的缓存实例
+   * @param _noLose 写入日志记录时传给try_append的noLose参数
+   */
+  explicit mmapLogger(std::shared_ptr<mmapBuffer> _buffer,
+                      bool _noLose = true);
+
+  /**
+   * @brief 取消缓存实例中的轮转文件开头记录
+   */
+  ~mmapLogger();
+
+  //删除复制构造函数
+  mmapLogger(const mmapLogger &) = delete;
+  //删除赋值运算符重载
+  mmapLogger &operator=(const mmapLogger &) = delete;
+
+  /**
+   * @brief 注册格式字符串，返回进程内唯一的格式编号
+   * @param site 调用点信息，格式字符串和文件名必须在进程生命周期内有效
+   * @param signature 参数类型串
+   * @return 格式编号，超过maxFormats时返回controlId
+   * @note 由log在每个调用点第一次执行时调用一次，之后使用静态变量中缓存的编号
+   */
+  static uint32_t registerFormat(const logSite &site, const char *signature);
+
+  /**
+   * @brief 写入一条日志记录，一般通过MMAP_LOG宏调用
+   * @param siteFn 返回logSite的无捕获lambda，每个调用点的类型不同，
+   * 用于为每个调用点生成一个保存格式编号的静态变量
+   * @param args
+   * 日志参数，支持整数、枚举、浮点数、指针、C字符串、std::string和std::string_view
+   * @return 记录写入缓存或溢出文件时返回true，被丢弃或超过缓存块大小时返回false
+   */
+  template <typename SiteFn, typename... Args>
+  bool log(SiteFn siteFn, const Args &...args) {
+    static const uint32_t formatId =
+        registerFormat(siteFn(), signatureOf<Args...>());
+    if (formatId == controlId) {
+      return false;
+    }
+    int64_t timestamp = logClock::now();
+    if (timestamp - lastSync.load(std::memory_order_relaxed) >=
+        syncIntervalNs) {
+      writeSync(timestamp);
+    }
+    if (!defined[formatId].load(std::memory_order_acquire)) {
+      defineFormat(formatId);
+    }
+
+    //小记录在栈上编码，避免每次日志调用分配内存
+    size_t len = recordHeaderLen + (argSize(args) + ... + 0);
+    char stackBuffer[256];
+    std::unique_ptr<char[]> heapBuffer;
+    char *record = stackBuffer;
+    if (len > sizeof(stackBuffer)) {
+      heapBuffer.reset(new char[len]);
+      record = heapBuffer.get();
+    }
+    char *pos = put(record, formatId);
+    pos = put(pos, timestamp);
+    ((pos = encodeArg(pos, args)), ...);
+    return buffer->try_append(record, len, noLose);
+  }
+
+  /**
+   * @brief 获取底层的缓存实例
+   */
+  const std::shared_ptr<mmapBuffer> &getBuffer() const { return buffer; }
+
+private:
+  template <typename T> struct unsupportedArg : std::false_type {};
+
+  //参数类型对应的类型字符
+  template <typename T> static constexpr char argType() {
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, const char *> ||
+                  std::is_same_v<U, char *> ||
+                  std::is_same_v<U, std::string> ||
+                  std::is_same_v<U, std::string_view>) {
+      return 's';
+    } else if constexpr (std::is_same_v<U, bool>) {
+      return 'u';
+    } else if constexpr (std::is_enum_v<U>) {
+      return std::is_signed_v<std::underlying_type_t<U>> ? 'i' : 'u';
+    } else if constexpr (std::is_integral_v<U>) {
+      return std::is_signed_v<U> ? 'i' : 'u';
+    } else if constexpr (std::is_floating_point_v<U>) {
+      return 'd';
+    } else if constexpr (std::is_pointer_v<U>) {
+      return 'p';
+    } else {
+      static_assert(unsupportedArg<U>::value, "unsupported log argument");
+      return 0;
+    }
+  }
+
+  //参数类型串，每个参数一个类型字符
+  template <typename... Args> static const char *signatureOf() {
+    static constexpr char signature[] = {argType<Args>()..., '\0'};
+    return signature;
+  }
+
+  //字符串参数的内容
+  template <typename T> static std::string_view stringArg(const T &value) {
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, std::string> ||
+                  std::is_same_v<U, std::string_view>) {
+      return value;
+    } else {
+      const char *str = value;
+      return str != nullptr ? std::string_view(str) : "(null)";
+    }
+  }
+
+  template <typename T> static size_t argSize(const T &value) {
+    if constexpr (argType<T>() == 's') {
+      return sizeof(uint32_t) + stringArg(value).size();
+    } else {
+      return sizeof(uint64_t);
+    }
+  }
+
+  template <typename T> static char *put(char *pos, T value) {
+    memcpy(pos, &value, sizeof(value));
+    return pos + sizeof(value);
+  }
+
+  template <typename T> static char *encodeArg(char *pos, const T &value) {
+    constexpr char type = argType<T>();
+    if constexpr (type == 's') {
+      std::string_view str = stringArg(value);
+      pos = put(pos, static_cast<uint32_t>(str.size()));
+      memcpy(pos, str.data(), str.size());
+      return pos + str.size();
+    } else if constexpr (type == 'd') {
+      return put(pos, static_cast<double>(value));
+    } else if constexpr (type == 'p') {
+      return put(pos, static_cast<uint64_t>(
+                          reinterpret_cast<uintptr_t>(value)));
+    } else if constexpr (type == 'i') {
+      return put(pos, static_cast<int64_t>(value));
+    } else {
+      return put(pos, static_cast<uint64_t>(value));
+    }
+  }
+
+  /**
+   * @brief 写入格式定义记录，同一日志实例中每个格式只在写入成功后标记为已定义
+   */
+  void defineFormat(uint32_t formatId);
+
+  /**
+   * @brief 编码格式定义记录
+   */
+  static std::string definitionRecord(uint32_t formatId);
+
+  /**
+   * @brief 编码时钟同步记录
+   */
+  static std::string syncRecord(int64_t timestamp);
+
+  /**
+   * @brief 轮转文件开头的记录，在持久化线程上调用，不能等待defineMutex
+   * @return 一条时钟同步记录和已经写入或正在写入的全部格式定义
+   */
+  std::vector<std::string> rotationPrologue();
+
+  /**
+   * @brief 写入时钟同步记录，多个线程同时到期时只有一个写入
+   */
+  void writeSync(int64_t timestamp);
+
+  std::shared_ptr<mmapBuffer> buffer;
+  bool noLose;
+  //上一次时钟同步的时间戳
+  std::atomic_int64_t lastSync;
+  //各格式编号是否已在本实例中写入格式定义
+  std::unique_ptr<std::atomic_bool[]> defined;
+  //串行化格式定义的写入
+  std::mutex defineMutex;
+  //正在写入定义的格式编号，没有时为controlId
+  std::atomic_uint32_t definingId = controlId;
+};
+
+/**
+ * @brief 解码mmapLogger写入的记录并格式化为文本
+ * @note
+ * 按数据流顺序解码，格式定义和时钟同步记录更新解码器状态，之后的日志记录按最近的定义解码，
+ * 进程重启后重新写入的定义覆盖之前的同名编号。轮转产生的每个文件都可以单独解码，
+ * 多个文件按顺序使用同一个解码器时开头重复的定义同样覆盖之前的定义。
+ * 格式字符串按printf的转换说明解释，参数类型与转换说明不符时按转换说明转换，
+ * 不支持%n
+ */
+class mmapLogDecoder {
+public:
+  /**
+   * @brief 解码一条记录
+   * @param record mmapReader读出的一条记录
+   * @param out 日志记录的文本追加到末尾，格式为"YYYY-mm-dd HH:MM:SS.nnnnnnnnn 内容\n"
+   * @return 追加了文本时返回true，控制记录和无法解析的记录返回false
+   */
+  bool decode(std::string_view record, std::string &out);
+
+  /**
+   * @brief 获取因格式未定义或内容不完整而跳过的日志记录数量
+   */
+  size_t getSkippedRecords() const { return skippedRecords; }
+
+private:
+  struct formatEntry {
+    std::string signature;
+    std::string format;
+    std::string file;
+    uint32_t line = 0;
+  };
+
+  //解码出的参数，字符串参数指向记录内部
+  struct argValue {
+    char type;
+    uint64_t bits; //整数、浮点数和指针的二进制值
+    std::string_view str;
+  };
+
+  /**
+   * @brief 处理控制记录
+   */
+  void decodeControl(std::string_view record);
+
+  /**
+   * @brief 按格式字符串和args中的参数追加格式化后的文本
+   */
+  void formatText(const std::string &format, std::string &out);
+
+  std::unordered_map<uint32_t, formatEntry> formats;
+  //最近一次时钟同步的原始时间戳和系统时间
+  int64_t syncTimestamp = 0;
+  int64_t syncRealtime = 0;
+  size_t skippedRecords = 0;
+  //当前记录的参数，在多次解码之间复用
+  std::vector<argValue> args;
+};
+
+/**
+ * @brief 写入一条延迟格式化的日志，格式字符串必须是字符串字面量
+ * @param logger mmapLogger实例
+ * @param format printf风格的格式字符串
+ */
+#define MMAP_LOG(logger, format, ...)                                          \
+  (logger).log(                                                                \
+      [] { return logSite{format, __FILE__, __LINE__}; } __VA_OPT__(, )        \
+          __VA_ARGS__)
+
+#endif
@@ -0,0 +1,80 @@
+#include "mmapReader.h"
+#include "mmapCodec.h"
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+mmapReader::mmapReader(const std::string &_filePath, size_t _pageSize)
+    : filePath(_filePath), pageSize(_pageSize) {
+  fd = open(filePath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat fileStat = {};
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    return;
+  }
+  fileLen = fileStat.st_size;
+  void *ptr = mmap(nullptr, fileLen, PROT_READ, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    fileLen = 0;
+    return;
+  }
+  //顺序读取，提示内核加大预读
+  madvise(ptr, fileLen, MADV_SEQUENTIAL);
+  data = reinterpret_cast<const char *>(ptr);
+  recordData = data;
+  recordDataLen = fileLen;
+
+  //压缩文件先解码，损坏的帧之后的数据被丢弃
+  if (mmapCodec::isFramed(data, fileLen)) {
+    mmapCodec::decodeFrames(data, fileLen, decodedData, pageSize);
+    recordData = decodedData.data();
+    recordDataLen = decodedData.size();
+  }
+}
+
+mmapReader::~mmapReader() {
+  if (data != nullptr) {
+    munmap(const_cast<char *>(data), fileLen);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool mmapReader::isValid() const { return data != nullptr; }
+
+size_t mmapReader::getFileLen() const { return fileLen; }
+
+bool mmapReader::isCompressed() const { return recordData != data; }
+
+bool mmapReader::next(std::string_view &record) {
+  while (readPos + mmapRecord::headerSize <= recordDataLen) {
+    size_t len = mmapRecord::decodeHeader(recordData + readPos);
+    if (len == 0) {
+      //页对齐补足的填充，跳到下一个页面的起始位置
+      readPos = (readPos / pageSize + 1) * pageSize;
+      continue;
+    }
+    if (len > recordDataLen - readPos - mmapRecord::headerSize) {
+      //文件末尾的记录不完整
+      return false;
+    }
+    record =
+        std::string_view(recordData + readPos + mmapRecord::headerSize, len);
+    readPos += mmapRecord::headerSize + len;
+    return true;
+  }
+  return false;
+}
+
+void mmapReader::rewind() { readPos = 0; }
+
+mmapReader::iterator mmapReader::begin() {
+  rewind();
+  return iterator(this);
+}
+
+mmapReader::iterator mmapReader::end() { return iterator(); }
@@ -0,0 +1,142 @@
+#ifndef __MMAPREADER__
+#define __MMAPREADER__
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 分帧记录的头部格式
+ * @note 头部为4字节小端整数，值为(长度<<1)|1，首字节必定非零，
+ * 因此记录起始位置读到的零字节一定是页对齐补足的填充，读取时跳到下一个页面
+ */
+struct mmapRecord {
+  //记录头部长度
+  static constexpr size_t headerSize = 4;
+  //单条记录的最大长度
+  static constexpr size_t maxLength = 0x7fffffff;
+
+  /**
+   * @brief 编码记录头部
+   * @param len 记录长度，不能为0
+   * @param header 写入头部的缓冲区，长度为headerSize
+   */
+  static void encodeHeader(size_t len, char *header) {
+    uint32_t word = static_cast<uint32_t>(len << 1 | 1);
+    for (size_t i = 0; i < headerSize; i++) {
+      header[i] = static_cast<char>(word >> (8 * i));
+    }
+  }
+
+  /**
+   * @brief 解码记录头部
+   * @param header 头部指针
+   * @return 返回记录长度，头部位置为填充字节时返回0
+   */
+  static size_t decodeHeader(const char *header) {
+    uint32_t word = 0;
+    for (size_t i = 0; i < headerSize; i++) {
+      word |= static_cast<uint32_t>(static_cast<unsigned char>(header[i]))
+              << (8 * i);
+    }
+    return (word & 1) ? (word >> 1) : 0;
+  }
+};
+
+/**
+ * @brief 映射分帧模式写入的持久化文件，零拷贝地逐条读取记录
+ * @note 持久化文件由压缩帧组成时，打开时一次性解码到内存中，再从解码后的数据读取记录
+ */
+class mmapReader {
+public:
+  /**
+   * @brief 只读映射持久化文件
+   * @param _filePath 持久化文件路径
+   * @param _pageSize 写入时使用的系统页面大小(bytes)，用于跳过页对齐补足的填充
+   */
+  explicit mmapReader(const std::string &_filePath,
+                      size_t _pageSize = 4096);
+
+  //删除复制构造函数
+  mmapReader(const mmapReader &) = delete;
+  //删除赋值运算符重载
+  mmapReader &operator=(const mmapReader &) = delete;
+
+  /**
+   * @brief 析构时解除内存映射并关闭文件
+   */
+  ~mmapReader();
+
+  /**
+   * @brief 检查文件是否映射成功
+   */
+  bool isValid() const;
+
+  /**
+   * @brief 获取映射文件的长度
+   */
+  size_t getFileLen() const;
+
+  /**
+   * @brief 持久化文件是否由压缩帧组成
+   */
+  bool isCompressed() const;
+
+  /**
+   * @brief 读取下一条记录
+   * @param record 指向映射内存或解码数据中记录的视图，在reader析构前有效
+   * @return 没有更多完整记录时返回false
+   */
+  bool next(std::string_view &record);
+
+  /**
+   * @brief 回到文件起始位置重新读取
+   */
+  void rewind();
+
+  /**
+   * @brief 按顺序遍历记录的输入迭代器
+   */
+  class iterator {
+  public:
+    iterator() = default;
+    explicit iterator(mmapReader *_reader) : reader(_reader) { ++*this; }
+
+    std::string_view operator*() const { return record; }
+    const std::string_view *operator->() const { return &record; }
+    iterator &operator++() {
+      if (reader != nullptr && !reader->next(record)) {
+        reader = nullptr;
+      }
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return reader == other.reader;
+    }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    mmapReader *reader = nullptr;
+    std::string_view record;
+  };
+
+  /**
+   * @brief 从文件起始位置开始遍历
+   */
+  iterator begin();
+
+  iterator end();
+
+private:
+  std::string filePath; //持久化文件路径
+  size_t pageSize = 4096;
+  int fd = -1;
+  const char *data = nullptr; //文件映射的头指针
+  size_t fileLen = 0;
+  std::string decodedData;          //压缩文件解码后的数据
+  const char *recordData = nullptr; //读取记录的数据，为映射或解码后的数据
+  size_t recordDataLen = 0;
+  size_t readPos = 0; //下一条记录的起始偏移量
+};
+
+#endif
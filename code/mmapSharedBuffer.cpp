@@ -0,0 +1,703 @@
+#include "mmapSharedBuffer.h"
+#include <algorithm>
+#include <assert.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::mutex mmapSharedBuffer::instanceMapMutex;
+
+std::unordered_map<std::string, std::shared_ptr<mmapSharedBuffer>>
+    mmapSharedBuffer::bufferInstances;
+
+namespace {
+
+//共享映射中的原子变量在各个进程中地址不同，必须是无锁实现
+static_assert(std::atomic_uint64_t::is_always_lock_free &&
+                  std::atomic_uint32_t::is_always_lock_free &&
+                  std::atomic_int32_t::is_always_lock_free,
+              "process-shared atomics must be lock-free");
+
+//在futex上休眠之前让出CPU重试的次数
+constexpr unsigned spinCount = 64;
+//有未写出的数据时持久化进程的最长休眠时间(ms)，用于检查写出期限和停滞的缓存块
+constexpr int pendingWaitMs = 100;
+
+//在进程间共享的futex上等待，不能使用FUTEX_PRIVATE_FLAG，timeoutMs为-1时无限等待
+void futexWait(std::atomic_uint32_t &word, uint32_t expected, int timeoutMs) {
+  timespec timeout = {};
+  timespec *timeoutPtr = nullptr;
+  if (timeoutMs >= 0) {
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = static_cast<long>(timeoutMs % 1000) * 1000000;
+    timeoutPtr = &timeout;
+  }
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected,
+          timeoutPtr, nullptr, 0);
+}
+
+//唤醒在futex上休眠的所有线程，包括其他进程中的线程
+void futexWake(std::atomic_uint32_t &word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
+
+//处理被信号中断和不完整的写入，从未写入的位置继续
+void writeFully(int fd, const char *data, size_t len, uint64_t offset) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t writeLen =
+        pwrite64(fd, data + written, len - written, offset + written);
+    if (writeLen < 0 && errno == EINTR) {
+      continue;
+    }
+    if (writeLen <= 0) {
+      break;
+    }
+    written += writeLen;
+  }
+}
+
+//将原子变量提高到target，多个进程同时提高时保留最大值
+void raiseTo(std::atomic_uint64_t &value, uint64_t target) {
+  uint64_t current = value;
+  while (current < target &&
+         !value.compare_exchange_weak(current, target)) {
+  }
+}
+
+size_t roundUp(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+} // namespace
+
+void mmapSharedBuffer::initBuffer(const std::string &_persistenceFilePath,
+                                  const std::string &_controlFilePath,
+                                  size_t _blockCount, size_t _blockSize,
+                                  unsigned int _systemPageSize) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  initFlag = true;
+  systemPageSize = _systemPageSize;
+  assert(_persistenceFilePath.size() < mmapSharedHeader::maxPathLength);
+
+  controlFd = ::open(_controlFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                     0645);
+  assert(controlFd >= 0);
+  if (posix_memalign(reinterpret_cast<void **>(&tailPage), systemPageSize,
+                     systemPageSize) != 0) {
+    tailPage = nullptr;
+  }
+
+  //连接过程互斥，第一个连接的进程完成恢复和初始化之后其他进程才能映射
+  lockByte(initLockByte, F_WRLCK, true);
+  uint64_t geometry[3] = {};
+  bool hasSession =
+      pread(controlFd, geometry, sizeof(geometry), 0) == sizeof(geometry) &&
+      geometry[0] == headerMagic;
+  bool mapped = false;
+  if (lockByte(attachLockByte, F_WRLCK, false)) {
+    //没有其他进程连接，上次会话可能异常结束，先按上次的参数写出遗留的数据
+    if (hasSession && mapControlFile(geometry[1], geometry[2], false)) {
+      recoverSession();
+      unmapControlFile();
+    }
+    mapped = mapControlFile(
+        roundUp(std::max<size_t>(_blockSize, systemPageSize), systemPageSize),
+        std::max<size_t>(_blockCount, 2), true);
+    if (mapped) {
+      startSession(_persistenceFilePath);
+    }
+    lockByte(attachLockByte, F_RDLCK, false);
+  } else {
+    //已有进程连接时沿用控制文件中的参数
+    lockByte(attachLockByte, F_RDLCK, true);
+    mapped = hasSession && mapControlFile(geometry[1], geometry[2], false);
+  }
+  if (mapped && !registerProcess()) {
+    //槽位已满，无法区分本进程的预留
+    unmapControlFile();
+    mapped = false;
+  }
+  if (!mapped) {
+    //关闭文件时释放记录锁，isValid返回false
+    close(controlFd);
+    controlFd = -1;
+    return;
+  }
+  lockByte(initLockByte, F_UNLCK, false);
+
+  //每个进程都有一个持久化线程，只有获得持久化锁的线程写出数据，其余的等待接替
+  persistThread = std::thread([this] { persistLoop(); });
+}
+
+void mmapSharedBuffer::setFlushDeadline(unsigned int deadlineMs) {
+  std::unique_lock<std::mutex> lk(bufferMutex);
+  if (initFlag) {
+    return;
+  }
+  flushDeadlineMs = deadlineMs;
+}
+
+bool mmapSharedBuffer::isValid() const { return header != nullptr; }
+
+bool mmapSharedBuffer::isPersister() const { return persisterFlag; }
+
+uint64_t mmapSharedBuffer::getPersistedOffset() const {
+  return header == nullptr ? 0 : header->persistedOffset.load();
+}
+
+uint64_t mmapSharedBuffer::getDroppedBytes() const { return droppedBytes; }
+
+mmapSharedBuffer::~mmapSharedBuffer() {
+  if (header != nullptr) {
+    //本进程预留的数据写出之后再停止持久化线程
+    waitForBufferPersist();
+    {
+      std::unique_lock<std::mutex> lock(stop_mtx);
+      stopFlag = true;
+    }
+    stop_cv.notify_all();
+    header->persistSeq++;
+    futexWake(header->persistSeq);
+    persistThread.join();
+
+    //与连接过程互斥，最后一个断开的进程截去持久化文件末尾补零的部分
+    lockByte(initLockByte, F_WRLCK, true);
+    header->processPids[pidSlot] = 0;
+    if (lockByte(attachLockByte, F_WRLCK, false) &&
+        header->persistedOffset == header->reserveOffset) {
+      int fd = ::open(header->persistencePath, O_WRONLY | O_CLOEXEC);
+      if (fd >= 0) {
+        ftruncate(fd, header->fileBase + header->persistedOffset);
+        close(fd);
+      }
+    }
+    unmapControlFile();
+    //关闭文件时释放本进程在控制文件上的所有记录锁
+    close(controlFd);
+  }
+  free(tailPage);
+}
+
+bool mmapSharedBuffer::lockByte(off_t byte, short type, bool wait) {
+  //OFD锁属于打开的文件描述，同一进程中使用同一控制文件的多个实例之间同样互斥
+  struct flock lock = {};
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = byte;
+  lock.l_len = 1;
+  while (fcntl(controlFd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock) != 0) {
+    if (!wait || errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool mmapSharedBuffer::mapControlFile(size_t _blockSize, size_t _blockCount,
+                                      bool resize) {
+  blockSize = _blockSize;
+  blockCount = _blockCount;
+  ringSize = blockSize * blockCount;
+  slotsOffset = roundUp(sizeof(mmapSharedHeader), committedStride) +
+                blockCount * committedStride;
+  slotStride =
+      committedStride + roundUp(blockCount * slotCounterLen, committedStride);
+  headerLen = roundUp(slotsOffset + mmapSharedHeader::maxProcesses * slotStride,
+                      systemPageSize);
+  mapLen = headerLen + ringSize;
+  if (blockSize == 0 || blockSize % systemPageSize != 0 || blockCount < 2) {
+    return false;
+  }
+  if (resize) {
+    if (ftruncate(controlFd, mapLen) != 0 ||
+        posix_fallocate(controlFd, 0, mapLen) != 0) {
+      return false;
+    }
+  } else {
+    //控制文件长度不足时访问映射会产生SIGBUS
+    struct stat fileStat = {};
+    if (fstat(controlFd, &fileStat) != 0 ||
+        static_cast<size_t>(fileStat.st_size) < mapLen) {
+      return false;
+    }
+  }
+  void *base = mmap(nullptr, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    controlFd, 0);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  mapBase = static_cast<char *>(base);
+  header = reinterpret_cast<mmapSharedHeader *>(mapBase);
+  ring = mapBase + headerLen;
+  return true;
+}
+
+void mmapSharedBuffer::unmapControlFile() {
+  munmap(mapBase, mapLen);
+  mapBase = nullptr;
+  header = nullptr;
+  ring = nullptr;
+}
+
+void mmapSharedBuffer::recoverSession() {
+  char path[mmapSharedHeader::maxPathLength] = {};
+  memcpy(path, header->persistencePath, sizeof(path) - 1);
+  int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0645);
+  if (fd < 0) {
+    return;
+  }
+  uint64_t persisted = header->persistedOffset;
+  uint64_t reserved = header->reserveOffset;
+  if (reserved < persisted || reserved - persisted > ringSize) {
+    //头部已损坏，不写出遗留的数据
+    reserved = persisted;
+  }
+
+  //持久化文件的长度应在已写出偏移量和补零后的页面末尾之间，否则已在两次会话之间被移走或修改，
+  //遗留的数据追加到文件末尾，也不截断文件
+  struct stat fileStat = {};
+  fstat(fd, &fileStat);
+  uint64_t fileLen = fileStat.st_size;
+  uint64_t fileEnd = header->fileBase + persisted;
+  if (fileLen < fileEnd / systemPageSize * systemPageSize ||
+      fileLen > roundUp(fileEnd, systemPageSize)) {
+    fileEnd = fileLen;
+  }
+  //崩溃时尚未提交的区间按缓存环中的原有内容写出
+  for (uint64_t offset = persisted; offset < reserved;) {
+    size_t pos = offset % ringSize;
+    size_t len = std::min<uint64_t>(reserved - offset, ringSize - pos);
+    writeFully(fd, ring + pos, len, fileEnd + offset - persisted);
+    offset += len;
+  }
+  ftruncate(fd, fileEnd + reserved - persisted);
+  close(fd);
+}
+
+void mmapSharedBuffer::startSession(const std::string &_persistenceFilePath) {
+  //重新初始化头部，原子变量、各缓存块的已提交长度和槽位计数全部清零
+  new (header) mmapSharedHeader{};
+  for (size_t i = 0; i < blockCount; i++) {
+    new (&committedOf(i)) std::atomic_uint64_t(0);
+  }
+  for (size_t slot = 0; slot < mmapSharedHeader::maxProcesses; slot++) {
+    new (&reservingOf(slot)) std::atomic_uint64_t(0);
+    for (size_t i = 0; i < blockCount; i++) {
+      new (&slotReservedOf(slot, i)) std::atomic_uint64_t(0);
+      new (&slotCommittedOf(slot, i)) std::atomic_uint64_t(0);
+    }
+  }
+  int fd = ::open(_persistenceFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                  0645);
+  assert(fd >= 0);
+  struct stat fileStat = {};
+  fstat(fd, &fileStat);
+  //数据流起点按页面对齐以满足O_DIRECT的要求，之前不足一页的部分作为已写出的数据放在缓存环开头
+  uint64_t fileBase = fileStat.st_size / systemPageSize * systemPageSize;
+  size_t tailLen = fileStat.st_size - fileBase;
+  if (tailLen > 0 && pread(fd, ring, tailLen, fileBase) !=
+                         static_cast<ssize_t>(tailLen)) {
+    memset(ring, 0, tailLen);
+  }
+  close(fd);
+
+  header->blockSize = blockSize;
+  header->blockCount = blockCount;
+  header->fileBase = fileBase;
+  memcpy(header->persistencePath, _persistenceFilePath.c_str(),
+         _persistenceFilePath.size() + 1);
+  committedOf(0) = tailLen;
+  header->reserveOffset = tailLen;
+  header->persistedOffset = tailLen;
+  header->flushRequest = tailLen;
+  header->magic = headerMagic;
+}
+
+bool mmapSharedBuffer::registerProcess() {
+  //先获取槽位的记录锁，持有锁之后其他进程不会再回收该槽位
+  for (size_t i = 0; i < mmapSharedHeader::maxProcesses; i++) {
+    if (lockByte(slotLockByte + i, F_WRLCK, false)) {
+      if (header->processPids[i] != 0) {
+        //上一个登记的进程没有正常断开，它的预留都在当前预留偏移量之前
+        settleSlot(i);
+        raiseTo(header->crashBound, header->reserveOffset);
+      }
+      header->processPids[i] = getpid();
+      pidSlot = static_cast<int>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void mmapSharedBuffer::reclaimCrashedSlots() {
+  //进程退出时内核释放它的记录锁，即使还未被回收也能发现，pid被重用时也不会误判
+  for (size_t i = 0; i < mmapSharedHeader::maxProcesses; i++) {
+    if (header->processPids[i] == 0 || static_cast<int>(i) == pidSlot) {
+      continue;
+    }
+    //持有槽位的记录锁时结清，与登记到该槽位的新进程互斥
+    if (!lockByte(slotLockByte + i, F_WRLCK, false)) {
+      continue;
+    }
+    if (header->processPids[i] != 0) {
+      settleSlot(i);
+      header->processPids[i] = 0;
+      raiseTo(header->crashBound, header->reserveOffset);
+    }
+    lockByte(slotLockByte + i, F_UNLCK, false);
+  }
+}
+
+void mmapSharedBuffer::settleSlot(size_t slot) {
+  for (size_t i = 0; i < blockCount; i++) {
+    slotCommittedOf(slot, i) = slotReservedOf(slot, i).load();
+  }
+  reservingOf(slot) = 0;
+}
+
+std::atomic_uint64_t &mmapSharedBuffer::committedOf(size_t index) const {
+  return *reinterpret_cast<std::atomic_uint64_t *>(
+      mapBase + roundUp(sizeof(mmapSharedHeader), committedStride) +
+      index * committedStride);
+}
+
+std::atomic_uint64_t &mmapSharedBuffer::reservingOf(size_t slot) const {
+  return *reinterpret_cast<std::atomic_uint64_t *>(mapBase + slotsOffset +
+                                                   slot * slotStride);
+}
+
+std::atomic_uint64_t &mmapSharedBuffer::slotReservedOf(size_t slot,
+                                                       size_t index) const {
+  return *reinterpret_cast<std::atomic_uint64_t *>(
+      mapBase + slotsOffset + slot * slotStride + committedStride +
+      index * slotCounterLen);
+}
+
+std::atomic_uint64_t &mmapSharedBuffer::slotCommittedOf(size_t slot,
+                                                        size_t index) const {
+  return *reinterpret_cast<std::atomic_uint64_t *>(
+      mapBase + slotsOffset + slot * slotStride + committedStride +
+      index * slotCounterLen + sizeof(uint64_t));
+}
+
+uint64_t mmapSharedBuffer::releasedOffset() const {
+  return header->persistedOffset / blockSize * blockSize;
+}
+
+bool mmapSharedBuffer::try_append(const char *data, size_t len, bool noLose,
+                                  uint64_t *ticket) {
+  if (ticket != nullptr) {
+    *ticket = 0;
+  }
+  if (header == nullptr) {
+    return false;
+  }
+  std::atomic_uint64_t &reserving = reservingOf(pidSlot);
+  //超过单个缓存块大小的数据分段写入
+  while (len > 0) {
+    size_t reserveLen = std::min(len, blockSize);
+    //预留之后不能撤销，缓存写满时先等待或丢弃再预留，预留区间总在缓存环的当前一轮之内，
+    //槽位中各缓存块的计数只包含本轮的预留
+    reserving++;
+    uint64_t start = header->reserveOffset;
+    while (true) {
+      if (start + reserveLen > releasedOffset() + ringSize) {
+        reserving--;
+        if (!noLose) {
+          droppedBytes += len;
+          return false;
+        }
+        waitForProgress(start + reserveLen, true);
+        reserving++;
+        start = header->reserveOffset;
+      } else if (header->reserveOffset.compare_exchange_weak(
+                     start, start + reserveLen)) {
+        break;
+      }
+    }
+    recordReserved(start, reserveLen);
+    reserving--;
+    copyIn(start, data, reserveLen);
+    commitRange(start, reserveLen);
+    data += reserveLen;
+    len -= reserveLen;
+    if (ticket != nullptr) {
+      *ticket = start + reserveLen;
+    }
+  }
+  return true;
+}
+
+void mmapSharedBuffer::copyIn(uint64_t start, const char *data, size_t len) {
+  size_t pos = start % ringSize;
+  size_t firstLen = std::min(len, ringSize - pos);
+  memcpy(ring + pos, data, firstLen);
+  if (firstLen < len) {
+    memcpy(ring, data + firstLen, len - firstLen);
+  }
+}
+
+void mmapSharedBuffer::recordReserved(uint64_t start, size_t len) {
+  while (len > 0) {
+    uint64_t blockIndex = start / blockSize;
+    size_t partLen =
+        std::min<uint64_t>(len, (blockIndex + 1) * blockSize - start);
+    slotReservedOf(pidSlot, blockIndex % blockCount) += partLen;
+    start += partLen;
+    len -= partLen;
+  }
+}
+
+void mmapSharedBuffer::commitRange(uint64_t start, size_t len) {
+  while (len > 0) {
+    uint64_t blockIndex = start / blockSize;
+    size_t partLen =
+        std::min<uint64_t>(len, (blockIndex + 1) * blockSize - start);
+    //已提交长度跨会话累加，恰好为缓存块大小的整数倍时该缓存块本轮提交完整
+    uint64_t committed = committedOf(blockIndex % blockCount)
+                             .fetch_add(partLen, std::memory_order_release) +
+                         partLen;
+    //先累加缓存块再累加槽位，持久化进程先读槽位后读缓存块，读到的未提交长度只会偏大
+    slotCommittedOf(pidSlot, blockIndex % blockCount) += partLen;
+    if (committed % blockSize == 0) {
+      wakePersister();
+    }
+    start += partLen;
+    len -= partLen;
+  }
+}
+
+void mmapSharedBuffer::wakePersister() {
+  header->persistSeq++;
+  if (header->persisterSleeping) {
+    futexWake(header->persistSeq);
+  }
+}
+
+void mmapSharedBuffer::notifyProgress() {
+  header->progressSeq++;
+  if (header->progressWaiters > 0) {
+    futexWake(header->progressSeq);
+  }
+}
+
+void mmapSharedBuffer::waitForProgress(uint64_t target, bool space) {
+  auto reached = [&] {
+    return space ? releasedOffset() + ringSize >= target
+                 : header->persistedOffset >= target;
+  };
+  for (unsigned spin = 0; !reached(); spin++) {
+    if (spin < spinCount) {
+      std::this_thread::yield();
+      continue;
+    }
+    //先登记再检查，持久化进程推进后读取到登记时一定会唤醒
+    uint32_t seq = header->progressSeq;
+    header->progressWaiters++;
+    if (!reached()) {
+      futexWait(header->progressSeq, seq, -1);
+    }
+    header->progressWaiters--;
+  }
+}
+
+void mmapSharedBuffer::waitUntilPersisted(uint64_t ticket) {
+  if (header == nullptr || header->persistedOffset >= ticket) {
+    return;
+  }
+  //多个进程的请求合并为一次写出
+  raiseTo(header->flushRequest, ticket);
+  wakePersister();
+  waitForProgress(ticket, false);
+}
+
+void mmapSharedBuffer::waitForBufferPersist() {
+  if (header != nullptr) {
+    waitUntilPersisted(header->reserveOffset);
+  }
+}
+
+void mmapSharedBuffer::persistLoop() {
+  //持久化锁只能由一个进程持有，持有的进程退出或崩溃时由内核释放，其他进程定期尝试接替
+  while (!lockByte(persistLockByte, F_WRLCK, false)) {
+    std::unique_lock<std::mutex> lock(stop_mtx);
+    if (stop_cv.wait_for(lock, std::chrono::milliseconds(takeoverIntervalMs),
+                         [this] { return stopFlag.load(); })) {
+      return;
+    }
+  }
+  persistenceFileFd = ::open(header->persistencePath,
+                             O_RDWR | O_CREAT | O_DIRECT | O_CLOEXEC, 0645);
+  assert(persistenceFileFd >= 0);
+  header->persisterPid = getpid();
+  persisterFlag = true;
+
+  //前任持久化进程可能已写出部分页面，写出总是从已写出偏移量所在的页面开始，重复写出不影响结果
+  while (true) {
+    uint32_t seq = header->persistSeq;
+    if (persistStep()) {
+      continue;
+    }
+    if (stopFlag) {
+      break;
+    }
+    //请求写出的数据所在缓存块仍有未完成的拷贝，让出CPU后重试
+    if (header->flushRequest > header->persistedOffset) {
+      std::this_thread::yield();
+      continue;
+    }
+    int timeout = -1;
+    if (header->reserveOffset > header->persistedOffset) {
+      timeout = flushDeadlineMs > 0
+                    ? std::min<int>(flushDeadlineMs, pendingWaitMs)
+                    : pendingWaitMs;
+    }
+    //先标记休眠再检查计数，写入进程递增计数后读取到标记时一定会唤醒
+    header->persisterSleeping = 1;
+    if (header->persistSeq == seq) {
+      futexWait(header->persistSeq, seq, timeout);
+    }
+    header->persisterSleeping = 0;
+  }
+
+  header->persisterPid = 0;
+  persisterFlag = false;
+  close(persistenceFileFd);
+  persistenceFileFd = -1;
+  lockByte(persistLockByte, F_UNLCK, false);
+}
+
+bool mmapSharedBuffer::persistStep() {
+  uint64_t persisted = header->persistedOffset;
+  uint64_t blockIndex = persisted / blockSize;
+  uint64_t blockStart = blockIndex * blockSize;
+  uint64_t blockEnd = blockStart + blockSize;
+  //减去之前各轮的长度得到本轮的已提交长度
+  std::atomic_uint64_t &counter = committedOf(blockIndex % blockCount);
+  uint64_t roundBase = blockIndex / blockCount * blockSize;
+  uint64_t committed = counter.load(std::memory_order_acquire) - roundBase;
+  if (committed >= blockSize) {
+    writeRange(persisted, blockEnd);
+    advancePersisted(blockEnd);
+    return true;
+  }
+
+  uint64_t reserved = header->reserveOffset;
+  if (reserved <= persisted) {
+    return false;
+  }
+  if (pendingSince == std::chrono::steady_clock::time_point()) {
+    pendingSince = std::chrono::steady_clock::now();
+  }
+  if (reserved < blockEnd) {
+    //预留偏移量在两次读取之间没有变化时，已提交长度只包含之前的预留，可以与预留长度比较
+    committed = counter.load(std::memory_order_acquire) - roundBase;
+    if (header->reserveOffset != reserved) {
+      return false;
+    }
+  }
+  uint64_t reservedLen = std::min(reserved, blockEnd) - blockStart;
+  if (committed < reservedLen) {
+    return repairStalledBlock(blockIndex, committed);
+  }
+
+  //缓存块未满，请求写出、期限到期或停止时写出已提交的部分
+  bool expired = flushDeadlineMs > 0 &&
+                 std::chrono::steady_clock::now() - pendingSince >=
+                     std::chrono::milliseconds(flushDeadlineMs);
+  if (!stopFlag && !expired && header->flushRequest <= persisted) {
+    return false;
+  }
+  writeRange(persisted, reserved);
+  advancePersisted(reserved);
+  return true;
+}
+
+void mmapSharedBuffer::writeRange(uint64_t from, uint64_t to) {
+  //整页部分直接从映射写出，不足一页的末尾拷贝后补零写出，下一次写出时原地重写该页面
+  uint64_t fileBase = header->fileBase;
+  uint64_t alignedStart = from / systemPageSize * systemPageSize;
+  uint64_t alignedEnd = to / systemPageSize * systemPageSize;
+  if (alignedEnd > alignedStart) {
+    writeFully(persistenceFileFd, ring + alignedStart % ringSize,
+               alignedEnd - alignedStart, fileBase + alignedStart);
+  }
+  if (to > alignedEnd && tailPage != nullptr) {
+    memcpy(tailPage, ring + alignedEnd % ringSize, to - alignedEnd);
+    memset(tailPage + (to - alignedEnd), 0,
+           systemPageSize - (to - alignedEnd));
+    writeFully(persistenceFileFd, tailPage, systemPageSize,
+               fileBase + alignedEnd);
+  }
+}
+
+void mmapSharedBuffer::advancePersisted(uint64_t offset) {
+  header->persistedOffset = offset;
+  pendingSince = std::chrono::steady_clock::time_point();
+  stalledBlock = UINT64_MAX;
+  notifyProgress();
+}
+
+bool mmapSharedBuffer::repairStalledBlock(uint64_t blockIndex,
+                                          uint64_t committed) {
+  auto now = std::chrono::steady_clock::now();
+  if (blockIndex != stalledBlock || committed != stalledCommitted) {
+    stalledBlock = blockIndex;
+    stalledCommitted = committed;
+    stalledSince = now;
+    return false;
+  }
+  if (now - stalledSince < std::chrono::milliseconds(stallTimeoutMs)) {
+    return false;
+  }
+  stalledSince = now;
+
+  reclaimCrashedSlots();
+  uint64_t blockStart = blockIndex * blockSize;
+  uint64_t blockEnd = blockStart + blockSize;
+  if (blockStart >= header->crashBound) {
+    return false;
+  }
+
+  //依次读取预留偏移量、各槽位正在预留的线程数、槽位计数和缓存块的已提交长度，
+  //预留偏移量之前的预留都已记入槽位，之后的提交只会使补齐的长度偏小
+  size_t index = blockIndex % blockCount;
+  uint64_t reserved = header->reserveOffset;
+  for (size_t slot = 0; slot < mmapSharedHeader::maxProcesses; slot++) {
+    if (reservingOf(slot) != 0) {
+      return false;
+    }
+  }
+  //崩溃进程的槽位已结清，剩余的未提交长度都属于存活进程
+  uint64_t outstanding = 0;
+  for (size_t slot = 0; slot < mmapSharedHeader::maxProcesses; slot++) {
+    uint64_t slotCommitted = slotCommittedOf(slot, index);
+    outstanding += slotReservedOf(slot, index) - slotCommitted;
+  }
+  uint64_t roundBase = blockIndex / blockCount * blockSize;
+  committed = committedOf(index) - roundBase;
+  if (reserved < blockEnd && header->reserveOffset != reserved) {
+    return false;
+  }
+  uint64_t reservedLen = std::min(reserved, blockEnd) - blockStart;
+  if (committed + outstanding >= reservedLen) {
+    return false;
+  }
+  //缓存块中可能有崩溃进程未完成的拷贝，补齐已提交长度后按原有内容写出
+  committedOf(index).fetch_add(reservedLen - committed - outstanding);
+  stalledBlock = UINT64_MAX;
+  return true;
+}
@@ -0,0 +1,405 @@
+#ifndef __MMAPSHAREDBUFFER__
+#define __MMAPSHAREDBUFFER__
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief
+ * 多进程共享缓存的控制文件头部，与缓存环一同映射到所有连接的进程中
+ * @note
+ * 所有可变字段都是无锁的原子变量，可以在进程间共享。数据流偏移量从本次会话开始计算，
+ * 在缓存环中的位置为偏移量对缓存环长度取余，在持久化文件中的位置为fileBase加偏移量
+ */
+struct mmapSharedHeader {
+  //记录连接进程pid的槽位数量
+  static constexpr size_t maxProcesses = 64;
+  //记录持久化文件路径的长度上限
+  static constexpr size_t maxPathLength = 1024;
+
+  uint64_t magic;      //文件标识，用于识别有效的控制文件
+  uint64_t blockSize;  //单个缓存块大小
+  uint64_t blockCount; //缓存块数量
+  uint64_t fileBase;   //本次会话的数据流起点在持久化文件中的偏移量，按页面对齐
+  char persistencePath[maxPathLength]; //持久化文件路径，由第一个连接的进程决定
+
+  //已预留的数据流偏移量，写入进程在缓存空间足够时通过比较交换预留
+  alignas(64) std::atomic_uint64_t reserveOffset;
+  //已写入持久化文件的数据流偏移量，只由持久化进程修改
+  alignas(64) std::atomic_uint64_t persistedOffset;
+  //请求写出到的数据流偏移量，未满的缓存块也写出已提交的部分
+  std::atomic_uint64_t flushRequest;
+  //唤醒持久化进程的futex计数
+  std::atomic_uint32_t persistSeq;
+  //持久化进程是否在persistSeq上休眠，未休眠时不进行唤醒的系统调用
+  std::atomic_uint32_t persisterSleeping;
+  //持久化推进时递增的futex计数，等待缓存空间和等待写出的进程在其上休眠
+  std::atomic_uint32_t progressSeq;
+  //在progressSeq上休眠的线程数量
+  std::atomic_uint32_t progressWaiters;
+  //已崩溃进程预留的数据不超过该偏移量，之前停滞的缓存块可以补齐崩溃进程未提交的长度
+  std::atomic_uint64_t crashBound;
+  //当前持久化进程的pid，没有持久化进程时为0
+  std::atomic_int32_t persisterPid;
+  //已连接进程的pid，槽位的记录锁随进程退出释放，锁已释放而pid仍在的槽位属于崩溃的进程
+  std::atomic_int32_t processPids[maxProcesses];
+};
+
+/**
+ * @brief
+ * 多进程共享的缓存，多个进程通过同一个控制文件写入同一个持久化文件。
+ * 缓存环和读写偏移量位于控制文件的共享映射中，任意进程都可以写入，
+ * 所有进程通过控制文件上的记录锁选举出唯一的持久化进程写出数据，持久化进程退出或崩溃后由其他进程接替
+ * @note
+ * 写入与mmapBuffer相同，先预留数据流区间，拷贝后按缓存块累加已提交长度，
+ * 缓存块的已提交长度跨会话累加，不需要在写出后清零，持久化进程在任意位置崩溃后都可以由接替的进程继续。
+ * 预留区间不超出缓存环，每个进程在自己的槽位中按缓存块另外累加预留和提交的长度，
+ * 写入进程崩溃后只补齐无法归属于存活进程的部分。
+ * 预先fork的多个进程需要在fork之后分别调用initBuffer，不能共用父进程初始化的实例
+ */
+class mmapSharedBuffer {
+public:
+  //控制文件头部标识
+  static constexpr uint64_t headerMagic = 0x3248534250414d4dULL; // "MMAPBSH2"
+  //其他进程检查持久化进程是否退出的时间间隔(ms)
+  static constexpr unsigned takeoverIntervalMs = 50;
+  //缓存块的已提交长度停止增长多久后检查写入进程是否崩溃(ms)
+  static constexpr unsigned stallTimeoutMs = 1000;
+
+  /**
+   * @brief 获取缓存实例指针，若缓存实例名称不存在，则创建
+   * @param _bufferName 缓存实例在本进程中的名称
+   * @return 缓存实例指针
+   */
+  static std::shared_ptr<mmapSharedBuffer> &
+  getBufferInstance(const std::string &_bufferName) {
+    std::unique_lock<std::mutex> lock(instanceMapMutex);
+    const auto [ins, success] = bufferInstances.emplace(
+        _bufferName, std::shared_ptr<mmapSharedBuffer>(new mmapSharedBuffer));
+    ins->second->bufferName = _bufferName;
+    return ins->second;
+  };
+
+  /**
+   * @brief 从map中移除指定的缓存，断开与共享缓存的连接
+   * @param _bufferName 缓存实例在本进程中的名称
+   */
+  static void removeBufferInstance(const std::string &_bufferName) {
+    std::shared_ptr<mmapSharedBuffer> instance;
+    {
+      std::unique_lock<std::mutex> lock(instanceMapMutex);
+      auto it = bufferInstances.find(_bufferName);
+      if (it == bufferInstances.end()) {
+        return;
+      }
+      instance = std::move(it->second);
+      bufferInstances.erase(it);
+    }
+    //析构需要等待数据写出，在锁外进行
+  }
+
+  /**
+   * @brief
+   * 连接共享缓存。控制文件没有其他进程连接时，先将上次会话遗留在缓存环中的数据写入其持久化文件，
+   * 再按参数重新初始化；已有进程连接时沿用控制文件中的缓存块大小、数量和持久化文件
+   * @param _persistenceFilePath 持久化文件的路径
+   * @param _controlFilePath
+   * 控制文件的路径，使用同一个控制文件的进程共享缓存，放在/dev/shm下时不产生磁盘写回。
+   * 已有maxProcesses个进程连接时连接失败
+   * @param _blockCount 缓存块数量，至少为2
+   * @param _blockSize 单个缓存块大小，向上取整到页面大小
+   * @param _systemPageSize 系统页面大小(bytes)默认4k
+   */
+  void initBuffer(const std::string &_persistenceFilePath = std::string("data"),
+                  const std::string &_controlFilePath =
+                      std::string("shared_buffer"),
+                  size_t _blockCount = 8, size_t _blockSize = 4096 * 1024,
+                  unsigned int _systemPageSize = 4096);
+
+  /**
+   * @brief
+   * 设置未写出数据的最长停留时间，需在initBuffer之前调用。本进程成为持久化进程后生效，
+   * 超过该时间时写出未满缓存块中已提交的部分，0表示只在缓存块写满或请求写出时写出
+   * @param deadlineMs 最长停留时间(ms)
+   */
+  void setFlushDeadline(unsigned int deadlineMs);
+
+  /**
+   * @brief 检查是否已连接共享缓存
+   */
+  bool isValid() const;
+
+  /**
+   * @brief 本进程当前是否为持久化进程
+   */
+  bool isPersister() const;
+
+  /**
+   * @brief 写入共享缓存
+   * @param data 写入数据的指针
+   * @param len 写入长度
+   * @param noLose true：缓存区满时阻塞等待，false：缓存区满时丢弃
+   * @param ticket 不为空时写入持久化凭据，可传入waitUntilPersisted
+   * @return 数据写入缓存时返回true，被丢弃或未连接时返回false
+   * @note 超过单个缓存块大小的数据分段写入，各段之间可能插入其他写入的数据
+   */
+  bool try_append(const char *data, size_t len, bool noLose = false,
+                  uint64_t *ticket = nullptr);
+
+  /**
+   * @brief 阻塞等待持久化凭据之前的数据全部写入持久化文件，其他进程可以继续写入
+   * @param ticket 写入时获得的持久化凭据
+   */
+  void waitUntilPersisted(uint64_t ticket);
+
+  /**
+   * @brief 阻塞等待调用时所有进程已预留的数据全部写入持久化文件
+   */
+  void waitForBufferPersist();
+
+  /**
+   * @brief 获取已写入持久化文件的数据流偏移量，持久化凭据不超过该值的数据都已写出
+   */
+  uint64_t getPersistedOffset() const;
+
+  /**
+   * @brief 获取本进程因缓存写满而丢弃的数据长度
+   */
+  uint64_t getDroppedBytes() const;
+
+  /**
+   * @brief
+   * 析构时等待已预留的数据写出后断开连接，本进程是持久化进程时交给其他进程接替，
+   * 是最后一个连接的进程时将持久化文件截断到实际长度
+   */
+  ~mmapSharedBuffer();
+
+private:
+  //全局构造锁
+  static std::mutex instanceMapMutex;
+  //缓存实例映射表
+  static std::unordered_map<std::string, std::shared_ptr<mmapSharedBuffer>>
+      bufferInstances;
+
+  //控制文件中各个记录锁所在的字节，初始化锁互斥连接过程，连接锁判断是否为最后一个进程
+  static constexpr off_t initLockByte = 0;
+  static constexpr off_t attachLockByte = 1;
+  static constexpr off_t persistLockByte = 2;
+  //pid槽位的记录锁从该字节开始，每个槽位一个字节，由登记的进程持有
+  static constexpr off_t slotLockByte = 3;
+  //每个缓存块的已提交长度占用一个缓存行，避免不同缓存块的写入互相干扰
+  static constexpr size_t committedStride = 64;
+  //槽位中每个缓存块的预留和提交长度，两个跨会话累加的计数
+  static constexpr size_t slotCounterLen = 2 * sizeof(uint64_t);
+
+  //缓存实例名称
+  std::string bufferName;
+  //保护参数设置和初始化
+  std::mutex bufferMutex;
+  bool initFlag = false;
+  unsigned int flushDeadlineMs = 0;
+
+  size_t blockSize = 0;
+  size_t blockCount = 0;
+  size_t ringSize = 0; //缓存环长度，等于blockSize * blockCount
+  size_t systemPageSize = 4096;
+  size_t slotsOffset = 0; //各槽位的计数在控制文件中的起点
+  size_t slotStride = 0;  //每个槽位的计数占用的长度，按缓存行对齐
+  size_t headerLen = 0; //头部、已提交长度数组和槽位计数占用的长度，按页面对齐
+
+  int controlFd = -1;
+  char *mapBase = nullptr; //控制文件映射的头指针
+  size_t mapLen = 0;
+  mmapSharedHeader *header = nullptr;
+  char *ring = nullptr; //缓存环的头指针
+  //本进程的pid在头部中的槽位
+  int pidSlot = -1;
+  std::atomic_uint64_t droppedBytes = 0;
+
+  //等待成为持久化进程，并在成为持久化进程后写出数据的线程
+  std::thread persistThread;
+  std::mutex stop_mtx;
+  std::condition_variable stop_cv;
+  std::atomic_bool stopFlag = false;
+  std::atomic_bool persisterFlag = false;
+
+  //以下成员只由持久化线程访问
+  int persistenceFileFd = -1;
+  char *tailPage = nullptr; //写出不足一页的末尾时使用的页对齐暂存页
+  //持久化进程发现未写出数据的时间，用于判断写出期限，没有未写出的数据时为默认值
+  std::chrono::steady_clock::time_point pendingSince;
+  //停滞检查的状态，记录停滞的缓存块、已提交长度和开始停滞的时间
+  uint64_t stalledBlock = UINT64_MAX;
+  uint64_t stalledCommitted = 0;
+  std::chrono::steady_clock::time_point stalledSince;
+
+  /**
+   * @brief 受保护的默认构造函数，防止在程序的其他位置被构造
+   */
+  mmapSharedBuffer(){};
+
+  //删除复制构造函数
+  mmapSharedBuffer(const mmapSharedBuffer &) = delete;
+  //删除赋值运算符重载
+  mmapSharedBuffer &operator=(const mmapSharedBuffer &) = delete;
+
+  /**
+   * @brief 在控制文件的一个字节上加记录锁，进程退出或关闭文件时由内核释放
+   * @param byte 加锁的字节
+   * @param type F_RDLCK、F_WRLCK或F_UNLCK，已持有的锁原子地转换类型
+   * @param wait 为true时等待其他进程释放冲突的锁
+   * @return 加锁成功返回true
+   */
+  bool lockByte(off_t byte, short type, bool wait);
+
+  /**
+   * @brief 按缓存块大小和数量映射控制文件
+   * @param resize 为true时将控制文件扩展到映射长度，只由第一个连接的进程调用
+   * @return 控制文件长度不足或映射失败时返回false
+   */
+  bool mapControlFile(size_t _blockSize, size_t _blockCount, bool resize);
+
+  /**
+   * @brief 解除控制文件的映射
+   */
+  void unmapControlFile();
+
+  /**
+   * @brief 将上次会话未写出的数据写入其持久化文件，并截断到实际长度
+   * @note 崩溃时尚未提交的区间内容不确定
+   */
+  void recoverSession();
+
+  /**
+   * @brief
+   * 开始新的会话，持久化文件末尾不足一页的部分读入缓存环开头，之后的写出原地重写该页面
+   * @param _persistenceFilePath 本次会话的持久化文件
+   */
+  void startSession(const std::string &_persistenceFilePath);
+
+  /**
+   * @brief
+   * 在头部登记本进程的pid并持有槽位的记录锁，槽位中遗留崩溃进程的pid时提高崩溃边界
+   * @return 槽位已满时返回false
+   */
+  bool registerProcess();
+
+  /**
+   * @brief 回收锁已释放的槽位，即没有正常断开就退出的进程，并将崩溃边界提高到当前预留偏移量
+   */
+  void reclaimCrashedSlots();
+
+  /**
+   * @brief
+   * 结清崩溃进程在槽位中未提交的预留，之后这部分长度不再归属于任何存活进程，需持有槽位的记录锁
+   * @param slot 槽位编号
+   */
+  void settleSlot(size_t slot);
+
+  /**
+   * @brief 获取缓存块的已提交长度，跨会话累加
+   * @param index 缓存块在缓存环中的编号
+   */
+  std::atomic_uint64_t &committedOf(size_t index) const;
+
+  /**
+   * @brief 获取槽位中正在预留的线程数量，预留成功并记入槽位之后才减少
+   * @param slot 槽位编号
+   */
+  std::atomic_uint64_t &reservingOf(size_t slot) const;
+
+  /**
+   * @brief 获取槽位所属进程在缓存块中累计预留的长度，跨会话累加
+   * @param slot 槽位编号
+   * @param index 缓存块在缓存环中的编号
+   */
+  std::atomic_uint64_t &slotReservedOf(size_t slot, size_t index) const;
+
+  /**
+   * @brief 获取槽位所属进程在缓存块中累计提交的长度，跨会话累加
+   * @param slot 槽位编号
+   * @param index 缓存块在缓存环中的编号
+   */
+  std::atomic_uint64_t &slotCommittedOf(size_t slot, size_t index) const;
+
+  /**
+   * @brief 已释放的数据流偏移量，只有写出完整的缓存块才会释放，预留区间的末尾不能超过该值加缓存环长度
+   */
+  uint64_t releasedOffset() const;
+
+  /**
+   * @brief 拷贝数据到缓存环中的预留区间，在缓存环末尾回绕
+   */
+  void copyIn(uint64_t start, const char *data, size_t len);
+
+  /**
+   * @brief 按缓存块将预留区间记入本进程的槽位
+   */
+  void recordReserved(uint64_t start, size_t len);
+
+  /**
+   * @brief 按缓存块累加已提交长度，缓存块提交完整时唤醒持久化进程
+   */
+  void commitRange(uint64_t start, size_t len);
+
+  /**
+   * @brief 唤醒持久化进程，持久化进程未休眠时只进行一次原子加法
+   */
+  void wakePersister();
+
+  /**
+   * @brief 持久化推进后唤醒等待的线程
+   */
+  void notifyProgress();
+
+  /**
+   * @brief 等待持久化推进到满足条件，先让出CPU重试，之后在共享的futex上休眠
+   * @param target 数据流偏移量
+   * @param space 为true时等待target之前有足够的缓存空间，否则等待target之前的数据写出
+   */
+  void waitForProgress(uint64_t target, bool space);
+
+  /**
+   * @brief
+   * 持久化线程的入口，等待获取持久化锁成为持久化进程，之后写出数据直到实例析构
+   */
+  void persistLoop();
+
+  /**
+   * @brief
+   * 写出一次数据，缓存块提交完整时写出整个缓存块，请求写出、期限到期或停止时写出未满缓存块中已提交的部分
+   * @return 持久化有推进时返回true
+   */
+  bool persistStep();
+
+  /**
+   * @brief 写出同一缓存块中的数据流区间，从起点所在页面开始写出，末尾不足一页的部分补零
+   */
+  void writeRange(uint64_t from, uint64_t to);
+
+  /**
+   * @brief 推进已写出偏移量，之后等待空间的写入进程可以重用已写出的完整缓存块
+   */
+  void advancePersisted(uint64_t offset);
+
+  /**
+   * @brief
+   * 当前缓存块的已提交长度长时间不增长时，检查是否有写入进程崩溃，崩溃进程预留但未提交的长度计为已提交
+   * @param blockIndex 当前缓存块的数据流编号
+   * @param committed 当前缓存块在本轮中的已提交长度
+   * @return 补齐了已提交长度时返回true
+   * @note
+   * 未提交的长度减去存活进程槽位中未提交的长度即为崩溃进程的部分，
+   * 存活进程仍在拷贝的区间不会被补齐，有进程正在预留时推迟到下一次检查
+   */
+  bool repairStalledBlock(uint64_t blockIndex, uint64_t committed);
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "persistScheduler.h"
+#include <algorithm>
+#include <assert.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+//唤醒事件的来源编号，实例的来源编号从1开始
+constexpr uint64_t wakeSourceId = 0;
+//单次epoll_wait处理的事件数量上限
+constexpr int maxEvents = 64;
+
+//读取并清零eventfd的计数
+void drainEventFd(int fd) {
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) > 0) {
+  }
+}
+
+} // namespace
+
+std::mutex persistScheduler::configMutex;
+size_t persistScheduler::configuredWorkers = 0;
+size_t persistScheduler::configuredMaxInFlight = 0;
+
+persistScheduler &persistScheduler::getInstance() {
+  static persistScheduler *scheduler = [] {
+    std::unique_lock<std::mutex> lock(configMutex);
+    size_t workerCount = configuredWorkers;
+    if (workerCount == 0) {
+      //默认工作线程数量与磁盘并发能力相当，不随实例数量增长
+      workerCount =
+          std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 4);
+    }
+    size_t maxInFlight =
+        configuredMaxInFlight == 0 ? workerCount : configuredMaxInFlight;
+    configuredWorkers = workerCount;
+    return new persistScheduler(workerCount, maxInFlight);
+  }();
+  return *scheduler;
+}
+
+bool persistScheduler::configure(size_t workerCount, size_t maxInFlight) {
+  std::unique_lock<std::mutex> lock(configMutex);
+  if (configuredWorkers != 0) {
+    return false;
+  }
+  configuredWorkers = std::max<size_t>(workerCount, 1);
+  configuredMaxInFlight = maxInFlight;
+  return true;
+}
+
+persistScheduler::persistScheduler(size_t workerCount, size_t _maxInFlight)
+    : maxInFlight(std::max<size_t>(_maxInFlight, 1)) {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  assert(epollFd >= 0);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(wakeFd >= 0);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = wakeSourceId;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+  for (size_t i = 0; i < workerCount; i++) {
+    workers.emplace_back([this] { workerLoop(); });
+  }
+}
+
+uint64_t persistScheduler::addSource(int eventFd, int priority,
+                                     unsigned weight, stepFunction step) {
+  std::unique_lock<std::mutex> lock(mtx);
+  auto src = std::make_shared<source>();
+  src->id = nextSourceId++;
+  src->eventFd = eventFd;
+  src->priority = priority;
+  src->weight = std::max(weight, 1U);
+  src->step = std::move(step);
+  sources[src->id] = src;
+
+  //边沿触发，每次写入eventfd都会产生一个事件，计数由处理该实例的工作线程清零
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.u64 = src->id;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event);
+
+  //注册后先执行一次，由step计算初始的等待状态
+  markReady(*src);
+  workAvailable.notify_one();
+  wakePoller();
+  return src->id;
+}
+
+void persistScheduler::removeSource(uint64_t id) {
+  std::unique_lock<std::mutex> lock(mtx);
+  auto it = sources.find(id);
+  if (it == sources.end()) {
+    return;
+  }
+  std::shared_ptr<source> src = it->second;
+  src->removed = true;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, src->eventFd, nullptr);
+  cancelTimer(*src);
+  if (src->state == sourceState::queued) {
+    ready.erase(src->readyKey);
+    src->state = sourceState::idle;
+  }
+
+  //等待正在进行的处理结束，之后不会再调用step
+  sourceIdle.wait(lock, [&] {
+    return src->state != sourceState::running &&
+           src->state != sourceState::rerun;
+  });
+  sources.erase(id);
+}
+
+void persistScheduler::post(std::function<void()> job) {
+  std::unique_lock<std::mutex> lock(mtx);
+  jobs.push_back(std::move(job));
+  workAvailable.notify_one();
+  wakePoller();
+}
+
+size_t persistScheduler::getWorkerCount() const { return workers.size(); }
+
+void persistScheduler::markReady(source &src) {
+  if (src.removed) {
+    return;
+  }
+  if (src.state == sourceState::idle) {
+    cancelTimer(src);
+    src.readyKey = {-src.priority, readySequence++};
+    ready.emplace(src.readyKey, sources[src.id]);
+    src.state = sourceState::queued;
+  } else if (src.state == sourceState::running) {
+    src.state = sourceState::rerun;
+  }
+}
+
+void persistScheduler::cancelTimer(source &src) {
+  if (src.hasTimer) {
+    timers.erase(src.timer);
+    src.hasTimer = false;
+  }
+}
+
+void persistScheduler::wakePoller() {
+  if (polling) {
+    uint64_t count = 1;
+    write(wakeFd, &count, sizeof(count));
+  }
+}
+
+void persistScheduler::workerLoop() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (true) {
+    //到期的定时器将对应实例加入就绪队列
+    auto now = clock::now();
+    while (!timers.empty() && timers.begin()->first <= now) {
+      auto it = sources.find(timers.begin()->second);
+      timers.erase(timers.begin());
+      if (it != sources.end()) {
+        it->second->hasTimer = false;
+        markReady(*it->second);
+      }
+    }
+
+    //后台任务优先执行，它们通常是为持久化工作做准备
+    if (!jobs.empty()) {
+      std::function<void()> job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+      continue;
+    }
+
+    //取出优先级最高的就绪实例，连续执行至多weight步，同时执行的数量不超过maxInFlight
+    if (!ready.empty() && inFlight < maxInFlight) {
+      std::shared_ptr<source> src = ready.begin()->second;
+      ready.erase(ready.begin());
+      src->state = sourceState::running;
+      inFlight++;
+      lock.unlock();
+
+      drainEventFd(src->eventFd);
+      int timeout = 0;
+      for (unsigned i = 0; i < src->weight && timeout == 0; i++) {
+        timeout = src->step();
+      }
+
+      lock.lock();
+      inFlight--;
+      bool rerun = src->state == sourceState::rerun;
+      src->state = sourceState::idle;
+      if (src->removed) {
+        sourceIdle.notify_all();
+      } else if (timeout == 0 || rerun) {
+        //仍有工作时排到同一优先级的队尾，让其他实例得到处理
+        markReady(*src);
+      } else if (timeout > 0) {
+        src->timer = timers.emplace(
+            clock::now() + std::chrono::milliseconds(timeout), src->id);
+        src->hasTimer = true;
+        if (src->timer == timers.begin()) {
+          wakePoller();
+        }
+      }
+      workAvailable.notify_one();
+      continue;
+    }
+
+    //只有一个线程等待epoll事件，其余线程等待就绪队列
+    if (!polling) {
+      int waitMs = -1;
+      if (!timers.empty()) {
+        auto remain = std::chrono::ceil<std::chrono::milliseconds>(
+            timers.begin()->first - clock::now());
+        waitMs = std::max<int>(remain.count(), 0);
+      }
+      polling = true;
+      lock.unlock();
+      epoll_event events[maxEvents];
+      int count = epoll_wait(epollFd, events, maxEvents, waitMs);
+      lock.lock();
+      polling = false;
+
+      for (int i = 0; i < count; i++) {
+        uint64_t id = events[i].data.u64;
+        if (id == wakeSourceId) {
+          drainEventFd(wakeFd);
+          continue;
+        }
+        auto it = sources.find(id);
+        if (it != sources.end()) {
+          markReady(*it->second);
+        }
+      }
+      workAvailable.notify_all();
+      continue;
+    }
+
+    workAvailable.wait(lock);
+  }
+}
@@ -0,0 +1,164 @@
+#ifndef __PERSISTSCHEDULER__
+#define __PERSISTSCHEDULER__
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief
+ * 进程内所有缓存实例共享的持久化调度器，由固定数量的工作线程轮流处理各个实例的持久化工作，
+ * 线程数量不随实例数量增长
+ * @note
+ * 每个实例注册一个eventfd，工作线程通过epoll等待事件。同一实例同时只会被一个工作线程处理，
+ * 就绪的实例按优先级从高到低、同一优先级内按就绪顺序处理
+ */
+class persistScheduler {
+public:
+  /**
+   * @brief 持久化工作的执行函数
+   * @return 还有待处理的工作时返回0，空闲时返回-1，需要在一段时间后再次执行时返回毫秒数
+   */
+  using stepFunction = std::function<int()>;
+
+  /**
+   * @brief 获取调度器实例，第一次调用时创建工作线程
+   * @note 调度器在进程退出前不会销毁，避免缓存实例在静态析构阶段访问已销毁的调度器
+   */
+  static persistScheduler &getInstance();
+
+  /**
+   * @brief 设置工作线程数量和同时执行的持久化工作数量上限，需在第一个缓存实例初始化之前调用
+   * @param workerCount 工作线程数量，至少为1
+   * @param maxInFlight 同时执行的持久化工作数量上限，为0时等于工作线程数量
+   * @return 调度器已经创建时不生效，返回false
+   */
+  static bool configure(size_t workerCount, size_t maxInFlight = 0);
+
+  //删除复制构造函数
+  persistScheduler(const persistScheduler &) = delete;
+  //删除赋值运算符重载
+  persistScheduler &operator=(const persistScheduler &) = delete;
+
+  /**
+   * @brief 注册一个持久化工作来源，注册后立即执行一次step
+   * @param eventFd 有新工作时变为可读的eventfd，由调度器读取清零
+   * @param priority 优先级，数值越大越先被处理
+   * @param weight 每次被调度时最多连续执行step的次数，至少为1
+   * @param step 执行一步持久化工作
+   * @return 返回来源编号，用于注销
+   */
+  uint64_t addSource(int eventFd, int priority, unsigned weight,
+                     stepFunction step);
+
+  /**
+   * @brief 注销持久化工作来源，正在执行时等待其结束，返回后step不会再被调用
+   * @param id addSource返回的来源编号
+   * @note 不能在工作线程中调用
+   */
+  void removeSource(uint64_t id);
+
+  /**
+   * @brief 在工作线程中执行一个后台任务，例如创建文件和关闭文件，任务先于持久化工作执行
+   */
+  void post(std::function<void()> job);
+
+  /**
+   * @brief 获取工作线程数量
+   */
+  size_t getWorkerCount() const;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief 调度状态
+   */
+  enum class sourceState {
+    idle,    //等待事件
+    queued,  //位于就绪队列中
+    running, //正在被工作线程处理
+    rerun    //处理期间收到新事件，结束后重新排队
+  };
+
+  struct source {
+    uint64_t id = 0;
+    int eventFd = -1;
+    int priority = 0;
+    unsigned weight = 1;
+    stepFunction step;
+    sourceState state = sourceState::idle;
+    bool removed = false;
+    //就绪队列中的位置
+    std::pair<int, uint64_t> readyKey;
+    //定时器的触发时间，没有定时器时为空
+    bool hasTimer = false;
+    std::multimap<clock::time_point, uint64_t>::iterator timer;
+  };
+
+  /**
+   * @brief 受保护的构造函数，只能通过getInstance获取实例
+   */
+  persistScheduler(size_t workerCount, size_t maxInFlight);
+
+  /**
+   * @brief 工作线程的执行逻辑
+   */
+  void workerLoop();
+
+  /**
+   * @brief 将来源加入就绪队列，正在处理时标记为需要重新处理，需持有mtx
+   */
+  void markReady(source &src);
+
+  /**
+   * @brief 取消来源的定时器，需持有mtx
+   */
+  void cancelTimer(source &src);
+
+  /**
+   * @brief 唤醒正在epoll_wait中等待的工作线程，需持有mtx
+   */
+  void wakePoller();
+
+  static std::mutex configMutex;
+  static size_t configuredWorkers;
+  static size_t configuredMaxInFlight;
+
+  std::mutex mtx;
+  //就绪队列或后台任务非空时通知等待中的工作线程
+  std::condition_variable workAvailable;
+  //来源处理结束时通知等待注销的线程
+  std::condition_variable sourceIdle;
+
+  int epollFd = -1;
+  //唤醒正在epoll_wait的工作线程
+  int wakeFd = -1;
+  //是否有工作线程正在epoll_wait
+  bool polling = false;
+
+  std::unordered_map<uint64_t, std::shared_ptr<source>> sources;
+  //就绪队列，键为(-优先级, 就绪序号)
+  std::map<std::pair<int, uint64_t>, std::shared_ptr<source>> ready;
+  //定时器，触发时间到来源编号的映射
+  std::multimap<clock::time_point, uint64_t> timers;
+  //后台任务队列
+  std::deque<std::function<void()>> jobs;
+
+  uint64_t nextSourceId = 1;
+  uint64_t readySequence = 0;
+  //正在执行的持久化工作数量
+  size_t inFlight = 0;
+  size_t maxInFlight = 1;
+  std::vector<std::thread> workers;
+};
+
+#endif
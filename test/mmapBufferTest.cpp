@@ -1,9 +1,9 @@
 #include "../code/mmapBuffer.h"
+#include "../code/mmapLogger.h"
 #include "chrono"
 #include <ctime>
 #include <iostream>
 #include <sstream>
-#include <sys/time.h>
 #include <thread>
 #include <vector>
 
@@ -11,29 +11,6 @@
 #define THREAD_COUNT 5
 #define LOG_SIZE 103
 
-time_t rawtime;
-time_t last_sec;
-time_t last_min;
-struct timeval curTime;
-char timeBuf[50];
-
-void updateTime() {
-  gettimeofday(&curTime, NULL);
-  if (last_sec == curTime.tv_sec) {
-    //同一秒内的日志
-  } else if (curTime.tv_sec / 60 == last_min) {
-    //同一分钟的日志
-    auto sec = curTime.tv_sec % 60;
-    timeBuf[17] = sec / 10 + '0';
-    timeBuf[18] = sec % 10 + '0';
-  } else {
-    time(&rawtime);
-    std::strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S",
-                  std::localtime(&rawtime));
-  }
-  last_sec = curTime.tv_sec;
-}
-
 void writeToBuffer(char *data, size_t len, int index) {
   auto ins = mmapBuffer::getBufferInstance("TEST");
   std::time_t time;
@@ -44,8 +21,8 @@ void writeToBuffer(char *data, size_t len, int index) {
   memcpy(data_ + 19, tag.str().c_str(), 5);
   data_[LOG_SIZE - 1] = '\n';
   for (; i < LOGS_PER_THREAD; i++) {
-    updateTime();
-    memcpy(data_, timeBuf, 19);
+    //每个线程缓存当前秒的时间文本
+    logClock::formatNow(data_);
     ins->try_append(data_, len, true);
   }
   std::cout << "worker : " << index << "finished!\n";
@@ -0,0 +1,161 @@
+#include "../code/mmapBuffer.h"
+#include "../code/mmapReader.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define PAGE_SIZE 4096
+#define RECORD_COUNT 50000
+#define BUFFER_BLOCK_SIZE (64 * 1024)
+
+static const char *dataPath = "codec_test_data";
+static const char *bufferPath = "codec_test_buffer";
+
+static size_t failures = 0;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cout << "check failed: " << what << "\n";
+    failures++;
+  }
+}
+
+//将多段数据依次编码为压缩帧，帧之间按页面对齐
+static std::string encodeAll(const mmapCodec &codec,
+                             const std::vector<std::string> &inputs) {
+  std::string frames;
+  for (const std::string &input : inputs) {
+    std::string frame(mmapCodec::frameBound(codec, input.size(), PAGE_SIZE),
+                      '\0');
+    frame.resize(mmapCodec::encodeFrame(codec, input.data(), input.size(),
+                                        frame.data(), PAGE_SIZE));
+    frames += frame;
+  }
+  return frames;
+}
+
+static mmapFrameHeader readHeader(const std::string &frames, size_t pos) {
+  mmapFrameHeader header;
+  memcpy(&header, frames.data() + pos, sizeof(header));
+  return header;
+}
+
+static void writeHeader(std::string &frames, size_t pos,
+                        const mmapFrameHeader &header) {
+  memcpy(frames.data() + pos, &header, sizeof(header));
+}
+
+//修改第二个帧的头部后解码应失败，之前的帧仍然输出
+static void checkRejected(const std::string &frames, size_t secondFrame,
+                          const std::string &firstInput,
+                          void (*corrupt)(mmapFrameHeader &),
+                          const char *what) {
+  std::string damaged = frames;
+  mmapFrameHeader header = readHeader(damaged, secondFrame);
+  corrupt(header);
+  writeHeader(damaged, secondFrame, header);
+  std::string out;
+  bool decoded = mmapCodec::decodeFrames(damaged.data(), damaged.size(), out,
+                                         PAGE_SIZE);
+  check(!decoded, what);
+  check(out == firstInput, "frames before the damaged frame are kept");
+}
+
+static void testFrames() {
+  lzCodec codec;
+  //可压缩的文本、不可压缩的数据(以未压缩帧存储)和跨越多个页面的大块数据
+  std::string text;
+  for (int i = 0; i < 2000; i++) {
+    text += "2024-01-01 12:00:00 [info] request " + std::to_string(i) + "\n";
+  }
+  std::string noise(10000, '\0');
+  uint32_t seed = 12345;
+  for (char &c : noise) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 16);
+  }
+  std::string large(1 << 20, 'a');
+  std::vector<std::string> inputs = {text, noise, large, "x"};
+
+  std::string frames = encodeAll(codec, inputs);
+  check(mmapCodec::isFramed(frames.data(), frames.size()),
+        "encoded data starts with a frame");
+  check(frames.size() % PAGE_SIZE == 0, "frames are page aligned");
+  std::string out;
+  check(mmapCodec::decodeFrames(frames.data(), frames.size(), out, PAGE_SIZE),
+        "valid frames decode");
+  check(out == text + noise + large + "x", "decoded data matches input");
+
+  size_t secondFrame = encodeAll(codec, {text}).size();
+  check(readHeader(frames, 0).compressedLen < text.size(),
+        "text is compressed");
+  check(readHeader(frames, secondFrame).codecId == mmapCodec::storedCodecId,
+        "incompressible data is stored");
+
+  //第二个帧改为可压缩的文本，用于检查压缩帧的损坏
+  frames = encodeAll(codec, {text, text});
+  checkRejected(
+      frames, secondFrame, text, [](mmapFrameHeader &h) { h.magic ^= 1; },
+      "bad magic is rejected");
+  checkRejected(
+      frames, secondFrame, text, [](mmapFrameHeader &h) { h.codecId = 99; },
+      "unknown codec is rejected");
+  checkRejected(
+      frames, secondFrame, text,
+      [](mmapFrameHeader &h) { h.compressedLen = 1ULL << 40; },
+      "compressed length past the end is rejected");
+  checkRejected(
+      frames, secondFrame, text,
+      [](mmapFrameHeader &h) { h.rawLen = 1ULL << 50; },
+      "raw length beyond the bound is rejected");
+  checkRejected(
+      frames, secondFrame, text, [](mmapFrameHeader &h) { h.rawLen++; },
+      "raw length mismatch is rejected");
+  checkRejected(
+      frames, secondFrame, text, [](mmapFrameHeader &h) { h.rawLen--; },
+      "short raw length is rejected");
+}
+
+//压缩并分帧写入的文件通过mmapReader解码后逐条读回
+static void testBuffer() {
+  remove(dataPath);
+  {
+    auto &ins = mmapBuffer::getBufferInstance("CODEC");
+    ins->enableRecordFraming();
+    ins->setCodec(std::make_shared<lzCodec>());
+    ins->initBuffer(dataPath, bufferPath, 4, 2, BUFFER_BLOCK_SIZE);
+    char line[64];
+    for (int i = 0; i < RECORD_COUNT; i++) {
+      int len = snprintf(line, sizeof(line), "record %d", i);
+      ins->try_append(line, len, true);
+      if (i % 10000 == 0) {
+        ins->waitForBufferPersist();
+      }
+    }
+    check(ins->getPersistenceFileLen() < ins->getActualDataLen(),
+          "file is smaller than the data");
+    mmapBuffer::removeBufferInstance("CODEC");
+  }
+
+  mmapReader reader(dataPath);
+  check(reader.isValid() && reader.isCompressed(), "reader sees frames");
+  int count = 0;
+  bool ordered = true;
+  char line[64];
+  for (std::string_view record : reader) {
+    int len = snprintf(line, sizeof(line), "record %d", count);
+    ordered = ordered && record == std::string_view(line, len);
+    count++;
+  }
+  check(count == RECORD_COUNT && ordered, "all records read back in order");
+  remove(dataPath);
+}
+
+int main() {
+  testFrames();
+  testBuffer();
+  std::cout << (failures == 0 ? "PASSED\n" : "FAILED\n");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#include "../code/mmapBuffer.h"
+#include "../code/mmapReader.h"
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#define RECORDS_PER_RUN 20000
+#define FLUSH_INTERVAL 777
+#define MAX_RECORD_SIZE 3000
+#define BUFFER_BLOCK_SIZE (16 * 1024)
+
+//持久化文件和缓存块文件的基础路径
+static const char *dataPath = "reader_test_data";
+static const char *bufferPath = "reader_test_buffer";
+
+//第index条记录的内容，长度随序号变化，包含零字节和换行，读取只能依赖长度头部
+static std::string makeRecord(int index) {
+  std::string record(1 + (index * 7919) % MAX_RECORD_SIZE, '\0');
+  for (size_t i = 0; i < record.size(); i++) {
+    record[i] = static_cast<char>((index + i * 31) & 0xff);
+  }
+  return record;
+}
+
+//写入一批记录，期间多次强制持久化，缓存块末尾和强制持久化的尾部都会留下填充
+static void writeRun(const std::string &name, int first) {
+  auto &ins = mmapBuffer::getBufferInstance(name);
+  ins->enableRecordFraming();
+  ins->initBuffer(dataPath, bufferPath, 4, 2, BUFFER_BLOCK_SIZE);
+  for (int i = first; i < first + RECORDS_PER_RUN; i++) {
+    std::string record = makeRecord(i);
+    ins->try_append(record.data(), record.size(), true);
+    if (i % FLUSH_INTERVAL == 0) {
+      ins->waitForBufferPersist();
+    }
+  }
+  mmapBuffer::removeBufferInstance(name);
+}
+
+int main() {
+  remove(dataPath);
+  //第二次初始化时追加到第一次写入的数据之后
+  writeRun("FIRST", 0);
+  writeRun("SECOND", RECORDS_PER_RUN);
+
+  mmapReader reader(dataPath);
+  if (!reader.isValid()) {
+    std::cout << "failed to map " << dataPath << "\n";
+    std::cout << "FAILED\n";
+    return 1;
+  }
+  size_t mismatched = 0;
+  int count = 0;
+  std::string_view record;
+  while (reader.next(record)) {
+    mismatched += record != makeRecord(count);
+    count++;
+  }
+
+  //迭代器从起点重新读取，结果与逐条读取相同
+  int iterated = 0;
+  for (std::string_view item : reader) {
+    mismatched += item != makeRecord(iterated);
+    iterated++;
+  }
+  remove(dataPath);
+
+  std::cout << "records read: " << count << ", iterated: " << iterated
+            << ", mismatched: " << mismatched << "\n";
+  if (count != RECORDS_PER_RUN * 2 || iterated != count || mismatched > 0) {
+    std::cout << "FAILED\n";
+    return 1;
+  }
+  std::cout << "PASSED\n";
+  return 0;
+}
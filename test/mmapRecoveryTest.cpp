@@ -0,0 +1,148 @@
+#include "../code/mmapBuffer.h"
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define THREAD_COUNT 4
+#define LOGS_PER_THREAD 30000
+#define LOGS_BEFORE_CRASH 1000
+#define LOGS_AFTER_RECOVERY 1000
+#define MAX_BLOCK_COUNT 8
+#define BUFFER_BLOCK_SIZE (64 * 1024)
+
+//持久化文件和缓存块文件的基础路径
+static const char *dataPath = "recovery_test_data";
+static const char *bufferPath = "recovery_test_buffer";
+
+//每条记录一行："阶段 线程 序号 填充\n"，填充长度随序号变化
+static int formatLine(char *line, int stage, int thread, int index) {
+  return snprintf(line, 128, "%d %d %d %.*s\n", stage, thread, index,
+                  index % 40, "........................................");
+}
+
+static void openBuffer(const std::string &name, bool compressed) {
+  auto &ins = mmapBuffer::getBufferInstance(name);
+  if (compressed) {
+    ins->setCodec(std::make_shared<lzCodec>());
+  }
+  ins->initBuffer(dataPath, bufferPath, MAX_BLOCK_COUNT, 2, BUFFER_BLOCK_SIZE);
+}
+
+static void writeLines(const std::string &name, int stage, int threadCount,
+                       int count) {
+  auto &ins = mmapBuffer::getBufferInstance(name);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threadCount; t++) {
+    threads.emplace_back([&ins, stage, t, count] {
+      char line[128];
+      for (int i = 0; i < count; i++) {
+        int len = formatLine(line, stage, t, i);
+        ins->try_append(line, len, true);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+//检查各阶段的每条记录都完整出现。崩溃时正在写出的缓存块可能被再次恢复，因此允许重复
+static size_t countMissing(const std::string &text) {
+  std::set<std::string> lines;
+  std::stringstream content(text);
+  std::string line;
+  while (std::getline(content, line)) {
+    //页面对齐的补零只出现在记录之间
+    size_t start = line.find_first_not_of('\0');
+    if (start != std::string::npos) {
+      lines.insert(line.substr(start) + "\n");
+    }
+  }
+  size_t missing = 0;
+  char expected[128];
+  for (int i = 0; i < LOGS_BEFORE_CRASH; i++) {
+    formatLine(expected, 0, 0, i);
+    missing += lines.count(expected) == 0;
+  }
+  for (int t = 0; t < THREAD_COUNT; t++) {
+    for (int i = 0; i < LOGS_PER_THREAD; i++) {
+      formatLine(expected, 1, t, i);
+      missing += lines.count(expected) == 0;
+    }
+  }
+  for (int i = 0; i < LOGS_AFTER_RECOVERY; i++) {
+    formatLine(expected, 2, 0, i);
+    missing += lines.count(expected) == 0;
+  }
+  return missing;
+}
+
+//每个阶段在单独的进程中运行，持久化调度器的线程不会被fork复制
+static int runStage(bool compressed, int stage) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    const std::string name = "STAGE" + std::to_string(stage);
+    openBuffer(name, compressed);
+    if (stage == 1) {
+      //写入后被杀死，缓存块中尚未写出的数据只保留在缓存块文件中
+      writeLines(name, stage, THREAD_COUNT, LOGS_PER_THREAD);
+      kill(getpid(), SIGKILL);
+    }
+    writeLines(name, stage, 1,
+               stage == 0 ? LOGS_BEFORE_CRASH : LOGS_AFTER_RECOVERY);
+    mmapBuffer::removeBufferInstance(name);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return status;
+}
+
+static bool runCase(bool compressed) {
+  remove(dataPath);
+
+  //正常关闭，之后被杀死，最后重新初始化时恢复遗留的缓存块，各阶段的数据依次追加
+  if (runStage(compressed, 0) != 0 || !WIFSIGNALED(runStage(compressed, 1)) ||
+      runStage(compressed, 2) != 0) {
+    std::cout << "unexpected process exit status\n";
+    return false;
+  }
+
+  std::ifstream file(dataPath, std::ios::binary);
+  std::stringstream content;
+  content << file.rdbuf();
+  std::string text = content.str();
+  if (mmapCodec::isFramed(text.data(), text.size())) {
+    std::string decoded;
+    if (!mmapCodec::decodeFrames(text.data(), text.size(), decoded)) {
+      std::cout << "failed to decode frames\n";
+      return false;
+    }
+    text = std::move(decoded);
+  }
+  remove(dataPath);
+
+  //恢复完成后遗留的缓存块文件已被删除
+  struct stat st;
+  bool leftover = stat((std::string(bufferPath) + "0").c_str(), &st) == 0;
+  size_t missing = countMissing(text);
+  std::cout << (compressed ? "compressed" : "plain")
+            << " missing records: " << missing
+            << ", leftover block files: " << leftover << "\n";
+  return missing == 0 && !leftover;
+}
+
+int main() {
+  bool passed = runCase(false) && runCase(true);
+  std::cout << (passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include "../code/mmapBuffer.h"
+#include "../code/mmapReader.h"
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define RECORD_COUNT 100000
+#define MAX_FILE_BYTES (64 * 1024)
+#define BUFFER_BLOCK_SIZE (16 * 1024)
+
+namespace fs = std::filesystem;
+
+//轮转文件所在目录，每个用例开始前清空
+static const char *fileDir = "rotation_test_files";
+
+//每个轮转文件开头的记录
+static const std::vector<std::string> prologue = {"prologue", "format 1"};
+
+static std::string makeRecord(int index) {
+  return "record " + std::to_string(index);
+}
+
+//按轮转策略写入分帧记录，关闭后返回目录中的文件数量
+static size_t writeRotated(const std::string &name, const std::string &dataPath,
+                           const std::string &namePattern) {
+  fs::remove_all(fileDir);
+  fs::create_directory(fileDir);
+  auto &ins = mmapBuffer::getBufferInstance(name);
+  ins->enableRecordFraming();
+  mmapBuffer::rotationPolicy policy;
+  policy.maxBytes = MAX_FILE_BYTES;
+  policy.namePattern = namePattern;
+  ins->setRotationPolicy(policy);
+  ins->setRotationPrologue([] { return prologue; });
+  ins->initBuffer(dataPath.c_str(), "rotation_test_buffer", 4, 2,
+                  BUFFER_BLOCK_SIZE);
+  for (int i = 0; i < RECORD_COUNT; i++) {
+    std::string record = makeRecord(i);
+    ins->try_append(record.data(), record.size(), true);
+  }
+  mmapBuffer::removeBufferInstance(name);
+
+  //未使用的后继文件在关闭时删除，目录中只剩轮转文件
+  size_t files = 0;
+  for (auto it = fs::directory_iterator(fileDir);
+       it != fs::directory_iterator(); ++it) {
+    files++;
+  }
+  return files;
+}
+
+//依次读取各文件，轮转生成的文件以开头记录起始，其余记录按序号连续
+static bool readRotated(const std::vector<std::string> &paths) {
+  int next = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    mmapReader reader(paths[i]);
+    if (!reader.isValid()) {
+      std::cout << "failed to map " << paths[i] << "\n";
+      return false;
+    }
+    std::string_view record;
+    for (size_t j = 0; i > 0 && j < prologue.size(); j++) {
+      if (!reader.next(record) || record != prologue[j]) {
+        std::cout << "missing prologue in " << paths[i] << "\n";
+        return false;
+      }
+    }
+    while (reader.next(record)) {
+      if (record != makeRecord(next)) {
+        std::cout << "unexpected record in " << paths[i] << "\n";
+        return false;
+      }
+      next++;
+    }
+  }
+  std::cout << "files: " << paths.size() << ", records: " << next << "\n";
+  return next == RECORD_COUNT;
+}
+
+//文件名格式为空时轮转文件为持久化文件路径后跟.{n}
+static bool runDefaultNames() {
+  std::string dataPath = std::string(fileDir) + "/data";
+  size_t files = writeRotated("DEFAULT", dataPath, "");
+  std::vector<std::string> paths = {dataPath};
+  for (size_t n = 1; n < files; n++) {
+    paths.push_back(dataPath + "." + std::to_string(n));
+  }
+  for (const std::string &path : paths) {
+    if (!fs::exists(path)) {
+      std::cout << "missing " << path << "\n";
+      return false;
+    }
+  }
+  return files > 2 && readRotated(paths);
+}
+
+//文件名格式中的{n}替换为轮转序号，其余部分按strftime展开
+static bool runPatternNames() {
+  std::string dataPath = std::string(fileDir) + "/first.log";
+  std::string pattern = std::string(fileDir) + "/part-{n}-%Y.log";
+  size_t files = writeRotated("PATTERN", dataPath, pattern);
+  time_t now = time(nullptr);
+  struct tm localTime = {};
+  localtime_r(&now, &localTime);
+  std::string year = std::to_string(localTime.tm_year + 1900);
+  std::vector<std::string> paths = {dataPath};
+  for (size_t n = 1; n < files; n++) {
+    paths.push_back(std::string(fileDir) + "/part-" + std::to_string(n) + "-" +
+                    year + ".log");
+  }
+  for (const std::string &path : paths) {
+    if (!fs::exists(path)) {
+      std::cout << "missing " << path << "\n";
+      return false;
+    }
+  }
+  return files > 2 && readRotated(paths);
+}
+
+int main() {
+  bool passed = runDefaultNames() && runPatternNames();
+  fs::remove_all(fileDir);
+  std::cout << (passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include "../code/mmapSharedBuffer.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define PROCESS_COUNT 6
+#define THREAD_COUNT 3
+#define LOGS_PER_THREAD 20000
+#define BLOCK_COUNT 4
+#define BLOCK_SIZE (64 * 1024)
+
+//持久化文件和控制文件
+static const char *dataPath = "shared_test_data";
+static const char *controlPath = "shared_test_control";
+//被暂停的进程，模拟仍在拷贝的慢速写入进程
+static const int stoppedProcess = 2;
+//被父进程杀死的写入进程
+static const int killedProcess = 1;
+//最先连接的进程成为持久化进程，写入一半时自杀
+static const int persisterProcess = 0;
+
+//每条记录一行："进程 线程 序号 填充\n"，填充长度随序号变化
+static int formatLine(char *line, int process, int thread, int index) {
+  return snprintf(line, 128, "%d %d %d %.*s\n", process, thread, index,
+                  index % 40, "........................................");
+}
+
+//子进程写入
+static void writeProcess(int process) {
+  auto &ins = mmapSharedBuffer::getBufferInstance("TEST");
+  ins->initBuffer(dataPath, controlPath, BLOCK_COUNT, BLOCK_SIZE);
+  if (!ins->isValid()) {
+    _exit(2);
+  }
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREAD_COUNT; t++) {
+    threads.emplace_back([&ins, process, t] {
+      char line[128];
+      for (int i = 0; i < LOGS_PER_THREAD; i++) {
+        int len = formatLine(line, process, t, i);
+        ins->try_append(line, len, true);
+        if (process == persisterProcess && t == 0 &&
+            i == LOGS_PER_THREAD / 2 && ins->isPersister()) {
+          kill(getpid(), SIGKILL);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  mmapSharedBuffer::removeBufferInstance("TEST");
+  _exit(0);
+}
+
+int main() {
+  remove(dataPath);
+  remove(controlPath);
+  std::vector<pid_t> pids;
+  for (int p = 0; p < PROCESS_COUNT; p++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      writeProcess(p);
+    }
+    pids.push_back(pid);
+    if (p == persisterProcess) {
+      //等待第一个进程获得持久化锁
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+  }
+
+  //写入过程中杀死一个写入进程，并暂停另一个超过停滞检查的时间
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  kill(pids[killedProcess], SIGKILL);
+  kill(pids[stoppedProcess], SIGSTOP);
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(mmapSharedBuffer::stallTimeoutMs * 3));
+  kill(pids[stoppedProcess], SIGCONT);
+
+  std::set<int> killed;
+  for (int p = 0; p < PROCESS_COUNT; p++) {
+    int status = 0;
+    waitpid(pids[p], &status, 0);
+    if (WIFSIGNALED(status)) {
+      killed.insert(p);
+    } else if (WEXITSTATUS(status) != 0) {
+      std::cout << "process " << p << " failed to attach\n";
+      return 1;
+    }
+  }
+
+  //崩溃进程未完成的区间按缓存环中的原有内容写出，只检查存活进程的每条记录都完整地出现
+  std::ifstream file(dataPath, std::ios::binary);
+  std::stringstream content;
+  content << file.rdbuf();
+  std::string text = content.str();
+  std::set<std::string> lines;
+  std::string line;
+  while (std::getline(content, line)) {
+    lines.insert(line + "\n");
+  }
+  size_t missing = 0;
+  char expected[128];
+  for (int p = 0; p < PROCESS_COUNT; p++) {
+    if (killed.count(p) > 0) {
+      continue;
+    }
+    for (int t = 0; t < THREAD_COUNT; t++) {
+      for (int i = 0; i < LOGS_PER_THREAD; i++) {
+        formatLine(expected, p, t, i);
+        //旧内容不一定以换行结尾，可能与之后的记录连成一行，逐行查找失败时在全文中查找
+        missing += lines.count(expected) == 0 &&
+                   text.find(expected) == std::string::npos;
+      }
+    }
+  }
+  remove(dataPath);
+  remove(controlPath);
+
+  std::cout << "killed processes: " << killed.size() << "\n";
+  std::cout << "missing records: " << missing << "\n";
+  if (killed.count(persisterProcess) == 0 || killed.count(killedProcess) == 0 ||
+      missing > 0) {
+    std::cout << "FAILED\n";
+    return 1;
+  }
+  std::cout << "PASSED\n";
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include "../code/mmapBuffer.h"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define THREAD_COUNT 4
+#define LOGS_PER_THREAD 50000
+#define WAIT_INTERVAL 50
+#define LIMITED_LOGS 10000
+#define FILE_SIZE_LIMIT (128 * 1024)
+#define BUFFER_BLOCK_SIZE (64 * 1024)
+
+//持久化文件和缓存块文件的基础路径
+static const char *dataPath = "ticket_test_data";
+static const char *bufferPath = "ticket_test_buffer";
+
+static int formatLine(char *line, int thread, int index) {
+  return snprintf(line, 64, "%d %d ticket test record\n", thread, index);
+}
+
+//各线程写入时不时等待自己的凭据，返回后凭据之前的数据应已出现在持久化文件的对应位置
+static bool runWaits(bool durable) {
+  remove(dataPath);
+  const std::string name = durable ? "DURABLE" : "PERSISTED";
+  auto &ins = mmapBuffer::getBufferInstance(name);
+  ins->initBuffer(dataPath, bufferPath, 4, 2, BUFFER_BLOCK_SIZE);
+  int fd = open(dataPath, O_RDONLY);
+  std::atomic<size_t> bad{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREAD_COUNT; t++) {
+    threads.emplace_back([&, t] {
+      char line[64];
+      char readBack[64];
+      for (int i = 0; i < LOGS_PER_THREAD; i++) {
+        int len = formatLine(line, t, i);
+        uint64_t ticket = 0;
+        ins->try_append(line, len, true, &ticket);
+        if (i % WAIT_INTERVAL != t) {
+          continue;
+        }
+        bool ok = durable ? ins->waitUntilDurable(ticket)
+                          : ins->waitUntilPersisted(ticket);
+        //未压缩且未分帧时凭据即为记录末尾在文件中的偏移量
+        if (!ok || ins->getPersistedOffset() < ticket ||
+            pread(fd, readBack, len, ticket - len) != len ||
+            memcmp(readBack, line, len) != 0) {
+          bad++;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  close(fd);
+  bad += ins->getPersistError() != 0;
+  mmapBuffer::removeBufferInstance(name);
+  remove(dataPath);
+
+  std::cout << (durable ? "durable" : "persisted")
+            << " waits failed: " << bad << "\n";
+  return bad == 0;
+}
+
+//限制文件长度使写出失败，等待应返回false并报告错误码，解除限制后数据在重试时写出
+static int runLimitedChild() {
+  signal(SIGXFSZ, SIG_IGN);
+  auto &ins = mmapBuffer::getBufferInstance("LIMITED");
+  ins->initBuffer(dataPath, bufferPath, 8, 2, BUFFER_BLOCK_SIZE);
+  rlimit original;
+  getrlimit(RLIMIT_FSIZE, &original);
+  rlimit limited = original;
+  limited.rlim_cur = FILE_SIZE_LIMIT;
+  setrlimit(RLIMIT_FSIZE, &limited);
+
+  //写入量小于限制与缓存容量之和，写入不会因缓存写满而阻塞
+  char line[64];
+  uint64_t ticket = 0;
+  for (int i = 0; i < LIMITED_LOGS; i++) {
+    int len = formatLine(line, 0, i);
+    ins->try_append(line, len, true, &ticket);
+  }
+  bool persisted = ins->waitUntilPersisted(ticket);
+  bool durable = ins->waitUntilDurable(ticket);
+  int err = ins->getPersistError();
+  //出错时只写出到限制之前的完整缓存块
+  bool bounded = ins->getPersistedOffset() <= FILE_SIZE_LIMIT;
+
+  setrlimit(RLIMIT_FSIZE, &original);
+  for (int i = 0; i < 100 && ins->getPersistedOffset() < ticket; i++) {
+    usleep(20000);
+  }
+  bool recovered = ins->getPersistedOffset() >= ticket;
+  mmapBuffer::removeBufferInstance("LIMITED");
+
+  struct stat st;
+  bool complete = stat(dataPath, &st) == 0 &&
+                  static_cast<uint64_t>(st.st_size) >= ticket;
+  remove(dataPath);
+  std::cout << "limited wait: " << persisted << ", durable: " << durable
+            << ", error: " << err << ", recovered: " << recovered << std::endl;
+  bool passed = !persisted && !durable && err == EFBIG && bounded &&
+                recovered && complete;
+  return passed ? 0 : 1;
+}
+
+//在子进程中运行，文件长度限制和被忽略的信号不影响其他用例
+static bool runLimited() {
+  remove(dataPath);
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(runLimitedChild());
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main() {
+  bool passed = runLimited() && runWaits(false) && runWaits(true);
+  std::cout << (passed ? "PASSED\n" : "FAILED\n");
+  return passed ? 0 : 1;
+}
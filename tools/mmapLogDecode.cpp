@@ -0,0 +1,62 @@
+#include "../code/mmapLogger.h"
+#include "../code/mmapReader.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * @brief
+ * 离线解码mmapLogger写入的二进制日志。按给定顺序读取持久化文件(轮转产生的多个文件按时间顺序给出)，
+ * 格式化后的文本输出到标准输出。
+ *
+ * 用法: logdecode [--page-size=4096] file...
+ * page-size为写入时使用的系统页面大小，与mmapReader相同
+ */
+
+int main(int argc, char **argv) {
+  size_t pageSize = 4096;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--page-size=", 12) == 0) {
+      pageSize = std::strtoull(arg + 12, nullptr, 10);
+    } else if (arg[0] == '-') {
+      fprintf(stderr, "usage: %s [--page-size=4096] file...\n", argv[0]);
+      return 1;
+    } else {
+      files.emplace_back(arg);
+    }
+  }
+  if (files.empty() || pageSize == 0) {
+    fprintf(stderr, "usage: %s [--page-size=4096] file...\n", argv[0]);
+    return 1;
+  }
+
+  int ret = 0;
+  mmapLogDecoder decoder;
+  std::string text;
+  for (const auto &file : files) {
+    mmapReader reader(file, pageSize);
+    if (!reader.isValid()) {
+      fprintf(stderr, "cannot read %s\n", file.c_str());
+      ret = 1;
+      continue;
+    }
+    std::string_view record;
+    while (reader.next(record)) {
+      //累积一批文本后再写出，减少系统调用
+      if (decoder.decode(record, text) && text.size() >= 64 * 1024) {
+        fwrite(text.data(), 1, text.size(), stdout);
+        text.clear();
+      }
+    }
+  }
+  fwrite(text.data(), 1, text.size(), stdout);
+  if (decoder.getSkippedRecords() > 0) {
+    fprintf(stderr, "skipped %zu undecodable records\n",
+            decoder.getSkippedRecords());
+  }
+  return ret;
+}
@@ -5,7 +5,55 @@ target("mmapBuffer")
 
 target("test")
     set_kind("binary")
-    add_files("test/*.cpp")
+    add_files("test/mmapBufferTest.cpp")
     add_deps("mmapBuffer")
     set_languages("cxx20")
-    add_syslinks("pthread")
\ No newline at end of file
+    add_syslinks("pthread")
+target("sharedtest")
+    set_kind("binary")
+    add_files("test/mmapSharedBufferTest.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("recoverytest")
+    set_kind("binary")
+    add_files("test/mmapRecoveryTest.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("readertest")
+    set_kind("binary")
+    add_files("test/mmapReaderTest.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("codectest")
+    set_kind("binary")
+    add_files("test/mmapCodecTest.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("tickettest")
+    set_kind("binary")
+    add_files("test/mmapTicketTest.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("rotationtest")
+    set_kind("binary")
+    add_files("test/mmapRotationTest.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("bench")
+    set_kind("binary")
+    add_files("bench/*.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")
+target("logdecode")
+    set_kind("binary")
+    add_files("tools/*.cpp")
+    add_deps("mmapBuffer")
+    set_languages("cxx20")
+    add_syslinks("pthread")